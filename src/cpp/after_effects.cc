@@ -14,19 +14,22 @@ AfterEffects::AfterEffects(GameObject *parent, Skybox* skybox)
     , skybox_(skybox) {
   engine::ShaderFile *vs = scene_->shader_manager()->get("after_effects.vert");
   engine::ShaderFile *fs = scene_->shader_manager()->get("after_effects_dof.frag");
-  if (fs->state() != gl::Shader::kCompileSuccessful) {
+  // The fallback compiles while we wait for the DoF shader
+  engine::ShaderFile *no_dof_fs =
+      scene_->shader_manager()->get("after_effects_no_dof.frag");
+  if (!fs->finishCompile()) {
     // intel doesn't support textureLoD, so no DoF :(
-    fs = scene_->shader_manager()->get("after_effects_no_dof.frag");
+    fs = no_dof_fs;
   }
 
   prog_.attachShaders(vs, fs).link();
-  gl::Use(prog_);
-
-  gl::UniformSampler(prog_, "uTex").set(0);
-  gl::UniformSampler(prog_, "uDepthTex").set(1);
-  (prog_ | "aPosition").bindLocation(rect_.kPosition);
-
-  prog_.validate();
+  prog_.setup([this]() {
+    gl::Use(prog_);
+    gl::UniformSampler(prog_, "uTex").set(0);
+    gl::UniformSampler(prog_, "uDepthTex").set(1);
+    prog_.bindAttribLocation("aPosition", rect_.kPosition);
+    prog_.validate();
+  });
 
   gl::Bind(color_tex_);
   color_tex_.upload(gl::kRgb, 1, 1, gl::kRgb, gl::kFloat, nullptr);
@@ -51,8 +54,10 @@ AfterEffects::AfterEffects(GameObject *parent, Skybox* skybox)
 void AfterEffects::screenResized(size_t w, size_t h) {
   width_ = w;
   height_ = h;
-  gl::Use(prog_);
-  uScreenSize_ = glm::vec2(w, h);
+  prog_.setup([this]() {
+    gl::Use(prog_);
+    uScreenSize_ = glm::vec2(width_, height_);
+  });
 
   gl::Bind(color_tex_);
   color_tex_.upload(gl::kRgb, width_, height_, gl::kRgb, gl::kFloat, nullptr);
@@ -72,11 +77,11 @@ void AfterEffects::update() {
 void AfterEffects::render() {
   gl::Unbind(gl::kFramebuffer);
 
-  gl::BindToTexUnit(color_tex_, 0);
+  engine::GlState::BindTexture(0, color_tex_);
   color_tex_.generateMipmap();
-  gl::BindToTexUnit(depth_tex_, 1);
+  engine::GlState::BindTexture(1, depth_tex_);
 
-  gl::Use(prog_);
+  engine::GlState::Use(prog_);
   prog_.update();
 
   auto cam = scene_->camera();
@@ -91,6 +96,7 @@ void AfterEffects::render() {
 
   rect_.render();
 
-  gl::UnbindFromTexUnit(depth_tex_, 1);
-  gl::UnbindFromTexUnit(color_tex_, 0);
+  // They are rendered to in the next frame
+  engine::GlState::BindTexture(1, 0);
+  engine::GlState::BindTexture(0, 0);
 }
@@ -2,34 +2,89 @@
 
 #include "./ayumi.h"
 
+#include <map>
 #include <string>
 #include "engine/oglwrap_config.h"
 #include <GLFW/glfw3.h>
 
+#include "engine/misc.h"
 #include "engine/scene.h"
 
 using engine::AnimParams;
 
 engine::ShaderFile* Ayumi::loadVertexShader(engine::ShaderManager* manager) {
+  // The skinning module is included by all the vertex shaders
+  gl::ShaderSource skinning_src("engine/skinning.vert");
+  skinning_src.insertMacroValue("BONE_ATTRIB_NUM", mesh_.getBoneAttribNum());
+  skinning_src.insertMacroValue("BONE_NUM", mesh_.getNumBones());
+  skinning_src.insertMacroValue("DUAL_QUATERNION_SKINNING",
+      mesh_.getSkinningMode() == engine::SkinningMode::DualQuaternion);
+  skinning_src.insertMacroValue("BONE_PALETTE_UBO", palette_ubo_);
+  manager->publish("engine/skinning.vert", skinning_src);
+
   gl::ShaderSource vs_src("ayumi.vert");
-  vs_src.insertMacroValue("BONE_ATTRIB_NUM", mesh_.getBoneAttribNum());
-  vs_src.insertMacroValue("BONE_NUM", mesh_.getNumBones());
+  vs_src.insertMacroValue("PRE_SKINNED", pre_skinned_);
   return manager->publish("ayumi.vert", vs_src);
 }
 
 engine::ShaderFile* Ayumi::loadShadowVertexShader(
     engine::ShaderManager* manager) {
   gl::ShaderSource shadow_vs_src("ayumi_shadow.vert");
-  shadow_vs_src.insertMacroValue("BONE_ATTRIB_NUM", mesh_.getBoneAttribNum());
-  shadow_vs_src.insertMacroValue("BONE_NUM", mesh_.getNumBones());
+  shadow_vs_src.insertMacroValue("PRE_SKINNED", pre_skinned_);
   return manager->publish("ayumi_shadow.vert", shadow_vs_src);
 }
 
-Ayumi::Ayumi(engine::GameObject* parent)
+void Ayumi::loadSkinningProgram(engine::ShaderManager* manager) {
+  // The captured varyings have to be specified before linking
+  skinning_prog_.attachShaders(manager->get("ayumi_skinning.vert"));
+  engine::AnimatedMeshRenderer::setupSkinningProgram(&skinning_prog_);
+  skinning_prog_.link();
+}
+
+static const char* kMeshFile = "src/resources/models/ayumi/ayumi.dae";
+static const std::string kAnimationDir = "src/resources/models/ayumi/";
+
+// Every animation file is loaded only once, even if more animations use it.
+static const char* kAnimationFiles[] = {
+  "src/resources/models/ayumi/ayumi_idle.dae",
+  "src/resources/models/ayumi/ayumi_walk.dae",
+  "src/resources/models/ayumi/ayumi_run.dae",
+  "src/resources/models/ayumi/ayumi_jump_rise.dae",
+  "src/resources/models/ayumi/ayumi_jump_fall.dae",
+  "src/resources/models/ayumi/ayumi_flip.dae",
+  "src/resources/models/ayumi/ayumi_attack.dae",
+  "src/resources/models/ayumi/ayumi_attack2.dae",
+  "src/resources/models/ayumi/ayumi_attack3.dae",
+  "src/resources/models/ayumi/ayumi_attack_chain0.dae"
+};
+
+Ayumi::Assets Ayumi::LoadAssets(engine::AsyncLoader* loader) {
+  Assets assets;
+  assets.mesh = loader->run([loader]() {
+    engine::ImportedScene imported = engine::ImportedScene::Import(
+        kMeshFile, aiProcessPreset_TargetRealtime_Quality | aiProcess_FlipUVs);
+    imported.loadTextures(loader, aiTextureType_DIFFUSE, true);
+    imported.loadTextures(loader, aiTextureType_SPECULAR, false);
+    return imported;
+  });
+  for (const char* filename : kAnimationFiles) {
+    assets.clips[filename] = loader->run([filename]() {
+      return engine::AnimatedMeshRenderer::loadClip(filename);
+    });
+  }
+
+  return assets;
+}
+
+Ayumi::Ayumi(engine::GameObject* parent, Assets assets)
     : engine::GameObject(parent)
-    , mesh_("src/resources/models/ayumi/ayumi.dae",
-            aiProcessPreset_TargetRealtime_Quality | aiProcess_FlipUVs)
+    , mesh_(assets.mesh.get(), 4, engine::SkinningMode::DualQuaternion)
     , anim_(mesh_.getAnimData())
+    , pre_skinned_(engine::AnimatedMeshRenderer::isPreSkinningSupported())
+    , palette_ubo_(engine::BonePaletteBuffer::IsSupported() &&
+                   mesh_.getNumBones() *
+                       engine::PaletteVectorsPerBone(mesh_.getSkinningMode())
+                   <= engine::BonePaletteBuffer::MaxVectors())
     , prog_(loadVertexShader(scene_->shader_manager()),
             scene_->shader_manager()->get("ayumi.frag"))
     , shadow_prog_(loadShadowVertexShader(scene_->shader_manager()),
@@ -37,64 +92,111 @@ Ayumi::Ayumi(engine::GameObject* parent)
     , uProjectionMatrix_(prog_, "uProjectionMatrix")
     , uCameraMatrix_(prog_, "uCameraMatrix")
     , uModelMatrix_(prog_, "uModelMatrix")
-    , uBones_(prog_, "uBones")
     , shadow_uMCP_(shadow_prog_, "uMCP")
+    , uBones_(prog_, "uBones")
     , shadow_uBones_(shadow_prog_, "uBones")
+    , skinning_uBones_(skinning_prog_, "uBones")
     , attack2_(false)
     , attack3_(false)
     , was_left_click_(false)
+    , left_button_down_(false)
+    , walk_key_down_(false)
     , charmove_(nullptr)
     , bsphere_(mesh_.bSphere()) {
-  gl::Use(prog_);
-
-  mesh_.setupPositions(prog_ | "aPosition");
-  mesh_.setupTexCoords(prog_ | "aTexCoord");
-  mesh_.setupNormals(prog_ | "aNormal");
-  gl::LazyVertexAttrib boneIDs(prog_, "aBoneIDs", false);
-  gl::LazyVertexAttrib weights(prog_, "aWeights", false);
-  mesh_.setupBones(boneIDs, weights, false);
+  if (pre_skinned_) {
+    loadSkinningProgram(scene_->shader_manager());
+  }
 
   mesh_.setupDiffuseTextures(1);
   mesh_.setupSpecularTextures(2);
-  gl::UniformSampler(prog_, "uDiffuseTexture").set(1);
-  gl::UniformSampler(prog_, "uSpecularTexture").set(2);
 
-  prog_.validate();
+  // The skinning program is linked after prog_, but querying it only waits
+  // for its link, that was issued together with the others.
+  prog_.setup([this]() {
+    if (pre_skinned_) {
+      gl::Use(skinning_prog_);
+
+      // The bind pose goes into the skinning pass, and
+      // the other passes only read the skinned vertices.
+      mesh_.setupPositions(skinning_prog_ | "aPosition");
+      mesh_.setupNormals(skinning_prog_ | "aNormal");
+      gl::LazyVertexAttrib boneIDs(skinning_prog_, "aBoneIDs", false);
+      gl::LazyVertexAttrib weights(skinning_prog_, "aWeights", false);
+      mesh_.setupBones(boneIDs, weights, false);
+
+      gl::Use(prog_);
+      mesh_.setupTexCoords(prog_ | "aTexCoord");
+      mesh_.setupSkinnedVertices(skinned_vertices_, prog_ | "aPosition",
+                                 prog_ | "aNormal", prog_ | "aTexCoord");
+    } else {
+      gl::Use(prog_);
+
+      mesh_.setupPositions(prog_ | "aPosition");
+      mesh_.setupTexCoords(prog_ | "aTexCoord");
+      mesh_.setupNormals(prog_ | "aNormal");
+      gl::LazyVertexAttrib boneIDs(prog_, "aBoneIDs", false);
+      gl::LazyVertexAttrib weights(prog_, "aWeights", false);
+      mesh_.setupBones(boneIDs, weights, false);
+    }
+
+    if (palette_ubo_) {
+      bone_palette_.bindBlock(prog_);
+      bone_palette_.bindBlock(shadow_prog_);
+      if (pre_skinned_) {
+        bone_palette_.bindBlock(skinning_prog_);
+      }
+    }
+
+    gl::UniformSampler(prog_, "uDiffuseTexture").set(1);
+    gl::UniformSampler(prog_, "uSpecularTexture").set(2);
+
+    prog_.validate();
+  });
 
   using engine::AnimFlag;
 
-  mesh_.addAnimation("src/resources/models/ayumi/ayumi_idle.dae", "Stand",
+  std::map<std::string, std::unique_ptr<engine::BakedClip>> clips;
+  for (auto& loaded_clip : assets.clips) {
+    clips[loaded_clip.first] = loaded_clip.second.get();
+  }
+  // Every animation gets its own copy of the clip
+  auto clip = [&clips](const std::string& filename) {
+    return engine::make_unique<engine::BakedClip>(*clips.at(filename));
+  };
+
+  mesh_.addAnimation(clip(kAnimationDir + "ayumi_idle.dae"), "Stand",
                      {AnimFlag::Repeat, AnimFlag::Interruptable});
 
-  mesh_.addAnimation("src/resources/models/ayumi/ayumi_walk.dae", "Walk",
+  mesh_.addAnimation(clip(kAnimationDir + "ayumi_walk.dae"), "Walk",
                      {AnimFlag::Repeat, AnimFlag::Interruptable});
 
-  mesh_.addAnimation("src/resources/models/ayumi/ayumi_walk.dae", "MoonWalk",
+  mesh_.addAnimation(clip(kAnimationDir + "ayumi_walk.dae"), "MoonWalk",
                      {AnimFlag::Repeat, AnimFlag::Mirrored,
                      AnimFlag::Interruptable});
 
-  mesh_.addAnimation("src/resources/models/ayumi/ayumi_run.dae", "Run",
+  mesh_.addAnimation(clip(kAnimationDir + "ayumi_run.dae"), "Run",
                      {AnimFlag::Repeat, AnimFlag::Interruptable});
 
-  mesh_.addAnimation("src/resources/models/ayumi/ayumi_jump_rise.dae", "JumpRise",
+  mesh_.addAnimation(clip(kAnimationDir + "ayumi_jump_rise.dae"), "JumpRise",
                      {AnimFlag::MirroredRepeat, AnimFlag::Interruptable}, 0.5f);
 
-  mesh_.addAnimation("src/resources/models/ayumi/ayumi_jump_fall.dae", "JumpFall",
+  mesh_.addAnimation(clip(kAnimationDir + "ayumi_jump_fall.dae"), "JumpFall",
                      {AnimFlag::MirroredRepeat, AnimFlag::Interruptable}, 0.5f);
 
-  mesh_.addAnimation("src/resources/models/ayumi/ayumi_flip.dae", "Flip",
+  mesh_.addAnimation(clip(kAnimationDir + "ayumi_flip.dae"), "Flip",
                      AnimFlag::None, 1.5f);
 
-  mesh_.addAnimation("src/resources/models/ayumi/ayumi_attack.dae", "Attack",
+  mesh_.addAnimation(clip(kAnimationDir + "ayumi_attack.dae"), "Attack",
                      AnimFlag::None, 2.5f);
 
-  mesh_.addAnimation("src/resources/models/ayumi/ayumi_attack2.dae", "Attack2",
+  mesh_.addAnimation(clip(kAnimationDir + "ayumi_attack2.dae"), "Attack2",
                      AnimFlag::None, 1.4f);
 
-  mesh_.addAnimation("src/resources/models/ayumi/ayumi_attack3.dae", "Attack3",
+  mesh_.addAnimation(clip(kAnimationDir + "ayumi_attack3.dae"), "Attack3",
                      AnimFlag::None, 3.0f);
 
-  mesh_.addAnimation("src/resources/models/ayumi/ayumi_attack_chain0.dae", "Attack_Chain0",
+  mesh_.addAnimation(clip(kAnimationDir + "ayumi_attack_chain0.dae"),
+                     "Attack_Chain0",
                      AnimFlag::None, 0.9f);
 
   anim_.setDefaultAnimation("Stand", 0.3f);
@@ -102,6 +204,13 @@ Ayumi::Ayumi(engine::GameObject* parent)
 
   anim_.setAnimationEndedCallback(
     [this](const std::string& str){return animationEndedCallback(str);});
+
+  // The scene updates the pose before every update()
+  scene_->crowd_animator()->addInstance(&mesh_, &anim_);
+}
+
+Ayumi::~Ayumi() {
+  scene_->crowd_animator()->removeInstance(&anim_);
 }
 
 engine::AnimatedMeshRenderer& Ayumi::getMesh() {
@@ -115,6 +224,11 @@ engine::Animation& Ayumi::getAnimation() {
 void Ayumi::update() {
   float time = scene_->game_time().current;
 
+  left_button_down_ = glfwGetMouseButton(scene_->window(),
+                                         GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+  walk_key_down_ =
+      glfwGetKey(scene_->window(), GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS;
+
   std::string curr_anim = anim_.getCurrentAnimation();
 
   using engine::AnimParams;
@@ -146,7 +260,7 @@ void Ayumi::update() {
     }
   } else {
     if (charmove_->isWalking()) {
-      if (glfwGetKey(scene_->window(), GLFW_KEY_LEFT_SHIFT) == GLFW_RELEASE) {
+      if (!walk_key_down_) {
         anim_.setCurrentAnimation(AnimParams("Run", 0.3f), time);
       } else {
         anim_.setCurrentAnimation(AnimParams("Walk", 0.3f), time);
@@ -156,43 +270,76 @@ void Ayumi::update() {
     }
   }
 
-  mesh_.updateBoneInfo(anim_, time);
+  // The farther she is, the less often her pose has to be evaluated
+  const engine::Camera& cam = *scene_->camera();
+  glm::vec4 bsphere =
+      mesh_.bSphere(transform()->matrix() * mesh_.worldTransform());
+  float distance = glm::length(glm::vec3(bsphere) - cam.transform()->pos());
+  anim_.setLod(engine::AnimLod::ForDistance(bsphere.w, distance, cam.fovy()));
+
+  // The animation chosen above is only posed at the next update, the pose
+  // for this frame was already updated by the scene's CrowdAnimator.
+  if (palette_ubo_) {
+    mesh_.uploadBoneInfo(anim_, bone_palette_);
+  }
+
+  if (pre_skinned_) {
+    engine::GlState::Use(skinning_prog_);
+    if (!palette_ubo_) {
+      mesh_.uploadBoneInfo(anim_, skinning_uBones_);
+    }
+    mesh_.skinVertices(skinned_vertices_);
+  }
 }
 
 void Ayumi::shadowRender() {
-  gl::Use(shadow_prog_);
+  engine::GlState::Use(shadow_prog_);
   shadow_uMCP_ =
     scene_->shadow()->modelCamProjMat(bsphere_, transform()->matrix(),
                                      mesh_.worldTransform());
-  mesh_.uploadBoneInfo(shadow_uBones_);
-
-  gl::CullFace(gl::kFront);
-  gl::FrontFace(gl::kCcw);
-  gl::TemporaryEnable cullface{gl::kCullFace};
+  engine::GlState::CullFace(GL_FRONT);
+  engine::GlState::FrontFace(GL_CCW);
+  engine::GlState::TemporarySet cullface{{{GL_CULL_FACE, true}}};
   mesh_.disableTextures();
 
-  mesh_.render();
+  if (pre_skinned_) {
+    mesh_.render(skinned_vertices_);
+  } else {
+    if (palette_ubo_) {
+      bone_palette_.bind();
+    } else {
+      mesh_.uploadBoneInfo(anim_, shadow_uBones_);
+    }
+    mesh_.render();
+  }
 
   mesh_.enableTextures();
-  gl::CullFace(gl::kBack);
+  engine::GlState::CullFace(GL_BACK);
 
   scene_->shadow()->push();
 }
 
 void Ayumi::render() {
-  gl::Use(prog_);
+  engine::GlState::Use(prog_);
   prog_.update();
   const auto& cam = *scene_->camera();
   uCameraMatrix_ = cam.cameraMatrix();
   uProjectionMatrix_ = cam.projectionMatrix();
   uModelMatrix_ = transform()->matrix() * mesh_.worldTransform();
 
-  mesh_.uploadBoneInfo(uBones_);
-
-  gl::FrontFace(gl::kCcw);
-  gl::TemporaryEnable cullface{gl::kCullFace};
+  engine::GlState::FrontFace(GL_CCW);
+  engine::GlState::TemporarySet cullface{{{GL_CULL_FACE, true}}};
 
-  mesh_.render();
+  if (pre_skinned_) {
+    mesh_.render(skinned_vertices_);
+  } else {
+    if (palette_ubo_) {
+      bone_palette_.bind();
+    } else {
+      mesh_.uploadBoneInfo(anim_, uBones_);
+    }
+    mesh_.render();
+  }
 }
 
 bool Ayumi::canJump() {
@@ -205,14 +352,12 @@ bool Ayumi::canFlip() {
 
 AnimParams Ayumi::animationEndedCallback(const std::string& current_anim) {
   if (current_anim == "Attack") {
-    if (attack2_ || glfwGetMouseButton(scene_->window(), GLFW_MOUSE_BUTTON_LEFT)
-          == GLFW_PRESS) {
+    if (attack2_ || left_button_down_) {
       return AnimParams("Attack2", 0.1f);
     }
   } else if (current_anim == "Attack2") {
     attack2_ = false;
-    if (attack3_ || glfwGetMouseButton(scene_->window(), GLFW_MOUSE_BUTTON_LEFT)
-          == GLFW_PRESS) {
+    if (attack3_ || left_button_down_) {
       return AnimParams("Attack3", 0.05f);
     }
   } else if (current_anim == "Attack3") {
@@ -240,7 +385,7 @@ AnimParams Ayumi::animationEndedCallback(const std::string& current_anim) {
     } else {
       params.transition_time = 0.3f;
     }
-    if (glfwGetKey(scene_->window(), GLFW_KEY_LEFT_SHIFT) == GLFW_RELEASE) {
+    if (!walk_key_down_) {
       params.name = "Run";
       return params;
     } else {
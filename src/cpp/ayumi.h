@@ -3,7 +3,13 @@
 #ifndef LOD_INCLUDE_AYUMI_H_
 #define LOD_INCLUDE_AYUMI_H_
 
+#include <map>
+#include <memory>
+#include <string>
+#include <future>
+
 #include "engine/game_object.h"
+#include "engine/async_loader.h"
 #include "engine/shader_manager.h"
 #include "engine/mesh/animated_mesh_renderer.h"
 
@@ -13,8 +19,19 @@
 
 class Ayumi : public engine::GameObject {
  public:
-  explicit Ayumi(GameObject* parent);
-  virtual ~Ayumi() {}
+  /// The assets that are loaded on worker threads.
+  struct Assets {
+    std::future<engine::ImportedScene> mesh;
+    /// The baked animation clips, by file name.
+    std::map<std::string,
+             std::future<std::unique_ptr<engine::BakedClip>>> clips;
+  };
+
+  /// Starts loading the mesh, its textures and the animations.
+  static Assets LoadAssets(engine::AsyncLoader* loader);
+
+  Ayumi(GameObject* parent, Assets assets);
+  virtual ~Ayumi();
 
   engine::AnimatedMeshRenderer& getMesh();
   engine::Animation& getAnimation();
@@ -27,15 +44,32 @@ class Ayumi : public engine::GameObject {
   }
 
  private:
+  // Skinned with dual quaternions, so the twisted joints keep their volume.
   engine::AnimatedMeshRenderer mesh_;
   engine::Animation anim_;
-  engine::ShaderProgram prog_, shadow_prog_;
+
+  // If it's supported, the vertices are skinned once per frame into
+  // skinned_vertices_, and both passes draw those.
+  bool pre_skinned_;
+  engine::SkinnedVertices skinned_vertices_;
+
+  // If it's supported, the palette is uploaded once per frame into
+  // bone_palette_, and all the programs read it from there. Otherwise it's
+  // uploaded into each program's uBones.
+  bool palette_ubo_;
+  engine::BonePaletteBuffer bone_palette_;
+
+  engine::ShaderProgram prog_, shadow_prog_, skinning_prog_;
 
   gl::LazyUniform<glm::mat4> uProjectionMatrix_, uCameraMatrix_,
-                             uModelMatrix_, uBones_,
-                             shadow_uMCP_, shadow_uBones_;
+                             uModelMatrix_, shadow_uMCP_;
+  engine::BonePaletteUniform uBones_, shadow_uBones_, skinning_uBones_;
 
   bool attack2_, attack3_, was_left_click_;
+
+  // The input, as it was at the last update. The animation ended callback
+  // runs on the scene's CrowdAnimator threads, that can't query GLFW.
+  bool left_button_down_, walk_key_down_;
   CharacterMovement *charmove_;
 
   glm::vec4 bsphere_;
@@ -46,6 +80,7 @@ class Ayumi : public engine::GameObject {
 
   engine::ShaderFile* loadVertexShader(engine::ShaderManager* manager);
   engine::ShaderFile* loadShadowVertexShader(engine::ShaderManager* manager);
+  void loadSkinningProgram(engine::ShaderManager* manager);
 
   virtual void update() override;
   virtual void shadowRender() override;
@@ -0,0 +1,152 @@
+// Copyright (c) 2014, Tamas Csala
+
+#include "./crowd.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <string>
+
+#include "engine/misc.h"
+#include "engine/scene.h"
+
+static const char* kMeshFile = "src/resources/models/ayumi/ayumi.dae";
+
+// The animations, that look fine without moving the characters
+static const struct {
+  const char* filename;
+  const char* name;
+  float speed;
+} kAnimations[] = {
+  {"src/resources/models/ayumi/ayumi_idle.dae", "Stand", 1.0f},
+  {"src/resources/models/ayumi/ayumi_attack.dae", "Attack", 1.0f},
+  {"src/resources/models/ayumi/ayumi_attack2.dae", "Attack2", 0.7f},
+  {"src/resources/models/ayumi/ayumi_attack3.dae", "Attack3", 1.5f}
+};
+
+static const int kCharacterCount = 256;
+static const float kMinDistance = 40.0f, kMaxDistance = 250.0f;
+static const float kDrawDistance = 600.0f;
+
+Crowd::Assets Crowd::LoadAssets(engine::AsyncLoader* loader) {
+  Assets assets;
+  assets.mesh = loader->run([loader]() {
+    engine::ImportedScene imported = engine::ImportedScene::Import(
+        kMeshFile, aiProcessPreset_TargetRealtime_Quality | aiProcess_FlipUVs);
+    imported.loadTextures(loader, aiTextureType_DIFFUSE, true);
+    imported.loadTextures(loader, aiTextureType_SPECULAR, false);
+    return imported;
+  });
+  for (const auto& anim : kAnimations) {
+    const char* filename = anim.filename;
+    assets.clips[filename] = loader->run([filename]() {
+      return engine::AnimatedMeshRenderer::loadClip(filename);
+    });
+  }
+
+  return assets;
+}
+
+engine::ShaderFile* Crowd::loadVertexShader(engine::ShaderManager* manager) {
+  gl::ShaderSource src("engine/vertex_animation.vert");
+  src.insertMacroValue("BONE_ATTRIB_NUM", mesh_.getBoneAttribNum());
+  manager->publish("engine/vertex_animation.vert", src);
+
+  return manager->get("crowd.vert");
+}
+
+Crowd::Crowd(GameObject* parent, const engine::HeightMapInterface& height_map,
+             Assets assets)
+    : GameObject(parent)
+    , mesh_(assets.mesh.get())
+    , prog_(loadVertexShader(scene_->shader_manager()),
+            scene_->shader_manager()->get("ayumi.frag"))
+    , uProjectionMatrix_(prog_, "uProjectionMatrix")
+    , uCameraMatrix_(prog_, "uCameraMatrix")
+    , uTime_(prog_, "VertexAnimation_uTime") {
+  for (const auto& anim : kAnimations) {
+    mesh_.addAnimation(assets.clips.at(anim.filename).get(), anim.name,
+                       engine::AnimFlag::Repeat, anim.speed);
+  }
+  anim_texture_ = engine::make_unique<engine::AnimationTexture>(mesh_);
+
+  mesh_.setupDiffuseTextures(1);
+  mesh_.setupSpecularTextures(2);
+
+  prog_.setup([this]() {
+    gl::Use(prog_);
+
+    // The instances' VAOs are copied from the regular ones, so those have
+    // to be set up first.
+    mesh_.setupPositions(prog_ | "aPosition");
+    mesh_.setupTexCoords(prog_ | "aTexCoord");
+    mesh_.setupNormals(prog_ | "aNormal");
+    gl::LazyVertexAttrib boneIDs(prog_, "aBoneIDs", false);
+    gl::LazyVertexAttrib weights(prog_, "aWeights", false);
+    mesh_.setupBones(boneIDs, weights, false);
+    mesh_.setupInstances(
+        gl::LazyVertexAttrib(prog_, "VertexAnimation_aTransform"),
+        prog_ | "VertexAnimation_aAnimation");
+
+    gl::UniformSampler(prog_, "uDiffuseTexture").set(1);
+    gl::UniformSampler(prog_, "uSpecularTexture").set(2);
+    gl::UniformSampler(prog_, "VertexAnimation_uTexture").set(3);
+    gl::Uniform<glm::vec2>(prog_, "VertexAnimation_uTexSize") =
+        anim_texture_->size();
+
+    prog_.validate();
+  });
+
+  // Scatter them around the center, where the player starts, facing her.
+  glm::vec2 center = height_map.center();
+  size_t anim_count = sizeof(kAnimations) / sizeof(kAnimations[0]);
+  for (int i = 0; i < kCharacterCount; ++i) {
+    float angle = 2*M_PI * rand() / RAND_MAX;
+    float distance = kMinDistance +
+        (kMaxDistance - kMinDistance) * rand() / RAND_MAX;
+    glm::vec2 coord = center + distance * glm::vec2(cos(angle), sin(angle));
+    glm::vec3 pos =
+        glm::vec3(coord.x, height_map.heightAt(coord.x, coord.y), coord.y);
+
+    glm::vec2 to_center = center - coord;
+    float rotation = atan2(to_center.x, to_center.y);
+    glm::mat4 matrix = glm::rotate(glm::mat4(), rotation, glm::vec3(0, 1, 0));
+    matrix[3] = glm::vec4(pos, 1);
+    matrix = matrix * mesh_.worldTransform();
+
+    const char* anim_name = kAnimations[rand() % anim_count].name;
+    float time_offset = 10.0f * rand() / RAND_MAX;
+
+    characters_.push_back(CharacterInfo{
+        anim_texture_->makeInstance(matrix, anim_name, time_offset),
+        mesh_.boundingBox(matrix)});
+  }
+}
+
+void Crowd::render() {
+  const auto& cam = *scene_->camera();
+  auto campos = cam.transform()->pos();
+  auto frustum = cam.frustum();
+
+  visible_instances_.clear();
+  for (const CharacterInfo& character : characters_) {
+    if (character.bbox.collidesWithFrustum(frustum) &&
+        glm::length(character.bbox.center() - campos) < kDrawDistance) {
+      visible_instances_.push_back(character.instance);
+    }
+  }
+  if (visible_instances_.empty()) {
+    return;
+  }
+
+  engine::GlState::Use(prog_);
+  prog_.update();
+  uCameraMatrix_ = cam.cameraMatrix();
+  uProjectionMatrix_ = cam.projectionMatrix();
+  uTime_ = scene_->game_time().current;
+
+  engine::GlState::FrontFace(GL_CCW);
+  engine::GlState::TemporarySet cullface{{{GL_CULL_FACE, true}}};
+  engine::GlState::BindTexture(3, anim_texture_->texture());
+
+  mesh_.renderInstances(visible_instances_);
+}
@@ -0,0 +1,64 @@
+// Copyright (c) 2014, Tamas Csala
+
+#ifndef LOD_CROWD_H_
+#define LOD_CROWD_H_
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <future>
+
+#include "engine/oglwrap_config.h"
+#include "engine/game_object.h"
+#include "engine/async_loader.h"
+#include "engine/shader_manager.h"
+#include "engine/height_map_interface.h"
+#include "engine/mesh/animated_mesh_renderer.h"
+#include "engine/mesh/animation_texture.h"
+
+/// A lot of characters standing around, drawn with a single instanced draw
+/// call per mesh. Their animations are baked into an AnimationTexture, and
+/// played back in the vertex shader, so they don't cost any CPU time.
+class Crowd : public engine::GameObject {
+ public:
+  /// The assets that are loaded on worker threads.
+  struct Assets {
+    std::future<engine::ImportedScene> mesh;
+    /// The baked animation clips, by file name.
+    std::map<std::string,
+             std::future<std::unique_ptr<engine::BakedClip>>> clips;
+  };
+
+  /// Starts loading the mesh, its textures and the animations.
+  static Assets LoadAssets(engine::AsyncLoader* loader);
+
+  Crowd(GameObject* parent, const engine::HeightMapInterface& height_map,
+        Assets assets);
+  virtual ~Crowd() {}
+
+ private:
+  engine::AnimatedMeshRenderer mesh_;
+  std::unique_ptr<engine::AnimationTexture> anim_texture_;
+  engine::ShaderProgram prog_;
+
+  gl::LazyUniform<glm::mat4> uProjectionMatrix_, uCameraMatrix_;
+  gl::LazyUniform<float> uTime_;
+
+  struct CharacterInfo {
+    engine::VertexAnimationInstance instance;
+    engine::BoundingBox bbox;
+  };
+
+  std::vector<CharacterInfo> characters_;
+
+  // The instances that are drawn in the current frame. It's only a member
+  // to avoid the reallocations.
+  std::vector<engine::VertexAnimationInstance> visible_instances_;
+
+  engine::ShaderFile* loadVertexShader(engine::ShaderManager* manager);
+
+  virtual void render() override;
+};
+
+#endif  // LOD_CROWD_H_
@@ -11,6 +11,7 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
 
 // Conversion between assimp and glm matrices
 
@@ -28,6 +29,18 @@ static inline glm::mat4 convertMatrix(const aiMatrix3x3& m) {
   return glm::mat4(glm::transpose(glm::make_mat3(&m.a1)));
 }
 
+/// Converts an assimp aiVector3D to glm vec3
+/// @param v - the vector to convert
+static inline glm::vec3 convertVector(const aiVector3D& v) {
+  return glm::vec3(v.x, v.y, v.z);
+}
+
+/// Converts an assimp aiQuaternion to glm quat
+/// @param q - the quaternion to convert
+static inline glm::quat convertQuaternion(const aiQuaternion& q) {
+  return glm::quat(q.w, q.x, q.y, q.z);
+}
+
 /// Converts a glm mat4 to an assimp aiMatrix4x4
 /// @param m - the matrix to convert
 static inline aiMatrix4x4 convertMatrix(const glm::mat4& m) {
@@ -0,0 +1,32 @@
+// Copyright (c) 2014, Tamas Csala
+
+#ifndef ENGINE_ASYNC_LOADER_INL_H_
+#define ENGINE_ASYNC_LOADER_INL_H_
+
+#include <memory>
+#include "./async_loader.h"
+
+namespace engine {
+
+template <typename Function>
+std::future<typename std::result_of<Function()>::type>
+AsyncLoader::run(Function function) {
+  using Result = typename std::result_of<Function()>::type;
+
+  // std::function needs a copyable callable, but packaged_task isn't one
+  auto task = std::make_shared<std::packaged_task<Result()>>(
+      std::move(function));
+  std::future<Result> future = task->get_future();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    jobs_.push_back([task]() { (*task)(); });
+    ++pending_jobs_;
+  }
+  job_ready_.notify_one();
+
+  return future;
+}
+
+}  // namespace engine
+
+#endif
@@ -0,0 +1,99 @@
+// Copyright (c) 2014, Tamas Csala
+
+#include "./async_loader.h"
+
+#include <chrono>
+#include <algorithm>
+
+namespace engine {
+
+AsyncLoader::AsyncLoader(unsigned thread_count)
+    : pending_jobs_(0)
+    , should_quit_(false) {
+  // hardware_concurrency() might return 0, but at least one worker is needed
+  for (unsigned i = 0; i < std::max(thread_count, 1u); ++i) {
+    workers_.emplace_back([this](){ workerLoop(); });
+  }
+}
+
+AsyncLoader::~AsyncLoader() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    should_quit_ = true;
+  }
+  job_ready_.notify_all();
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+}
+
+void AsyncLoader::workerLoop() {
+  while (true) {
+    std::function<void()> job;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      job_ready_.wait(lock, [this]() {
+        return should_quit_ || !jobs_.empty();
+      });
+      if (should_quit_) { return; }
+      job = std::move(jobs_.front());
+      jobs_.pop_front();
+    }
+
+    // The exceptions are stored in the job's future
+    job();
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      --pending_jobs_;
+    }
+    main_thread_wakeup_.notify_one();
+  }
+}
+
+void AsyncLoader::runOnMainThread(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    main_thread_tasks_.push_back(std::move(task));
+  }
+  main_thread_wakeup_.notify_one();
+}
+
+void AsyncLoader::processMainThreadTasks(double max_seconds) {
+  using Clock = std::chrono::steady_clock;
+  Clock::time_point end = Clock::now() +
+    std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(max_seconds));
+
+  do {
+    std::function<void()> task;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (main_thread_tasks_.empty()) { return; }
+      task = std::move(main_thread_tasks_.front());
+      main_thread_tasks_.pop_front();
+    }
+    task();
+  } while (Clock::now() < end);
+}
+
+void AsyncLoader::finish(const std::function<void()>& idle,
+                         double time_slice) {
+  while (true) {
+    processMainThreadTasks(time_slice);
+    if (idle) { idle(); }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (pending_jobs_ == 0 && main_thread_tasks_.empty()) {
+      return;
+    }
+    if (main_thread_tasks_.empty()) {
+      // Wake up for the next task, or at the end of the time slice (the
+      // idle callback might want to animate something).
+      main_thread_wakeup_.wait_for(lock,
+                                   std::chrono::duration<double>(time_slice));
+    }
+  }
+}
+
+}  // namespace engine
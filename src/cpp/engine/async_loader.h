@@ -0,0 +1,69 @@
+// Copyright (c) 2014, Tamas Csala
+
+#ifndef ENGINE_ASYNC_LOADER_H_
+#define ENGINE_ASYNC_LOADER_H_
+
+#include <deque>
+#include <mutex>
+#include <future>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <type_traits>
+#include <condition_variable>
+
+namespace engine {
+
+/// Loads assets on worker threads, while the main thread keeps working.
+/** The jobs run on the worker threads shouldn't use OpenGL, as the context
+  * belongs to the main thread. If a job has to upload something, it can
+  * queue a task with runOnMainThread(), which will be executed by the main
+  * thread, in small time slices, so it can keep drawing a loading screen. */
+class AsyncLoader {
+ public:
+  /// Starts the worker threads.
+  explicit AsyncLoader(
+      unsigned thread_count = std::thread::hardware_concurrency());
+  ~AsyncLoader();
+
+  template <typename Function>
+  /// Runs a function on a worker thread.
+  /** The returned future gets the function's result, or its exception. */
+  std::future<typename std::result_of<Function()>::type> run(Function function);
+
+  /// Queues a task to be executed on the main thread (for ex. an upload to
+  /// OpenGL). It can be called from any thread.
+  void runOnMainThread(std::function<void()> task);
+
+  /// Executes the queued main thread tasks until there's none left, or
+  /// until the time runs out (but it executes at least one task).
+  void processMainThreadTasks(double max_seconds);
+
+  /// Waits until every job, and every main thread task is done.
+  /** @param idle - Called after every time slice of main thread tasks, for
+    *               ex. to redraw the loading screen.
+    * @param time_slice - The length of a time slice in seconds. */
+  void finish(const std::function<void()>& idle = nullptr,
+              double time_slice = 1.0 / 60.0);
+
+ private:
+  std::vector<std::thread> workers_;
+  std::deque<std::function<void()>> jobs_, main_thread_tasks_;
+
+  std::mutex mutex_;
+  std::condition_variable job_ready_, main_thread_wakeup_;
+  /// The number of the jobs that are queued or running.
+  unsigned pending_jobs_;
+  bool should_quit_;
+
+  void workerLoop();
+
+  AsyncLoader(const AsyncLoader&) = delete;
+  AsyncLoader& operator=(const AsyncLoader&) = delete;
+};
+
+}  // namespace engine
+
+#include "./async_loader-inl.h"
+
+#endif
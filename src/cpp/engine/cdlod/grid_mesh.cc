@@ -1,5 +1,6 @@
 #include "grid_mesh.h"
 
+#include "../gl_state.h"
 #include "../../oglwrap/context.h"
 #include "../../oglwrap/smart_enums.h"
 
@@ -77,7 +78,7 @@ void GridMesh::render() {
     using gl::PrimType;
     using gl::IndexType;
 
-    gl::Bind(vao_);
+    GlState::BindVertexArray(vao_);
     gl::Bind(aRenderData_);
     aRenderData_.data(render_data_);
 
@@ -85,7 +86,7 @@ void GridMesh::render() {
                               index_count_,
                               IndexType::kUnsignedShort,
                               render_data_.size());   // instance count
-    gl::Unbind(vao_);
+    GlState::UnbindVertexArray();
   }
 #endif
 }
@@ -94,14 +95,14 @@ void GridMesh::render(gl::UniformObject<glm::vec4> uRenderData) const {
   using gl::PrimType;
   using gl::IndexType;
 
-  gl::Bind(vao_);
+  GlState::BindVertexArray(vao_);
   for(auto& data : render_data_) {
     uRenderData = data;
     gl::DrawElements(PrimType::kTriangleStrip,
                     index_count_,
                     IndexType::kUnsignedShort);
   }
-  gl::Unbind(vao_);
+  GlState::UnbindVertexArray();
 }
 
 } // namespace cdlod
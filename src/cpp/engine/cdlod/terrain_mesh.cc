@@ -1,6 +1,7 @@
 // Copyright (c) 2014, Tamas Csala
 
 #include "./terrain_mesh.h"
+#include "../gl_state.h"
 #include "../../oglwrap/smart_enums.h"
 
 namespace engine {
@@ -57,12 +58,12 @@ void TerrainMesh::render(const Camera& cam) {
                            "before the use of the render() function.");
   }
 
-  gl::BindToTexUnit(height_map_tex_, tex_unit_);
+  GlState::BindTexture(tex_unit_, height_map_tex_);
 
   uCamPos_->set(cam.transform()->pos());
 
-  gl::FrontFace(gl::kCcw);
-  gl::TemporaryEnable cullface{gl::kCullFace};
+  GlState::FrontFace(GL_CCW);
+  GlState::TemporarySet cullface{{{GL_CULL_FACE, true}}};
 
   #ifdef glVertexAttribDivisor
     if (glVertexAttribDivisor)
@@ -70,8 +71,6 @@ void TerrainMesh::render(const Camera& cam) {
     else
   #endif
     mesh_.render(cam, *uRenderData_);
-
-  gl::UnbindFromTexUnit(height_map_tex_, tex_unit_);
 }
 
 }  // namespace cdlod
@@ -0,0 +1,444 @@
+// Copyright (c) 2014, Tamas Csala
+
+#include "./compressed_texture.h"
+
+#include <cmath>
+#include <climits>
+#include <cstdint>
+#include <fstream>
+#include <algorithm>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "./misc.h"
+#include "./texture_source.h"
+
+namespace engine {
+
+namespace {
+
+const char kMagic[4] = {'B', 'C', 'T', 'X'};
+const uint32_t kVersion = 1;
+
+struct FileHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t format;
+  uint32_t srgb;
+  uint32_t width, height;
+  uint32_t level_count;
+};
+
+using Pixel = glm::tvec4<unsigned char, glm::highp>;
+
+float SrgbToLinear(float value) {
+  return value <= 0.04045f ? value / 12.92f
+                           : std::pow((value + 0.055f) / 1.055f, 2.4f);
+}
+
+float LinearToSrgb(float value) {
+  return value <= 0.0031308f ? value * 12.92f
+                             : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+}
+
+/// A mipmap level before the compression, with [0, 1] values (that are in
+/// linear space for srgb images).
+struct FloatImage {
+  int w, h;
+  std::vector<glm::vec4> data;
+
+  const glm::vec4& at(int x, int y) const {
+    return data[std::min(y, h - 1) * w + std::min(x, w - 1)];
+  }
+};
+
+/// Halves an image with a box filter.
+FloatImage Downsample(const FloatImage& src) {
+  FloatImage dst;
+  dst.w = std::max(src.w / 2, 1);
+  dst.h = std::max(src.h / 2, 1);
+  dst.data.resize(dst.w * dst.h);
+  for (int y = 0; y < dst.h; ++y) {
+    for (int x = 0; x < dst.w; ++x) {
+      dst.data[y*dst.w + x] = (src.at(2*x, 2*y) + src.at(2*x + 1, 2*y) +
+                               src.at(2*x, 2*y + 1) +
+                               src.at(2*x + 1, 2*y + 1)) / 4.0f;
+    }
+  }
+  return dst;
+}
+
+std::vector<Pixel> ToPixels(const FloatImage& image, bool srgb) {
+  std::vector<Pixel> pixels(image.data.size());
+  for (size_t i = 0; i < pixels.size(); ++i) {
+    glm::vec4 color = image.data[i];
+    if (srgb) {
+      color = glm::vec4(LinearToSrgb(color.r), LinearToSrgb(color.g),
+                        LinearToSrgb(color.b), color.a);
+    }
+    pixels[i] = Pixel(glm::clamp(color, 0.0f, 1.0f) * 255.0f + 0.5f);
+  }
+  return pixels;
+}
+
+/// Fetches a 4x4 block, the pixels outside the image are clamped.
+void FetchBlock(const std::vector<Pixel>& pixels, int w, int h,
+                int block_x, int block_y, Pixel block[16]) {
+  for (int y = 0; y < 4; ++y) {
+    for (int x = 0; x < 4; ++x) {
+      int px = std::min(block_x*4 + x, w - 1);
+      int py = std::min(block_y*4 + y, h - 1);
+      block[y*4 + x] = pixels[py*w + px];
+    }
+  }
+}
+
+uint16_t PackRgb565(const glm::vec3& color) {
+  glm::ivec3 c = glm::ivec3(glm::clamp(color, 0.0f, 255.0f) *
+                            glm::vec3(31, 63, 31) / 255.0f + 0.5f);
+  return (c.r << 11) | (c.g << 5) | c.b;
+}
+
+glm::vec3 UnpackRgb565(uint16_t color) {
+  int r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+  // Replicate the high bits, like the hardware does
+  return glm::vec3((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2));
+}
+
+/// Writes a BC1 color block (8 bytes), always in the four color mode.
+/** The endpoints are the extremes of the colors along their principal axis,
+  * pulled a bit inside, as the extremes are rarely hit by the palette. */
+void CompressColorBlock(const Pixel block[16], unsigned char* out) {
+  glm::vec3 colors[16], mean(0.0f);
+  for (int i = 0; i < 16; ++i) {
+    colors[i] = glm::vec3(block[i]);
+    mean += colors[i] / 16.0f;
+  }
+
+  float cov[6] = {0, 0, 0, 0, 0, 0};
+  for (int i = 0; i < 16; ++i) {
+    glm::vec3 d = colors[i] - mean;
+    cov[0] += d.r*d.r; cov[1] += d.r*d.g; cov[2] += d.r*d.b;
+    cov[3] += d.g*d.g; cov[4] += d.g*d.b; cov[5] += d.b*d.b;
+  }
+
+  // Power iteration for the principal axis
+  glm::vec3 axis(1.0f);
+  for (int iter = 0; iter < 8; ++iter) {
+    axis = glm::vec3(cov[0]*axis.r + cov[1]*axis.g + cov[2]*axis.b,
+                     cov[1]*axis.r + cov[3]*axis.g + cov[4]*axis.b,
+                     cov[2]*axis.r + cov[4]*axis.g + cov[5]*axis.b);
+    float len = glm::length(axis);
+    if (len < 1e-6f) { break; }
+    axis /= len;
+  }
+
+  glm::vec3 min_color = colors[0], max_color = colors[0];
+  float min_dot = glm::dot(colors[0], axis), max_dot = min_dot;
+  for (int i = 1; i < 16; ++i) {
+    float d = glm::dot(colors[i], axis);
+    if (d < min_dot) { min_dot = d; min_color = colors[i]; }
+    if (d > max_dot) { max_dot = d; max_color = colors[i]; }
+  }
+  glm::vec3 inset = (max_color - min_color) / 16.0f;
+
+  uint16_t c0 = PackRgb565(max_color - inset);
+  uint16_t c1 = PackRgb565(min_color + inset);
+  if (c0 < c1) { std::swap(c0, c1); }
+
+  uint32_t indices = 0;
+  if (c0 != c1) {
+    glm::vec3 palette[4];
+    palette[0] = UnpackRgb565(c0);
+    palette[1] = UnpackRgb565(c1);
+    palette[2] = (2.0f*palette[0] + palette[1]) / 3.0f;
+    palette[3] = (palette[0] + 2.0f*palette[1]) / 3.0f;
+
+    for (int i = 0; i < 16; ++i) {
+      uint32_t best = 0;
+      float best_dist = INFINITY;
+      for (uint32_t j = 0; j < 4; ++j) {
+        glm::vec3 d = colors[i] - palette[j];
+        float dist = glm::dot(d, d);
+        if (dist < best_dist) { best_dist = dist; best = j; }
+      }
+      indices |= best << (2*i);
+    }
+  }  // else every index is 0, and the 3 color mode isn't used either
+
+  out[0] = c0 & 0xFF; out[1] = c0 >> 8;
+  out[2] = c1 & 0xFF; out[3] = c1 >> 8;
+  for (int i = 0; i < 4; ++i) {
+    out[4 + i] = (indices >> (8*i)) & 0xFF;
+  }
+}
+
+/// Writes a single channel BC4 block (8 bytes), in the eight value mode.
+/** That is the alpha block of BC3, and the two halves of a BC5 block. */
+void CompressChannelBlock(const unsigned char values[16], unsigned char* out) {
+  unsigned char v0 = *std::max_element(values, values + 16);
+  unsigned char v1 = *std::min_element(values, values + 16);
+
+  uint64_t indices = 0;
+  if (v0 != v1) {
+    float palette[8];
+    palette[0] = v0;
+    palette[1] = v1;
+    for (int i = 2; i < 8; ++i) {
+      palette[i] = ((8 - i)*v0 + (i - 1)*v1) / 7.0f;
+    }
+
+    for (int i = 0; i < 16; ++i) {
+      uint64_t best = 0;
+      float best_dist = INFINITY;
+      for (uint64_t j = 0; j < 8; ++j) {
+        float dist = std::abs(values[i] - palette[j]);
+        if (dist < best_dist) { best_dist = dist; best = j; }
+      }
+      indices |= best << (3*i);
+    }
+  }  // else every index is 0, which means v0 in both modes
+
+  out[0] = v0;
+  out[1] = v1;
+  for (int i = 0; i < 6; ++i) {
+    out[2 + i] = (indices >> (8*i)) & 0xFF;
+  }
+}
+
+size_t BlockSize(BlockFormat format) {
+  return format == BlockFormat::BC1 ? 8 : 16;
+}
+
+std::vector<unsigned char> CompressLevel(const std::vector<Pixel>& pixels,
+                                         int w, int h, BlockFormat format) {
+  int blocks_x = (w + 3) / 4, blocks_y = (h + 3) / 4;
+  std::vector<unsigned char> data(blocks_x * blocks_y * BlockSize(format));
+  unsigned char* out = data.data();
+
+  for (int by = 0; by < blocks_y; ++by) {
+    for (int bx = 0; bx < blocks_x; ++bx) {
+      Pixel block[16];
+      FetchBlock(pixels, w, h, bx, by, block);
+
+      unsigned char channel[16];
+      switch (format) {
+        case BlockFormat::BC1:
+          CompressColorBlock(block, out);
+          break;
+        case BlockFormat::BC3:
+          for (int i = 0; i < 16; ++i) { channel[i] = block[i].a; }
+          CompressChannelBlock(channel, out);
+          CompressColorBlock(block, out + 8);
+          break;
+        case BlockFormat::BC5:
+          for (int i = 0; i < 16; ++i) { channel[i] = block[i].r; }
+          CompressChannelBlock(channel, out);
+          for (int i = 0; i < 16; ++i) { channel[i] = block[i].g; }
+          CompressChannelBlock(channel, out + 8);
+          break;
+      }
+      out += BlockSize(format);
+    }
+  }
+
+  return data;
+}
+
+GLenum InternalFormat(BlockFormat format, bool srgb) {
+  switch (format) {
+    case BlockFormat::BC1:
+      return srgb ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+                  : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case BlockFormat::BC3:
+      return srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT
+                  : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case BlockFormat::BC5:
+      return GL_COMPRESSED_RG_RGTC2;
+  }
+  return 0;
+}
+
+}  // namespace
+
+std::unique_ptr<CompressedImage> CompressedImage::Compress(
+    const unsigned char* rgba, int width, int height, BlockFormat format,
+    bool srgb) {
+  if (format == BlockFormat::BC5) {
+    srgb = false;
+  } else if (format == BlockFormat::BC3) {
+    bool opaque = true;
+    for (int i = 0; i < width*height && opaque; ++i) {
+      opaque = rgba[4*i + 3] == 255;
+    }
+    if (opaque) { format = BlockFormat::BC1; }
+  }
+
+  FloatImage level;
+  level.w = width;
+  level.h = height;
+  level.data.resize(width * height);
+  for (int i = 0; i < width*height; ++i) {
+    glm::vec4 color = glm::vec4(rgba[4*i], rgba[4*i + 1],
+                                rgba[4*i + 2], rgba[4*i + 3]) / 255.0f;
+    if (srgb) {
+      color = glm::vec4(SrgbToLinear(color.r), SrgbToLinear(color.g),
+                        SrgbToLinear(color.b), color.a);
+    }
+    level.data[i] = color;
+  }
+
+  std::unique_ptr<CompressedImage> image{
+    new CompressedImage{format, srgb, width, height}};
+  while (true) {
+    image->levels_.push_back(
+        CompressLevel(ToPixels(level, srgb), level.w, level.h, format));
+    if (level.w == 1 && level.h == 1) { break; }
+    level = Downsample(level);
+  }
+
+  return image;
+}
+
+bool CompressedImage::save(const std::string& filename) const {
+  std::ofstream file(filename, std::ios::binary);
+  if (!file) { return false; }
+
+  FileHeader header;
+  std::copy(kMagic, kMagic + 4, header.magic);
+  header.version = kVersion;
+  header.format = static_cast<uint32_t>(format_);
+  header.srgb = srgb_;
+  header.width = width_;
+  header.height = height_;
+  header.level_count = levels_.size();
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  for (const auto& level : levels_) {
+    uint32_t size = level.size();
+    file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    file.write(reinterpret_cast<const char*>(level.data()), size);
+  }
+
+  return file.good();
+}
+
+std::unique_ptr<CompressedImage> CompressedImage::load(
+    const std::string& filename) {
+  std::ifstream file(filename, std::ios::binary);
+  if (!file) { return nullptr; }
+
+  file.seekg(0, std::ios::end);
+  uint64_t file_size = file.tellg();
+  file.seekg(0, std::ios::beg);
+
+  FileHeader header;
+  file.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (!file || !std::equal(kMagic, kMagic + 4, header.magic) ||
+      header.version != kVersion || header.level_count == 0 ||
+      header.format > static_cast<uint32_t>(BlockFormat::BC5) ||
+      header.width == 0 || header.height == 0 ||
+      header.width > INT_MAX || header.height > INT_MAX) {
+    return nullptr;
+  }
+
+  // Every level has to have exactly the size that glCompressedTexImage2D
+  // expects, and a truncated or corrupted file shouldn't make us allocate,
+  // or read more than what is actually there.
+  BlockFormat format = static_cast<BlockFormat>(header.format);
+  uint64_t remaining_size = file_size - sizeof(header);
+  std::vector<uint32_t> level_sizes;
+  uint64_t w = header.width, h = header.height;
+  for (uint32_t level = 0; level < header.level_count; ++level) {
+    if (level > 0) {
+      if (w == 1 && h == 1) {
+        return nullptr;  // more levels than the full mipmap chain
+      }
+      w = std::max<uint64_t>(w / 2, 1);
+      h = std::max<uint64_t>(h / 2, 1);
+    }
+    uint64_t size = ((w + 3) / 4) * ((h + 3) / 4) * BlockSize(format);
+    if (sizeof(uint32_t) + size > remaining_size) {
+      return nullptr;
+    }
+    remaining_size -= sizeof(uint32_t) + size;
+    level_sizes.push_back(size);
+  }
+  if (remaining_size != 0) {
+    return nullptr;
+  }
+
+  std::unique_ptr<CompressedImage> image{new CompressedImage{
+      format, header.srgb != 0,
+      static_cast<int>(header.width), static_cast<int>(header.height)}};
+  image->levels_.resize(header.level_count);
+  for (size_t i = 0; i < image->levels_.size(); ++i) {
+    uint32_t size = 0;
+    file.read(reinterpret_cast<char*>(&size), sizeof(size));
+    if (!file || size != level_sizes[i]) { return nullptr; }
+    image->levels_[i].resize(size);
+    file.read(reinterpret_cast<char*>(image->levels_[i].data()), size);
+  }
+
+  if (!file) { return nullptr; }
+  return image;
+}
+
+bool CompressedImage::IsSupported(BlockFormat format, bool srgb) {
+#if defined(GLEW_EXT_texture_compression_s3tc) && defined(GLEW_VERSION_3_0)
+  switch (format) {
+    case BlockFormat::BC1:
+    case BlockFormat::BC3:
+      // The srgb S3TC formats are only defined by EXT_texture_sRGB, GL 2.1
+      // only has the uncompressed ones.
+      return GLEW_EXT_texture_compression_s3tc &&
+             (!srgb || GLEW_EXT_texture_sRGB);
+    case BlockFormat::BC5:
+      return GLEW_VERSION_3_0 || GLEW_ARB_texture_compression_rgtc;
+  }
+#endif
+  return false;
+}
+
+void CompressedImage::upload(gl::Texture2D& texture) const {
+  gl::Bind(texture);
+  GLenum internal_format = InternalFormat(format_, srgb_);
+  int w = width_, h = height_;
+  for (size_t level = 0; level < levels_.size(); ++level) {
+    glCompressedTexImage2D(GL_TEXTURE_2D, level, internal_format, w, h, 0,
+                           levels_[level].size(), levels_[level].data());
+    w = std::max(w / 2, 1);
+    h = std::max(h / 2, 1);
+  }
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels_.size() - 1);
+}
+
+#if OGLWRAP_USE_IMAGEMAGICK
+std::unique_ptr<CompressedImage> LoadCompressedImage(
+    const std::string& filename, BlockFormat format, bool srgb) {
+  if (format == BlockFormat::BC5) { srgb = false; }
+  if (!CompressedImage::IsSupported(format, srgb)) { return nullptr; }
+
+  const char* format_names[] = {"bc1", "bc3", "bc5"};
+  std::string cache_filename = filename + "." +
+      format_names[static_cast<int>(format)] + (srgb ? "_srgb" : "") + ".tex";
+
+  std::unique_ptr<CompressedImage> image;
+  if (IsNewer(cache_filename, filename)) {
+    image = CompressedImage::load(cache_filename);
+  }
+
+  if (!image) {
+    TextureSource<unsigned char, 4> source(filename, "RGBA");
+    image = CompressedImage::Compress(source.data().data()->data(),
+                                      source.w(), source.h(), format, srgb);
+    // Failing to write the cache isn't an error, it is just slower next time.
+    image->save(cache_filename);
+  }
+
+  return image;
+}
+#endif
+
+}  // namespace engine
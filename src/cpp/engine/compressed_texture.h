@@ -0,0 +1,82 @@
+// Copyright (c) 2014, Tamas Csala
+
+#ifndef ENGINE_COMPRESSED_TEXTURE_H_
+#define ENGINE_COMPRESSED_TEXTURE_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "./oglwrap_config.h"
+#include "../oglwrap/textures/texture_2D.h"
+
+namespace engine {
+
+/// The block compression formats (4x4 pixel blocks).
+enum class BlockFormat {
+  BC1,  ///< RGB, 8 bytes per block (DXT1).
+  BC3,  ///< RGBA, 16 bytes per block (DXT5).
+  BC5   ///< Two channels (RG), 16 bytes per block, for normal maps (RGTC2).
+};
+
+/// A block compressed image with its whole mipmap chain.
+class CompressedImage {
+ public:
+  /// Generates the mipmaps of an image, and compresses every level.
+  /** @param rgba    The pixels of the image, with 4 bytes each.
+    * @param format  The block format. A BC3 image that doesn't have any
+    *                transparent pixels is stored as BC1.
+    * @param srgb    The mipmaps of an srgb image are averaged in linear
+    *                space. Ignored for BC5. */
+  static std::unique_ptr<CompressedImage> Compress(const unsigned char* rgba,
+                                                   int width, int height,
+                                                   BlockFormat format,
+                                                   bool srgb);
+
+  /// Writes the image to a file. Returns false on failure.
+  bool save(const std::string& filename) const;
+
+  /// Loads an image written by save(). Returns nullptr if the file doesn't
+  /// exist, if it was written by an incompatible version, or if the sizes
+  /// of its levels don't match its dimensions and its length.
+  static std::unique_ptr<CompressedImage> load(const std::string& filename);
+
+  /// Checks if the OpenGL implementation can sample a format.
+  static bool IsSupported(BlockFormat format, bool srgb);
+
+  /// Uploads every level to a texture.
+  /** Changes the Texture2D binding of the active texture unit. The filtering
+    * isn't changed, but a mipmapped minification filter can be used without
+    * calling generateMipmap(). */
+  void upload(gl::Texture2D& texture) const;
+
+  BlockFormat format() const { return format_; }
+  bool srgb() const { return srgb_; }
+  int width() const { return width_; }
+  int height() const { return height_; }
+  size_t level_count() const { return levels_.size(); }
+
+ private:
+  BlockFormat format_;
+  bool srgb_;
+  int width_, height_;
+  std::vector<std::vector<unsigned char>> levels_;
+
+  CompressedImage(BlockFormat format, bool srgb, int width, int height)
+      : format_(format), srgb_(srgb), width_(width), height_(height) {}
+};
+
+#if OGLWRAP_USE_IMAGEMAGICK
+/// Loads an image through a cache of its compressed version.
+/** The cache is stored next to the original file, and it is regenerated if
+  * the original file gets modified. It doesn't use OpenGL, so it can be
+  * called on a worker thread.
+  * @return nullptr if the format isn't supported, in this case the caller
+  *         should upload the image uncompressed. */
+std::unique_ptr<CompressedImage> LoadCompressedImage(
+    const std::string& filename, BlockFormat format, bool srgb);
+#endif
+
+}  // namespace engine
+
+#endif
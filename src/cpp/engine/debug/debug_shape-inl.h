@@ -4,6 +4,7 @@
 #define ENGINE_DEBUG_DEBUG_SHAPE_INL_H_
 
 #include "./debug_shape.h"
+#include "../gl_state.h"
 
 namespace engine {
 namespace debug {
@@ -31,8 +32,8 @@ DebugShape<Shape_t>::DebugShape(GameObject* parent, const glm::vec3& color)
     prog_ = new engine::ShaderProgram{
                 scene_->shader_manager()->get("engine/simple_shape.vert"),
                 scene_->shader_manager()->get("engine/simple_shape.frag")};
-    (*prog_ | "aPosition").bindLocation(shape_->kPosition);
-    (*prog_ | "aNormal").bindLocation(shape_->kNormal);
+    prog_->bindAttribLocation("aPosition", shape_->kPosition);
+    prog_->bindAttribLocation("aNormal", shape_->kNormal);
     uProjectionMatrix_ = new gl::LazyUniform<glm::mat4>{*prog_, "uProjectionMatrix"};
     uCameraMatrix_ = new gl::LazyUniform<glm::mat4>{*prog_, "uCameraMatrix"};
     uModelMatrix_ = new gl::LazyUniform<glm::mat4>{*prog_, "uModelMatrix"};
@@ -42,15 +43,15 @@ DebugShape<Shape_t>::DebugShape(GameObject* parent, const glm::vec3& color)
 
 template<typename Shape_t>
 void DebugShape<Shape_t>::render() {
-  gl::Use(*prog_);
+  GlState::Use(*prog_);
   const auto& cam = *scene_->camera();
   uCameraMatrix_->set(cam.cameraMatrix());
   uProjectionMatrix_->set(cam.projectionMatrix());
   uModelMatrix_->set(transform()->matrix());
   uColor_->set(color_);
 
-  gl::FrontFace(shape_->faceWinding());
-  gl::TemporaryEnable cullface{gl::kCullFace};
+  GlState::FrontFace(GLenum(shape_->faceWinding()));
+  GlState::TemporarySet cullface{{GL_CULL_FACE, true}};
   shape_->render();
 }
 
@@ -21,7 +21,7 @@ static void PrintDebugTime() {
 }
 
 static void GlInit() {
-  gl::Enable(gl::kDepthTest);
+  engine::GlState::Set(GL_DEPTH_TEST, true);
   gl::Hint(gl::kTextureCompressionHint, gl::kFastest);
 }
 
@@ -82,6 +82,19 @@ void GameEngine::InitContext() {
   }
   gl::GetError();
 
+  // Let the driver compile the shaders on as many threads as it wants.
+#if defined(glMaxShaderCompilerThreadsKHR)
+  if (GLEW_KHR_parallel_shader_compile) {
+    glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+  } else if (GLEW_ARB_parallel_shader_compile) {
+    glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+  }
+#elif defined(glMaxShaderCompilerThreadsARB)
+  if (GLEW_ARB_parallel_shader_compile) {
+    glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+  }
+#endif
+
   // No V-sync needed.
   glfwSwapInterval(0);
 
@@ -101,7 +114,17 @@ void GameEngine::Run() {
       delete scene_;
       scene_ = new_scene_;
       new_scene_ = nullptr;
+      // Every program of the scene has issued its link by now, this waits
+      // for them, and sets them up.
+      shader_manager_->finishLinks();
     }
+    // The programs linked later (for ex. on first use) are checked as soon
+    // as the driver finished them.
+    shader_manager_->finishLinks(false);
+
+    // The bindings made outside of GlState (for ex. at load time, or by the
+    // setup functions above) are forgotten at the start of every frame.
+    GlState::BeginFrame();
     gl::Clear().Color().Depth();
     scene_->turn();
 
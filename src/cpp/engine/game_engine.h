@@ -73,7 +73,7 @@ class GameEngine {
   }
 
   static void ScreenResizeCallback(GLFWwindow* window, int width, int height) {
-    gl::Viewport(width, height);
+    GlState::Viewport(0, 0, width, height);
     scene_->screenResizedAll(width, height);
   }
 
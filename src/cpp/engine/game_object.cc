@@ -117,13 +117,6 @@ void GameObject::mouseMovedAll(double xpos, double ypos) {
   }
 }
 
-void GameObject::collisionAll(const GameObject* other) {
-  collision(other);
-  for (size_t i = 0; i < components_.size(); ++i) {
-    components_[i]->collisionAll(other);
-  }
-}
-
 void GameObject::initScreenSize() {
   glm::vec2 window_size = GameEngine::window_size();
   screenResized(window_size.x, window_size.y);
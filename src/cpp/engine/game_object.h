@@ -10,6 +10,7 @@
 #include <algorithm>
 
 #include "./transform.h"
+#include "./physics/contact.h"
 
 namespace engine {
 
@@ -63,7 +64,8 @@ class GameObject {
   virtual void mouseScrolled(double xoffset, double yoffset) {}
   virtual void mouseButtonPressed(int button, int action, int mods) {}
   virtual void mouseMoved(double xpos, double ypos) {}
-  virtual void collision(const GameObject* other) {}
+  // Only called if the object is subscribed to the scene's contact events
+  virtual void collision(const Contact& contact) {}
 
   virtual void shadowRenderAll();
   virtual void renderAll();
@@ -75,7 +77,6 @@ class GameObject {
   virtual void mouseScrolledAll(double xoffset, double yoffset);
   virtual void mouseButtonPressedAll(int button, int action, int mods);
   virtual void mouseMovedAll(double xpos, double ypos);
-  virtual void collisionAll(const GameObject* other);
 
  protected:
   Scene* scene_;
@@ -0,0 +1,172 @@
+// Copyright (c) 2014, Tamas Csala
+
+#include "./gl_state.h"
+
+#include <cassert>
+
+namespace engine {
+
+constexpr GLuint GlState::kUnknown;
+constexpr unsigned GlState::kMaxTextureUnits;
+
+std::array<GLuint, GlState::kMaxTextureUnits> GlState::UnknownTextures() {
+  std::array<GLuint, GlState::kMaxTextureUnits> textures;
+  textures.fill(GlState::kUnknown);
+  return textures;
+}
+
+GLuint GlState::program_ = GlState::kUnknown;
+GLuint GlState::vao_ = GlState::kUnknown;
+unsigned GlState::active_texture_unit_ = GlState::kUnknown;
+std::array<GLuint, GlState::kMaxTextureUnits> GlState::textures_ =
+    UnknownTextures();
+std::map<GLenum, bool> GlState::capabilities_;
+GlState::Cached<std::pair<GLenum, GLenum>> GlState::blend_func_;
+GlState::Cached<GLenum> GlState::cull_face_, GlState::front_face_;
+GlState::Cached<bool> GlState::depth_mask_;
+GlState::Cached<std::array<GLint, 4>> GlState::viewport_;
+GlState::Counters GlState::frame_, GlState::last_frame_;
+
+template <typename T>
+bool GlState::Changes(Cached<T>& cached, const T& value) {
+  if (cached.known && cached.value == value) {
+    frame_.filtered++;
+    return false;
+  }
+  cached.known = true;
+  cached.value = value;
+  frame_.issued++;
+  return true;
+}
+
+bool GlState::Changes(GLuint& cached, GLuint value) {
+  if (cached == value) {
+    frame_.filtered++;
+    return false;
+  }
+  cached = value;
+  frame_.issued++;
+  return true;
+}
+
+void GlState::Use(const gl::Program& program) {
+  if (Changes(program_, program.expose())) {
+    glUseProgram(program_);
+  }
+}
+
+void GlState::BindVertexArray(const gl::VertexArray& vao) {
+  if (Changes(vao_, vao.expose())) {
+    glBindVertexArray(vao_);
+  }
+}
+
+void GlState::UnbindVertexArray() {
+  if (Changes(vao_, 0)) {
+    glBindVertexArray(0);
+  }
+}
+
+void GlState::BindTexture(unsigned unit, const gl::Texture2D& texture) {
+  BindTexture(unit, texture.expose());
+}
+
+void GlState::BindTexture(unsigned unit, GLuint texture) {
+  // The units above the tracked ones are always bound
+  if (unit < kMaxTextureUnits && textures_[unit] == texture) {
+    frame_.filtered++;
+    return;
+  }
+
+  if (Changes(active_texture_unit_, unit)) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+  }
+  glBindTexture(GL_TEXTURE_2D, texture);
+  frame_.issued++;
+  if (unit < kMaxTextureUnits) {
+    textures_[unit] = texture;
+  }
+}
+
+bool GlState::IsEnabled(GLenum capability) {
+  auto iter = capabilities_.find(capability);
+  if (iter == capabilities_.end()) {
+    bool enabled = glIsEnabled(capability) == GL_TRUE;
+    iter = capabilities_.insert({capability, enabled}).first;
+  }
+  // The cached state is never reset, so an enable or disable that bypassed
+  // this class would make it wrong for the rest of the run.
+  assert(iter->second == (glIsEnabled(capability) == GL_TRUE));
+  return iter->second;
+}
+
+void GlState::Set(GLenum capability, bool enabled) {
+  if (IsEnabled(capability) == enabled) {
+    frame_.filtered++;
+    return;
+  }
+
+  capabilities_[capability] = enabled;
+  frame_.issued++;
+  if (enabled) {
+    glEnable(capability);
+  } else {
+    glDisable(capability);
+  }
+}
+
+void GlState::BlendFunc(GLenum src_factor, GLenum dst_factor) {
+  if (Changes(blend_func_, std::make_pair(src_factor, dst_factor))) {
+    glBlendFunc(src_factor, dst_factor);
+  }
+}
+
+void GlState::CullFace(GLenum mode) {
+  if (Changes(cull_face_, mode)) {
+    glCullFace(mode);
+  }
+}
+
+void GlState::FrontFace(GLenum mode) {
+  if (Changes(front_face_, mode)) {
+    glFrontFace(mode);
+  }
+}
+
+void GlState::DepthMask(bool flag) {
+  if (Changes(depth_mask_, flag)) {
+    glDepthMask(flag);
+  }
+}
+
+void GlState::Viewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+  if (Changes(viewport_, std::array<GLint, 4>{{x, y, width, height}})) {
+    glViewport(x, y, width, height);
+  }
+}
+
+GlState::TemporarySet::TemporarySet(
+    std::initializer_list<std::pair<GLenum, bool>> capabilities) {
+  for (const auto& capability : capabilities) {
+    previous_.push_back({capability.first, IsEnabled(capability.first)});
+    Set(capability.first, capability.second);
+  }
+}
+
+GlState::TemporarySet::~TemporarySet() {
+  for (const auto& capability : previous_) {
+    Set(capability.first, capability.second);
+  }
+}
+
+void GlState::BeginFrame() {
+  program_ = kUnknown;
+  vao_ = kUnknown;
+  active_texture_unit_ = kUnknown;
+  textures_.fill(kUnknown);
+
+  last_frame_ = frame_;
+  frame_ = Counters{};
+}
+
+}  // namespace engine
@@ -0,0 +1,106 @@
+// Copyright (c) 2014, Tamas Csala
+
+#ifndef ENGINE_GL_STATE_H_
+#define ENGINE_GL_STATE_H_
+
+#include <map>
+#include <array>
+#include <cstddef>
+#include <vector>
+#include <utility>
+#include <initializer_list>
+
+#include "./oglwrap_config.h"
+#include "../oglwrap/shader.h"
+#include "../oglwrap/vertex_array.h"
+#include "../oglwrap/textures/texture_2D.h"
+
+namespace engine {
+
+/// Tracks the OpenGL state that is changed in every frame, and filters out
+/// the calls that wouldn't change anything.
+/** The program, vertex array and texture bindings are forgotten at the start
+  * of every frame (see BeginFrame), so the code that only binds objects at
+  * load time (for ex. to upload something) doesn't have to use this class.
+  * But the capabilities, the blending, culling, depth mask and viewport
+  * settings are never forgotten, so every glEnable / glDisable (and the
+  * other setters) has to go through this class, even at load time. The
+  * debug builds check the cached capabilities against glIsEnabled. */
+class GlState {
+ public:
+  /// The number of the state changing calls that were passed to the driver,
+  /// and the number of the ones that were filtered out.
+  struct Counters {
+    size_t issued = 0, filtered = 0;
+  };
+
+  static void Use(const gl::Program& program);
+
+  static void BindVertexArray(const gl::VertexArray& vao);
+  static void UnbindVertexArray();
+
+  /// Binds a Texture2D to a texture unit (this changes the active unit).
+  static void BindTexture(unsigned unit, const gl::Texture2D& texture);
+  static void BindTexture(unsigned unit, GLuint texture);
+
+  /// Enables or disables a capability (for ex. GL_BLEND).
+  static void Set(GLenum capability, bool enabled);
+  static void BlendFunc(GLenum src_factor, GLenum dst_factor);
+  static void CullFace(GLenum mode);
+  static void FrontFace(GLenum mode);
+  static void DepthMask(bool flag);
+  static void Viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+
+  /// Sets capabilities until the end of the scope, then restores them.
+  class TemporarySet {
+   public:
+    TemporarySet(std::initializer_list<std::pair<GLenum, bool>> capabilities);
+    ~TemporarySet();
+
+   private:
+    std::vector<std::pair<GLenum, bool>> previous_;
+
+    TemporarySet(const TemporarySet&) = delete;
+    TemporarySet& operator=(const TemporarySet&) = delete;
+  };
+
+  /// Forgets the bindings, and starts counting the calls of a new frame.
+  static void BeginFrame();
+
+  /// The counters of the last finished frame.
+  static const Counters& last_frame() { return last_frame_; }
+
+ private:
+  static constexpr GLuint kUnknown = ~0u;
+  static constexpr unsigned kMaxTextureUnits = 32;
+
+  template <typename T>
+  struct Cached {
+    bool known = false;
+    T value;
+  };
+
+  static GLuint program_, vao_;
+  static unsigned active_texture_unit_;
+  static std::array<GLuint, kMaxTextureUnits> textures_;
+  static std::map<GLenum, bool> capabilities_;
+  static Cached<std::pair<GLenum, GLenum>> blend_func_;
+  static Cached<GLenum> cull_face_, front_face_;
+  static Cached<bool> depth_mask_;
+  static Cached<std::array<GLint, 4>> viewport_;
+  static Counters frame_, last_frame_;
+
+  static std::array<GLuint, kMaxTextureUnits> UnknownTextures();
+
+  /// Returns true (and stores the value) if it differs from the cached one.
+  template <typename T>
+  static bool Changes(Cached<T>& cached, const T& value);
+  static bool Changes(GLuint& cached, GLuint value);
+
+  /// Returns the state of a capability, queries it if it isn't known yet.
+  static bool IsEnabled(GLenum capability);
+};
+
+}  // namespace engine
+
+#endif
@@ -9,6 +9,7 @@
 
 #include "./font_manager.h"
 #include "../misc.h"
+#include "../gl_state.h"
 
 namespace engine {
 namespace gui {
@@ -71,8 +72,8 @@ class FontData {
     return texture_font_get_glyph(font_, ch);
   }
 
-  void bindTexture() const {
-    glBindTexture(GL_TEXTURE_2D, atlas_->id);
+  void bindTexture(unsigned unit) const {
+    GlState::BindTexture(unit, atlas_->id);
   }
 
   texture_font_t* expose() { return font_; }
@@ -127,7 +128,7 @@ class Font {
   }
 
   texture_glyph_t *get_glyph(wchar_t ch) {return data_->get_glyph(ch); }
-  void bindTexture() const { data_->bindTexture(); }
+  void bindTexture(unsigned unit) const { data_->bindTexture(unit); }
 
 };
 
@@ -7,6 +7,7 @@
 #include <vector>
 
 #include "../game_engine.h"
+#include "../gl_state.h"
 #include "../../oglwrap/smart_enums.h"
 
 #include "./font.h"
@@ -33,7 +34,7 @@ class Label : public GameObject {
     gl::FragmentShader fs("engine/text.frag");
 
     (prog_ << vs << fs).link();
-    gl::Use(prog_);
+    GlState::Use(prog_);
     gl::Uniform<glm::vec4>(prog_, "uColor") = font.color();
 
     set_text(text, cursor_pos);
@@ -64,7 +65,7 @@ class Label : public GameObject {
       actual_pos.y += size().y;
     }
 
-    gl::Use(prog_);
+    GlState::Use(prog_);
     gl::Uniform<glm::vec2>(prog_, "uOffset") = actual_pos;
   }
 
@@ -146,15 +147,15 @@ class Label : public GameObject {
     // Update the length of the text
     size_.x = x1;
 
-    gl::Use(prog_);
-    gl::Bind(vao_);
+    GlState::Use(prog_);
+    GlState::BindVertexArray(vao_);
     gl::Bind(attribs_);
     attribs_.data(attribs_vec);
     (prog_ | "aPosition").pointer(2, gl::kFloat, false,
                                   4*sizeof(GLfloat), 0).enable();
     (prog_ | "aTexCoord").pointer(2, gl::kFloat, false, 4*sizeof(GLfloat),
                                   (const void*)(2*sizeof(GLfloat))).enable();
-    gl::Unbind(vao_);
+    GlState::UnbindVertexArray();
 
     vertex_count_ = attribs_vec.size();
   }
@@ -162,7 +163,7 @@ class Label : public GameObject {
   const Font& font() const { return font_; }
   const glm::vec4& color() const { return font_.color(); }
   void set_color(const glm::vec4& color) {
-    gl::Use(prog_);
+    GlState::Use(prog_);
     gl::Uniform<glm::vec4>(prog_, "uColor") = color;
     font_.set_color(color);
   }
@@ -192,21 +193,20 @@ class Label : public GameObject {
   }
 
   virtual void screenResized(size_t width, size_t height) override {
-    gl::Use(prog_);
+    GlState::Use(prog_);
     gl::Uniform<glm::mat4>(prog_, "uProjectionMatrix") =
       glm::ortho<float>(-int(width)/2, width/2, -int(height)/2, height/2, -1, 1);
     set_position(pos_);
   }
 
   virtual void render2D() override {
-    gl::Use(prog_);
-    gl::Bind(vao_);
+    GlState::Use(prog_);
+    GlState::BindVertexArray(vao_);
 
-    gl::ActiveTexture(0);
-    font_.bindTexture();
+    font_.bindTexture(0);
     gl::DrawArrays(gl::kTriangles, 0, vertex_count_);
 
-    gl::Unbind(vao_);
+    GlState::UnbindVertexArray();
   }
 };
 
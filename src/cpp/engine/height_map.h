@@ -4,6 +4,7 @@
 #define ENGINE_HEIGHT_MAP_H_
 
 #include <climits>
+#include <utility>
 #include "../oglwrap/debug/insertion.h"
 #include "./transform.h"
 #include "./height_map_interface.h"
@@ -22,7 +23,12 @@ class HeightMap : public HeightMapInterface {
   // - 'I': an integer image will be used.
   HeightMap(const std::string& file_name,
             const std::string& format_string = "CR")
-      : tex_(file_name, format_string) {
+      : HeightMap(TextureSource<T, 1>{file_name, format_string}) {}
+
+  // Uses an already loaded texture (for ex. one that was loaded on a
+  // worker thread)
+  explicit HeightMap(TextureSource<T, 1>&& tex)
+      : tex_(std::move(tex)) {
     static_assert(std::is_same<T, char>::value ||
                   std::is_same<T, unsigned char>::value ||
                   std::is_same<T, short>::value ||
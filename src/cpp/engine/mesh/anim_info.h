@@ -5,23 +5,24 @@
 
 #include <map>
 #include <memory>
+#include <vector>
 
 #include "../oglwrap_config.h"
 
 #include "anim_state.h"
-#include "../assimp.h"
+#include "baked_clip.h"
 
 namespace engine {
 
 /// A struct storing info per animation
 struct AnimInfo {
-  /// The importer that stores the animations.
+  /// The baked animation.
   // It is a shared_ptr because we want to use AnimInfo
   // in std::vector, which needs copy ctor
-  std::shared_ptr<Assimp::Importer> importer;
+  std::shared_ptr<BakedClip> clip;
 
   /// Handle for the animations
-  const aiScene* handle;
+  const BakedClip* handle;
 
   /// The name of the animation.
   std::string name;
@@ -38,10 +39,13 @@ struct AnimInfo {
   /// The offset values at the ends of the animations.
   glm::vec3 end_offset;
 
+  /// The index of the animation channel for every skeleton node (in the order
+  /// of SkinningData::nodes), or -1 if the node isn't animated.
+  std::vector<int> node_channels;
+
   /// Default constructor
   AnimInfo()
-      : importer(new Assimp::Importer{})
-      , handle(nullptr)
+      : handle(nullptr)
       , flags(0)
       , speed(1.0f)
   { }
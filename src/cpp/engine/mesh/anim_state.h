@@ -3,7 +3,10 @@
 #ifndef ENGINE_MESH_ANIM_STATE_H_
 #define ENGINE_MESH_ANIM_STATE_H_
 
+#include <cmath>
+#include <algorithm>
 #include "mesh_renderer.h"
+#include "baked_clip.h"
 
 namespace engine {
 
@@ -39,7 +42,7 @@ enum class AnimFlag : GLbitfield {
 /// A class storing an animation's state.
 struct AnimationState {
   /// The handle to the animation.
-  const aiScene* handle;
+  const BakedClip* handle;
 
   /// The index of the animation in the anim vector.
   size_t idx;
@@ -63,6 +66,68 @@ struct AnimationState {
   { }
 };
 
+/// The indices of the last used keyframes in an animation channel.
+/** As the animation time usually only moves forward by a little between two
+  * frames, the next search for a keyframe can start from these. */
+struct KeyCursor {
+  unsigned position;
+  unsigned rotation;
+  unsigned scaling;
+
+  KeyCursor() : position(0), rotation(0), scaling(0) { }
+};
+
+/// The level of detail of an animated instance.
+struct AnimLod {
+  /// The pose is only evaluated at every update_interval-th update, and the
+  /// bones' transformations are interpolated in the updates between them.
+  /** The interpolation is done between the last two evaluated poses, so the
+    * animation lags behind with at most update_interval updates. The root
+    * motion is interpolated the same way. */
+  unsigned update_interval;
+
+  /// The nodes, that have less levels of nodes below them than this, aren't
+  /// animated. For example 3 freezes the fingers, and most of the face.
+  unsigned skipped_leaf_levels;
+
+  explicit AnimLod(unsigned update_interval = 1,
+                   unsigned skipped_leaf_levels = 0)
+      : update_interval(std::max(update_interval, 1u))
+      , skipped_leaf_levels(skipped_leaf_levels)
+  { }
+
+  /**
+   * @brief Chooses a level of detail for an instance by its size on the screen.
+   *
+   * @param screen_size   The radius of the instance's bounding sphere on the
+   *                      screen, divided by the height of the screen.
+   */
+  static AnimLod ForScreenSize(float screen_size) {
+    if (screen_size > 0.2f) {
+      return AnimLod{1, 0};
+    } else if (screen_size > 0.1f) {
+      return AnimLod{2, 0};
+    } else if (screen_size > 0.05f) {
+      return AnimLod{4, 2};
+    } else {
+      return AnimLod{4, 3};
+    }
+  }
+
+  /**
+   * @brief Chooses a level of detail for an instance by its distance from
+   *        the camera.
+   *
+   * @param radius     The radius of the instance's bounding sphere.
+   * @param distance   The distance of the instance from the camera.
+   * @param fovy       The vertical field of view of the camera, in radians.
+   */
+  static AnimLod ForDistance(float radius, float distance, float fovy) {
+    float screen_size = radius / (2 * distance * std::tan(fovy / 2));
+    return ForScreenSize(screen_size);
+  }
+};
+
 /// A placeholder class for passing AnimationParameters
 struct AnimParams {
   /// The name of the animation
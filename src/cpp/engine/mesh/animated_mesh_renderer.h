@@ -10,10 +10,16 @@
 #include "../../oglwrap/uniform.h"
 #include "../../oglwrap/smart_enums.h"
 
+#include "../shader_manager.h"
 #include "./mesh_renderer.h"
 #include "./anim_state.h"
 #include "./skinning_data.h"
 #include "./anim_info.h"
+#include "./baked_clip.h"
+#include "./bone_palette_uniform.h"
+#include "./bone_palette_buffer.h"
+#include "./skinned_vertices.h"
+#include "./animation_texture.h"
 
 namespace engine {
 
@@ -27,16 +33,47 @@ class AnimatedMeshRenderer : public MeshRenderer {
   /// The animations.
   AnimData anims_;
 
+  /// The per instance data for the instanced rendering.
+  gl::ArrayBuffer instance_buffer_;
+
+  /// The copies of the entries' VAOs, that also have the per instance
+  /// attributes. Empty until setupInstances is called.
+  std::vector<gl::VertexArray> instance_vaos_;
+
  public:
   /**
    * @brief Loads in the mesh and the skeleton for an asset, and prepares it
    *        for animation.
    *
-   * @param filename   The name of the file.
-   * @param flags      The assimp post-process flags to use while loading the mesh.
+   * @param filename              The name of the file.
+   * @param flags                 The assimp post-process flags to use while
+   *                              loading the mesh.
+   * @param max_bone_influences   The maximum number of bones that can
+   *                              influence a vertex. Only the strongest ones
+   *                              are kept, and their weights are renormalized.
+   *                              Every 4 influences take a bone attribute
+   *                              set, at most 32 can be used.
+   * @param skinning_mode         How the bones should be blended, which also
+   *                              decides the format of the instances' bone
+   *                              palettes. The vertex shaders have to be
+   *                              compiled for the same mode.
    */
   AnimatedMeshRenderer(const std::string& filename,
-                       gl::Bitfield<aiPostProcessSteps> flags);
+                       gl::Bitfield<aiPostProcessSteps> flags,
+                       unsigned max_bone_influences = 4,
+                       SkinningMode skinning_mode = SkinningMode::Linear);
+
+  /**
+   * @brief Prepares an already imported asset for animation.
+   *
+   * @param imported              The imported scene (see ImportedScene).
+   * @param max_bone_influences   The maximum number of bones that can
+   *                              influence a vertex.
+   * @param skinning_mode         How the bones should be blended.
+   */
+  explicit AnimatedMeshRenderer(
+      ImportedScene imported, unsigned max_bone_influences = 4,
+      SkinningMode skinning_mode = SkinningMode::Linear);
 
   /// Returns a reference to the animation resources
   const AnimData& getAnimData() const { return anims_; }
@@ -67,6 +104,12 @@ class AnimatedMeshRenderer : public MeshRenderer {
    */
   size_t getBoneAttribNum();
 
+  /// Returns how the bones are blended. It is fixed at the construction, the
+  /// vertex shaders should be compiled for it.
+  SkinningMode getSkinningMode() const {
+    return skinning_data_.skinning_mode;
+  }
+
   /**
    * @brief Loads in bone weight and id information to the given array of
    *        attribute arrays.
@@ -75,7 +118,9 @@ class AnimatedMeshRenderer : public MeshRenderer {
    * it up for use. For example if you specified "in vec4 boneIds[3]" you have
    * to give "prog | boneIds".
    *
-   * Calling this function changes the currently active VAO and ArrayBuffer.
+   * The instances are drawn with copies of the VAOs, so this should be
+   * called after the mesh's regular vertex attributes are set up. Calling
+   * this function changes the currently active VAO and ArrayBuffer.
    *
    * @param boneIDs        The array of attributes array to use as destination
    *                       for bone IDs.
@@ -87,18 +132,153 @@ class AnimatedMeshRenderer : public MeshRenderer {
                   gl::LazyVertexAttrib bone_weights,
                   bool integerIDs = true);
 
+  // ------------------------------ Pre-skinning -------------------------------
+
+  /// Returns if the vertices can be skinned into buffers with transform
+  /// feedback (GL 3.0+).
+  static bool isPreSkinningSupported();
+
+  /**
+   * @brief Specifies the varyings of a skinning program, that should be
+   *        captured by skinVertices().
+   *
+   * It has to be called before the program is linked. The skinning program
+   * should write the skinned position into "vec3 vSkinnedPosition" and the
+   * skinned normal into "vec3 vSkinnedNormal".
+   */
+  static void setupSkinningProgram(ShaderProgram* program);
+
+  /**
+   * @brief Creates the buffers for the pre-skinned vertices of an instance,
+   *        and sets them up for drawing.
+   *
+   * In this mode, the positions, the normals and the bones should be set up
+   * to the skinning program's attributes, and setupTexCoords has to be called
+   * before this function. Calling this function changes the currently active
+   * VAO and ArrayBuffer.
+   *
+   * @param vertices     The instance's buffers to set up.
+   * @param positions    The attribute array that should read the skinned
+   *                     positions.
+   * @param normals      The attribute array that should read the skinned
+   *                     normals.
+   * @param tex_coords   The attribute array that should read the tex coords.
+   */
+  void setupSkinnedVertices(SkinnedVertices& vertices,
+                            gl::VertexAttrib positions,
+                            gl::VertexAttrib normals,
+                            gl::VertexAttrib tex_coords);
+
+  /**
+   * @brief Skins the vertices of an instance into its buffers.
+   *
+   * The skinning program has to be in use, with the instance's bones
+   * uploaded. It should be called once per frame, after the pose is updated.
+   * Changes the currently active VAO.
+   */
+  void skinVertices(SkinnedVertices& vertices);
+
+  /// Renders the pre-skinned vertices of an instance.
+  /** Changes the currently active VAO and may change the Texture2D binding */
+  void render(const SkinnedVertices& vertices);
+
+  /// Renders the mesh in the bind pose, or skinned in the vertex shader.
+  using MeshRenderer::render;
+
+  // ------------------------ Vertex animation textures ------------------------
+
+  /**
+   * @brief Samples an animation at evenly spaced times, and returns the bone
+   *        palettes of the frames after each other.
+   *
+   * The palettes are in the SkinningMode::Linear format, and the root motion
+   * is removed from them.
+   *
+   * @param anim_name     The name of the animation.
+   * @param frame_count   The number of frames to sample, evenly covering one
+   *                      period of the animation.
+   */
+  std::vector<glm::vec4> bakeBonePalettes(const std::string& anim_name,
+                                          unsigned frame_count) const;
+
+  /// Returns the length of an animation in seconds, when played with its
+  /// default speed.
+  float getAnimationDuration(const std::string& anim_name) const;
+
+  /**
+   * @brief Sets up the per instance attributes for instanced rendering.
+   *
+   * The instances are drawn with copies of the VAOs, so this should be
+   * called after the mesh's regular vertex attributes are set up. Calling
+   * this function changes the currently active VAO and ArrayBuffer.
+   *
+   * @param transform   The array of three attributes, that should get the
+   *                    rows of VertexAnimationInstance::transform.
+   * @param animation   The attribute that should get
+   *                    VertexAnimationInstance::animation.
+   */
+  void setupInstances(gl::LazyVertexAttrib transform,
+                      gl::VertexAttrib animation);
+
+  /**
+   * @brief Renders a lot of instances with a single draw call per mesh.
+   *
+   * Needs instanced rendering (GL 3.3+), it doesn't do anything without it.
+   * Changes the currently active VAO and ArrayBuffer, and may change the
+   * Texture2D binding.
+   */
+  void renderInstances(const std::vector<VertexAnimationInstance>& instances);
+
   // -------------------------------- Animation --------------------------------
 
-  /// Updates the bones' transformations.
+  /**
+   * @brief Updates the pose of an animated instance.
+   *
+   * It only reads the data shared by the instances, so the poses of different
+   * instances can be updated on different threads at the same time. The
+   * instance's AnimationEndedCallback is called on the caller's thread.
+   * Depending on the instance's AnimLod, the pose might only be evaluated at
+   * every n-th call, and interpolated in the others.
+   *
+   * @param animation        The animation to update.
+   * @param time_in_seconds  Expect a time value as a float, optimally since
+   *                         the start of the program.
+   */
+  void updatePose(Animation& animation, float time_in_seconds) const;
+
+  /**
+   * @brief Updates the pose of an animated instance, and moves the pinned
+   *        external bones with it.
+   *
+   * @param animation        The animation to update.
+   * @param time_in_seconds  Expect a time value as a float, optimally since
+   *                         the start of the program.
+   */
   void updateBoneInfo(Animation& animation,
                       float time_in_seconds);
 
   /**
    * @brief Uploads the bones' transformations into the given uniform array.
    *
-   * @param bones - The uniform naming the bones array. It should be indexable.
+   * The palette is packed when the pose is updated, so the uploads for
+   * multiple passes (for e.g. the shadow) don't have to repack it.
+   *
+   * @param animation   The animated instance, whose pose should be uploaded.
+   * @param bones       The uniform naming the bones array.
    */
-  void uploadBoneInfo(gl::LazyUniform<glm::mat4>& bones);
+  void uploadBoneInfo(const Animation& animation, BonePaletteUniform& bones);
+
+  /**
+   * @brief Uploads the bones' transformations into the instance's uniform
+   *        buffer, and binds it.
+   *
+   * It only has to be called once per update, all the programs that are
+   * connected to the buffer's binding point read the same palette.
+   *
+   * @param animation   The animated instance, whose pose should be uploaded.
+   * @param bones       The instance's palette buffer.
+   */
+  void uploadBoneInfo(const Animation& animation, BonePaletteBuffer& bones);
 
   /**
    * @brief Updates the bones transformation and uploads them into the given
@@ -107,12 +287,11 @@ class AnimatedMeshRenderer : public MeshRenderer {
    * @param animation        The animation to update.
    * @param time_in_seconds  Expect a time value as a float, optimally since
    *                         the start of the program.
-   * @param bones            The uniform naming the bones array. It should be
-   *                         indexable.
+   * @param bones            The uniform naming the bones array.
    */
   void updateAndUploadBoneInfo(Animation& animation,
                                float time_in_seconds,
-                               gl::LazyUniform<glm::mat4>& bones);
+                               BonePaletteUniform& bones);
 
   // --------------------------- Animation Control -----------------------------
 
@@ -132,12 +311,39 @@ class AnimatedMeshRenderer : public MeshRenderer {
    * @param speed       Sets the default speed of the animation. If it's 1, it
    *                    will be played with the its default speed. If it's
    *                    negative, it will be played backwards.
+   *
+   * The animation is baked into a compact format at the first load, and it is
+   * cached next to the original file (with a .clip extension). The cache is
+   * used until the original file gets modified.
    */
   void addAnimation(const std::string& filename,
                     const std::string& anim_name,
                     gl::Bitfield<AnimFlag> flags = AnimFlag::None,
                     float speed = 1.0f);
 
+  /**
+   * @brief Adds an animation, that is already loaded by loadClip().
+   *
+   * @param clip        The baked animation.
+   * @param anim_name   The name with you wanna reference this animation.
+   * @param flags       The default animation modifiers.
+   * @param speed       The default speed of the animation.
+   */
+  void addAnimation(std::unique_ptr<BakedClip> clip,
+                    const std::string& anim_name,
+                    gl::Bitfield<AnimFlag> flags = AnimFlag::None,
+                    float speed = 1.0f);
+
+  /**
+   * @brief Loads and bakes the animation of a file, through its .clip cache.
+   *
+   * It doesn't depend on the mesh, so it can be called on a worker thread,
+   * and the result can be added with addAnimation later.
+   *
+   * @param filename    The name of the file, from where to load the animation.
+   */
+  static std::unique_ptr<BakedClip> loadClip(const std::string& filename);
+
  private:
   /// It shouldn't be copyable.
   AnimatedMeshRenderer(const AnimatedMeshRenderer& src) = delete;
@@ -150,14 +356,24 @@ class AnimatedMeshRenderer : public MeshRenderer {
   /// Fills the bone_mapping with data.
   void mapBones();
 
+  /**
+   * @brief Fills SkinningData::nodes and the default pose with data, for the
+   *        subtree of a node.
+   *
+   * @param node     The root of the subtree.
+   * @param parent   The index of the node's parent, or -1 for the root node.
+   * @return The number of nodes in the subtree.
+   */
+  unsigned mapNodes(const aiNode* node, int parent = -1);
+
   /**
    * @brief A recursive functions that should be started from the root node, and
-   * it returns the first bone under it.
+   * it returns the track of the first bone under it, or -1.
    *
    * @param node   The current root node.
-   * @param anim   The animation to seek the root bone in.
+   * @param clip   The animation to seek the root bone in.
    */
-  const aiNodeAnim* getRootBone(const aiNode* node, const aiScene* anim);
+  int getRootBone(const aiNode* node, const BakedClip& clip);
 
   template <typename Index_t>
   /**
@@ -233,8 +449,11 @@ class AnimatedMeshRenderer : public MeshRenderer {
    * @param anim_time   The time elapsed since the start of this animation.
    * @param node_anim   The animation node, in which the function should search
    *                    for a keyframe.
+   * @param cursor      The result of the last search in this channel. The
+   *                    search starts from here, and it is updated.
    */
-  unsigned findPosition(float anim_time, const aiNodeAnim* node_anim);
+  static unsigned findPosition(float anim_time, const aiNodeAnim* node_anim,
+                               unsigned* cursor);
 
   /**
    * @brief Returns the index of the currently active rotation keyframe for
@@ -243,8 +462,11 @@ class AnimatedMeshRenderer : public MeshRenderer {
    * @param anim_time   The time elapsed since the start of this animation.
    * @param node_anim   The animation node, in which the function should search
    *                    for a keyframe.
+   * @param cursor      The result of the last search in this channel. The
+   *                    search starts from here, and it is updated.
    */
-  unsigned findRotation(float anim_time, const aiNodeAnim* node_anim);
+  static unsigned findRotation(float anim_time, const aiNodeAnim* node_anim,
+                               unsigned* cursor);
 
   /**
    * @brief Returns the index of the currently active scaling keyframe for
@@ -253,8 +475,11 @@ class AnimatedMeshRenderer : public MeshRenderer {
    * @param anim_time   The time elapsed since the start of this animation.
    * @param node_anim   The animation node, in which the function should search
    *                    for a keyframe.
+   * @param cursor      The result of the last search in this channel. The
+   *                    search starts from here, and it is updated.
    */
-  unsigned findScaling(float anim_time, const aiNodeAnim* node_anim);
+  static unsigned findScaling(float anim_time, const aiNodeAnim* node_anim,
+                              unsigned* cursor);
 
   /**
    * @brief Returns a linearly interpolated value between the previous and next
@@ -264,9 +489,11 @@ class AnimatedMeshRenderer : public MeshRenderer {
    * @param anim_time   The time elapsed since the start of this animation.
    * @param node_anim   The animation node, in which the function should search
    *                    for the keyframes.
+   * @param cursor      The keyframe cursor of the animation node.
    */
-  void calcInterpolatedPosition(aiVector3D& out, float anim_time,
-                                const aiNodeAnim* node_anim);
+  static void calcInterpolatedPosition(aiVector3D& out, float anim_time,
+                                       const aiNodeAnim* node_anim,
+                                       KeyCursor& cursor);
 
   /**
    * @brief Returns a spherically interpolated value (always choosing the shorter
@@ -276,9 +503,11 @@ class AnimatedMeshRenderer : public MeshRenderer {
    * @param anim_time   The time elapsed since the start of this animation.
    * @param node_anim   The animation node, in which the function should search
    *                    for the keyframes.
+   * @param cursor      The keyframe cursor of the animation node.
    */
-  void calcInterpolatedRotation(aiQuaternion& out, float anim_time,
-                                const aiNodeAnim* node_anim);
+  static void calcInterpolatedRotation(aiQuaternion& out, float anim_time,
+                                       const aiNodeAnim* node_anim,
+                                       KeyCursor& cursor);
 
   /**
    * @brief Returns a linearly interpolated value between the previous and next
@@ -288,68 +517,93 @@ class AnimatedMeshRenderer : public MeshRenderer {
    * @param anim_time   The time elapsed since the start of this animation.
    * @param node_anim   The animation node, in which the function should search
    *                    for the keyframes.
+   * @param cursor      The keyframe cursor of the animation node.
+   */
+  static void calcInterpolatedScaling(aiVector3D& out, float anim_time,
+                                      const aiNodeAnim* node_anim,
+                                      KeyCursor& cursor);
+
+  /**
+   * @brief Fills the node to track mapping of an animation, for the subtree
+   *        of a node.
+   *
+   * @param node            The root of the subtree.
+   * @param clip            The animation, whose tracks should be mapped.
+   * @param node_channels   The track indices are appended to this, in
+   *                        the order of SkinningData::nodes.
+   */
+  void mapChannels(const aiNode* node, const BakedClip& clip,
+                   std::vector<int>& node_channels);
+
+  /**
+   * @brief Resamples an animation with a uniform rate, and compresses it.
+   *
+   * @param animation   The animation to bake.
+   */
+  static std::unique_ptr<BakedClip> bakeAnimation(
+      const aiAnimation* animation);
+
+  /**
+   * @brief Evaluates the pose of an animated instance, regardless of its
+   *        level of detail.
+   *
+   * @param animation        The animation to update.
+   * @param time_in_seconds  The current time.
    */
-  void calcInterpolatedScaling(aiVector3D& out, float anim_time,
-                               const aiNodeAnim* node_anim);
+  void evaluatePose(Animation& animation, float time_in_seconds) const;
 
   /**
-   * @brief Returns the animation node in the given animation, referenced by
-   *        its name.
+   * @brief Samples the local transformations of every node of the skeleton
+   *        from an animation.
+   *
+   * The nodes that the animation doesn't have a track for get their
+   * default transformation.
    *
-   * Returns nullptr if it doesn't find a node with that name,
-   * which usually means that it's not a bone.
+   * @param anim_idx              The index of the animation to sample.
+   * @param anim_time             The current animation time.
+   * @param skipped_leaf_levels   The nodes with less levels of nodes below
+   *                              them than this, stay in their default pose.
+   * @param pose                  Returns the result here.
+   */
+  void samplePose(size_t anim_idx, float anim_time,
+                  unsigned skipped_leaf_levels, LocalPose& pose) const;
+
+  /**
+   * @brief Interpolates between two poses, used for the transition between
+   *        two animations.
    *
-   * @param animation - The animation, this function should search in.
-   * @param node_name - The name of the bone to search.
+   * @param prev_pose   The pose of the previous animation.
+   * @param factor      The weight of the current pose.
+   * @param pose        The pose of the current animation, the result is
+   *                    returned here.
    */
-  const aiNodeAnim* findNodeAnim(const aiAnimation* animation,
-                                 const std::string node_name);
+  void blendPoses(const LocalPose& prev_pose, float factor,
+                  LocalPose& pose) const;
 
   /**
-   * @brief Recursive function that travels through the entire node hierarchy,
-   *        and creates transformation values in world space.
+   * @brief Removes the root bone's movement on the XZ plane from the pose.
    *
-   * Bone transformations are stored relative to their parents. That's why it is
-   * needed. Also note, that the translation of the root node on the XZ plane is
-   * treated differently, that offset isn't baked into the animation, you can get
-   * the offset with the offsetSinceLastFrame() function, and you have to
-   * externally do the object's movement, as normally it will stay right where
-   * it was at the start of the animation.
+   * That offset isn't baked into the animation, you can get the offset with
+   * the offsetSinceLastFrame() function, and you have to externally do the
+   * object's movement, as normally it will stay right where it was at the
+   * start of the animation.
    *
-   * @param animation          The animation to update.
-   * @param anim_time          The current animation time.
-   * @param node               The node (bone) whose, and whose child's
-   *                           transformation should be updated. You should call
-   *                           this function with the root node.
-   * @param parent_transform   The transformation of the parent node. You should
-   *                           call it with an identity matrix.
+   * @return The removed offset.
    */
-  void updateBoneTree(Animation& animation,
-                      float anim_time,
-                      const aiNode* node,
-                      const glm::mat4& parent_transform = glm::mat4());
+  glm::vec3 removeRootMotion(LocalPose& pose) const;
 
   /**
-   * @brief Does the same thing as readNodeHierarchy, but it is used to create
-   *        transitions between animations, so it interpolates between four
-   *        keyframes not two.
+   * @brief Creates the transformations in model space from the local pose of
+   *        an instance, and updates its bones' final transformations.
+   *
+   * Bone transformations are stored relative to their parents, and as the
+   * nodes are sorted so that every parent precedes its children, it is done
+   * in a single pass over the nodes.
    *
-   * @param animation             The animation to update.
-   * @param prev_animation_time   The animation time of when, the last animation
-   *                              was interrupted.
-   * @param next_animation_time   The current animation time.
-   * @param node                  The node (bone) whose, and whose child's
-   *                              transformation should be updated. You should
-   *                              call this function with the root node.
-   * @param parent_transform      The transformation of the parent node. You
-   *                              should call it with an identity matrix.
+   * @param animation   The animated instance.
+   * @param mode        The format of the bone palette.
    */
-  void updateBoneTreeInTransition(Animation& animation,
-                                  float prev_animation_time,
-                                  float next_animation_time,
-                                  float factor,
-                                  const aiNode* node,
-                                  const glm::mat4& parent_transform = glm::mat4());
+  void updateGlobalTransforms(Animation& animation, SkinningMode mode) const;
 
 };  // AnimatedMeshRenderer
 }  // namespace engine
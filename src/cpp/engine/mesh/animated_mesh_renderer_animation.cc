@@ -1,58 +1,81 @@
 // Copyright (c) 2014, Tamas Csala
 
+#include <cmath>
+#include <algorithm>
 #include "animated_mesh_renderer.h"
 #include "animation.h"
 
 namespace engine {
 
+/// The number of samples per second in the baked animations.
+static const float kAnimationSampleRate = 30.0f;
+
 template <typename T, typename U>
 T mix(const T& x, const T& y, const U& a) {
    return x*(1-a) + y*a;
 }
 
-unsigned AnimatedMeshRenderer::findPosition(float anim_time,
-                                            const aiNodeAnim* node_anim) {
-   // Find the first one that is bigger or equals
-   for (unsigned i = 0; i < node_anim->mNumPositionKeys - 1; i++) {
-      if (anim_time <= (float)node_anim->mPositionKeys[i + 1].mTime) {
-         return i;
-      }
+/// Returns the index of the key, that starts the interval containing anim_time.
+/** The search starts at the cursor, and at its neighbours, as the animation
+  * time usually changes just a little between two calls. If that fails (after
+  * a seek, or a loop), it falls back to a binary search. */
+template <typename Key>
+static unsigned FindKey(float anim_time, const Key* keys,
+                        unsigned num_keys, unsigned* cursor) {
+   unsigned last = num_keys - 2;
+   auto is_valid = [=](unsigned i) {
+      return (i == 0 || (float)keys[i].mTime < anim_time) &&
+             (i == last || anim_time <= (float)keys[i + 1].mTime);
+   };
+
+   unsigned i = std::min(*cursor, last);
+   if (is_valid(i)) {
+      return i;
+   } else if (i < last && is_valid(i + 1)) {
+      return *cursor = i + 1;
+   } else if (0 < i && is_valid(i - 1)) {
+      return *cursor = i - 1;
    }
-   // Should never get here
-   assert(0);
+
+   // Find the first one that is bigger or equals
+   const Key* key = std::lower_bound(keys + 1, keys + num_keys - 1, anim_time,
+      [](const Key& key, float time) { return (float)key.mTime < time; });
+   return *cursor = (key - keys) - 1;
+}
+
+unsigned AnimatedMeshRenderer::findPosition(float anim_time,
+                                            const aiNodeAnim* node_anim,
+                                            unsigned* cursor) {
+   return FindKey(anim_time, node_anim->mPositionKeys,
+                  node_anim->mNumPositionKeys, cursor);
 }
 
 unsigned AnimatedMeshRenderer::findRotation(float anim_time,
-                                            const aiNodeAnim* node_anim) {
-   for (unsigned i = 0; i < node_anim->mNumRotationKeys - 1; i++) {
-      if (anim_time <= (float)node_anim->mRotationKeys[i + 1].mTime) {
-         return i;
-      }
-   }
-   assert(0);
+                                            const aiNodeAnim* node_anim,
+                                            unsigned* cursor) {
+   return FindKey(anim_time, node_anim->mRotationKeys,
+                  node_anim->mNumRotationKeys, cursor);
 }
 
 unsigned AnimatedMeshRenderer::findScaling(float anim_time,
-                                           const aiNodeAnim* node_anim) {
-   for (unsigned i = 0; i < node_anim->mNumScalingKeys - 1; i++) {
-      if (anim_time <= (float)node_anim->mScalingKeys[i + 1].mTime) {
-         return i;
-      }
-   }
-   assert(0);
+                                           const aiNodeAnim* node_anim,
+                                           unsigned* cursor) {
+   return FindKey(anim_time, node_anim->mScalingKeys,
+                  node_anim->mNumScalingKeys, cursor);
 }
 
 void AnimatedMeshRenderer::calcInterpolatedPosition(
                                                 aiVector3D& out,
                                                 float anim_time,
-                                                const aiNodeAnim* node_anim) {
+                                                const aiNodeAnim* node_anim,
+                                                KeyCursor& cursor) {
    const auto& keys = node_anim->mPositionKeys;
    const auto& numKeys = node_anim->mNumPositionKeys;
    if (numKeys == 1) {
       out = keys[0].mValue;
       return;
    }
-   size_t i = findPosition(anim_time, node_anim);
+   size_t i = findPosition(anim_time, node_anim, &cursor.position);
    float deltaTime = keys[i + 1].mTime - keys[i].mTime;
    float factor = (anim_time - (float)keys[i].mTime) / deltaTime;
    factor = glm::clamp(factor, 0.0f, 1.0f);
@@ -65,14 +88,15 @@ void AnimatedMeshRenderer::calcInterpolatedPosition(
 void AnimatedMeshRenderer::calcInterpolatedRotation(
                                                 aiQuaternion& out,
                                                 float anim_time,
-                                                const aiNodeAnim* node_anim) {
+                                                const aiNodeAnim* node_anim,
+                                                KeyCursor& cursor) {
    const auto& keys = node_anim->mRotationKeys;
    const auto& numKeys = node_anim->mNumRotationKeys;
    if (numKeys == 1) {
       out = keys[0].mValue;
       return;
    }
-   size_t i = findRotation(anim_time, node_anim);
+   size_t i = findRotation(anim_time, node_anim, &cursor.rotation);
    float deltaTime = keys[i + 1].mTime - keys[i].mTime;
    float factor = (anim_time - (float)keys[i].mTime) / deltaTime;
    factor = glm::clamp(factor, 0.0f, 1.0f);
@@ -86,14 +110,15 @@ void AnimatedMeshRenderer::calcInterpolatedRotation(
 void AnimatedMeshRenderer::calcInterpolatedScaling(
                                                 aiVector3D& out,
                                                 float anim_time,
-                                                const aiNodeAnim* node_anim) {
+                                                const aiNodeAnim* node_anim,
+                                                KeyCursor& cursor) {
    const auto& keys = node_anim->mScalingKeys;
    const auto& numKeys = node_anim->mNumScalingKeys;
    if (numKeys == 1) {
       out = keys[0].mValue;
       return;
    }
-   size_t i = findRotation(anim_time, node_anim);
+   size_t i = findScaling(anim_time, node_anim, &cursor.scaling);
    float deltaTime = keys[i + 1].mTime - keys[i].mTime;
    float factor = (anim_time - (float)keys[i].mTime) / deltaTime;
    factor = glm::clamp(factor, 0.0f, 1.0f);
@@ -103,183 +128,272 @@ void AnimatedMeshRenderer::calcInterpolatedScaling(
    out = mix(start, end, factor);
 }
 
-const aiNodeAnim* AnimatedMeshRenderer::findNodeAnim(const aiAnimation* animation,
-                                                     const std::string node_name) {
-   for (unsigned i = 0; i < animation->mNumChannels; i++) {
-      const aiNodeAnim* node_anim = animation->mChannels[i];
-      if (std::string(node_anim->mNodeName.data) == node_name) {
-         return node_anim;
-      }
+void AnimatedMeshRenderer::mapChannels(const aiNode* node,
+                                       const BakedClip& clip,
+                                       std::vector<int>& node_channels) {
+   std::string node_name(node->mName.data);
+   if (node_name == skinning_data_.root_bone) {
+      skinning_data_.root_bone_node = node_channels.size();
+   }
+
+   node_channels.push_back(clip.findTrack(node_name));
+
+   for (unsigned i = 0; i < node->mNumChildren; i++) {
+      mapChannels(node->mChildren[i], clip, node_channels);
    }
-   return nullptr;
 }
 
-void AnimatedMeshRenderer::updateBoneTree(Animation& anim,
-                                          float anim_time,
-                                          const aiNode* node,
-                                          const glm::mat4& parent_transform) {
-   std::string node_name(node->mName.data);
-   const aiAnimation* animation = anim.current_anim_.handle->mAnimations[0];
-   const aiNodeAnim* node_anim = findNodeAnim(animation, node_name);
-   glm::mat4 local_transform = engine::convertMatrix(node->mTransformation);
-
-   if (node_anim) {
-      // Interpolate the transformations and get the matrices
-      aiVector3D scaling;
-      calcInterpolatedScaling(scaling, anim_time, node_anim);
-      glm::mat4 scalingM = glm::scale(glm::mat4(), glm::vec3(scaling.x, scaling.y, scaling.z));
-
-      aiQuaternion rotation;
-      calcInterpolatedRotation(rotation, anim_time, node_anim);
-      glm::mat4 rotationM = engine::convertMatrix(rotation.GetMatrix());
-
-      aiVector3D translation;
-      calcInterpolatedPosition(translation, anim_time, node_anim);
-      glm::mat4 translationM;
-
-      if (node_name == skinning_data_.root_bone) {
-         anim.current_anim_.offset = glm::vec3(translation.x, 0, translation.z);
-         if (anim.current_anim_.flags.test(AnimFlag::Mirrored)) {
-            anim.current_anim_.offset *= -1;
-         }
-         translationM = glm::translate(glm::mat4(), glm::vec3(0, translation.y, 0));
-      } else {
-         translationM = glm::translate(glm::mat4(), glm::vec3(translation.x, translation.y, translation.z));
+std::unique_ptr<BakedClip> AnimatedMeshRenderer::bakeAnimation(
+                                             const aiAnimation* animation) {
+   float ticks_per_second = animation->mTicksPerSecond > 1e-10 ? // != 0
+                            animation->mTicksPerSecond : 24.0f;
+   float duration = animation->mDuration;
+   unsigned sample_count =
+      std::ceil(duration / ticks_per_second * kAnimationSampleRate) + 1;
+
+   std::unique_ptr<BakedClip> clip{
+      new BakedClip{duration, ticks_per_second, sample_count}};
+
+   std::vector<glm::vec3> translations(sample_count), scales(sample_count);
+   std::vector<glm::quat> rotations(sample_count);
+   for (unsigned channel = 0; channel < animation->mNumChannels; channel++) {
+      const aiNodeAnim* node_anim = animation->mChannels[channel];
+      // The samples are taken in order, so the cursor is always at the
+      // right place, or one key before it.
+      KeyCursor cursor;
+      for (unsigned i = 0; i < sample_count; i++) {
+         float anim_time = sample_count > 1 ? duration * i / (sample_count - 1) : 0;
+
+         aiVector3D scaling;
+         calcInterpolatedScaling(scaling, anim_time, node_anim, cursor);
+         scales[i] = engine::convertVector(scaling);
+
+         aiQuaternion rotation;
+         calcInterpolatedRotation(rotation, anim_time, node_anim, cursor);
+         rotations[i] = engine::convertQuaternion(rotation);
+
+         aiVector3D translation;
+         calcInterpolatedPosition(translation, anim_time, node_anim, cursor);
+         translations[i] = engine::convertVector(translation);
       }
-      // Combine the transformations
-      local_transform = translationM * rotationM * scalingM;
+      clip->addTrack(node_anim->mNodeName.data, translations.data(),
+                     rotations.data(), scales.data());
    }
 
-   glm::mat4 global_transform = parent_transform * local_transform;
+   return clip;
+}
+
+/// Creates an affine transformation from a translation, a rotation and a scale.
+/** It is the same as translate(t) * mat4_cast(r) * scale(s), but it doesn't
+  * do any matrix multiplication. */
+static glm::mat4x3 ComposeAffine(const glm::vec3& t, const glm::quat& r,
+                                 const glm::vec3& s) {
+   glm::mat3 rotation = glm::mat3_cast(r);
+   return glm::mat4x3(rotation[0] * s.x, rotation[1] * s.y,
+                      rotation[2] * s.z, t);
+}
 
-   if (skinning_data_.bone_mapping.find(node_name) != skinning_data_.bone_mapping.end()) {
-      unsigned bone_idx = skinning_data_.bone_mapping[node_name];
-      if (skinning_data_.bone_info[bone_idx].external == false) {
-         skinning_data_.bone_info[bone_idx].final_transform =
-            global_transform * skinning_data_.bone_info[bone_idx].bone_offset;
-      }
-      if (skinning_data_.bone_info[bone_idx].pinned == true) {
-         *skinning_data_.bone_info[bone_idx].global_transform_ptr = global_transform;
-         // A pinned bone has all external child
-         return;
-      }
+/// Multiplies two affine transformations.
+/** The last rows of both matrices are implicitly (0, 0, 0, 1), so it is
+  * three 3x3 matrix-vector products less than a mat4 multiplication. */
+static glm::mat4x3 MultiplyAffine(const glm::mat4x3& a, const glm::mat4x3& b) {
+   glm::mat3 a_linear(a[0], a[1], a[2]);
+   return glm::mat4x3(a_linear * b[0], a_linear * b[1],
+                      a_linear * b[2], a_linear * b[3] + a[3]);
+}
+
+/// Writes a bone's transformation into the palette, in the given format.
+static void PackBone(const glm::mat4x3& transform, SkinningMode mode,
+                     glm::vec4* out) {
+   if (mode == SkinningMode::Linear) {
+      glm::mat3x4 rows = glm::transpose(transform);
+      out[0] = rows[0];
+      out[1] = rows[1];
+      out[2] = rows[2];
+   } else {
+      // Dual quaternions can't represent scaling, so it's removed
+      glm::quat real = glm::quat_cast(glm::mat3(glm::normalize(transform[0]),
+                                                glm::normalize(transform[1]),
+                                                glm::normalize(transform[2])));
+      glm::vec3 t = transform[3];
+      glm::quat dual = 0.5f * (glm::quat(0.0f, t.x, t.y, t.z) * real);
+      out[0] = glm::vec4(real.x, real.y, real.z, real.w);
+      out[1] = glm::vec4(dual.x, dual.y, dual.z, dual.w);
    }
-   for (unsigned i = 0; i < node->mNumChildren; i++) {
-      updateBoneTree(anim, anim_time, node->mChildren[i], global_transform);
+}
+
+void AnimatedMeshRenderer::samplePose(size_t anim_idx,
+                                      float anim_time,
+                                      unsigned skipped_leaf_levels,
+                                      LocalPose& pose) const {
+   const BakedClip& clip = *anims_[anim_idx].handle;
+   const std::vector<int>& node_channels = anims_[anim_idx].node_channels;
+
+   // The nodes that aren't animated stay in their default pose
+   pose = skinning_data_.default_pose;
+
+   const std::vector<SkinningData::NodeInfo>& nodes = skinning_data_.nodes;
+   for (size_t i = 0; i < node_channels.size(); i++) {
+      int track = node_channels[i];
+      if (track >= 0 && nodes[i].height >= skipped_leaf_levels) {
+         clip.sample(track, anim_time, &pose.translations[i],
+                     &pose.rotations[i], &pose.scales[i]);
+      }
    }
 }
 
-void AnimatedMeshRenderer::updateBoneTreeInTransition(
-                                             Animation& anim,
-                                             float prev_anim_time,
-                                             float next_anim_time,
-                                             float factor,
-                                             const aiNode* node,
-                                             const glm::mat4& parent_transform) {
-   std::string node_name(node->mName.data);
-   const aiAnimation* prev_animation = anim.last_anim_.handle->mAnimations[0];
-   const aiAnimation* next_animation = anim.current_anim_.handle->mAnimations[0];
-   const aiNodeAnim* prev_node_anim = findNodeAnim(prev_animation, node_name);
-   const aiNodeAnim* next_node_anim = findNodeAnim(next_animation, node_name);
+void AnimatedMeshRenderer::blendPoses(const LocalPose& prev_pose,
+                                      float factor,
+                                      LocalPose& pose) const {
+   for (size_t i = 0; i < pose.translations.size(); i++) {
+      pose.translations[i] =
+         glm::mix(prev_pose.translations[i], pose.translations[i], factor);
+   }
+   for (size_t i = 0; i < pose.rotations.size(); i++) {
+      // Spherical linear interpolation, that chooses the shorter path.
+      const glm::quat& prev = prev_pose.rotations[i];
+      glm::quat& next = pose.rotations[i];
+      next = glm::slerp(prev, glm::dot(prev, next) < 0 ? -next : next, factor);
+   }
+   for (size_t i = 0; i < pose.scales.size(); i++) {
+      pose.scales[i] = glm::mix(prev_pose.scales[i], pose.scales[i], factor);
+   }
+}
 
-   glm::mat4 local_transform = engine::convertMatrix(node->mTransformation);
+glm::vec3 AnimatedMeshRenderer::removeRootMotion(LocalPose& pose) const {
+   int root = skinning_data_.root_bone_node;
+   if (root < 0) {
+      return glm::vec3();
+   }
 
-   if (prev_node_anim && next_node_anim) {
-      // Interpolate the transformations and get the matrices
-      aiVector3D prev_scaling, next_scaling;
-      calcInterpolatedScaling(prev_scaling, prev_anim_time, prev_node_anim);
-      calcInterpolatedScaling(next_scaling, next_anim_time, next_node_anim);
-      aiVector3D scaling = mix(prev_scaling, next_scaling, factor);
-      glm::mat4 scalingM = glm::scale(glm::mat4(), glm::vec3(scaling.x, scaling.y, scaling.z));
+   glm::vec3& translation = pose.translations[root];
+   glm::vec3 offset = glm::vec3(translation.x, 0, translation.z);
+   translation.x = translation.z = 0;
+   return offset;
+}
 
-      aiQuaternion prev_rotation, next_rotation, rotation;
-      calcInterpolatedRotation(prev_rotation, prev_anim_time, prev_node_anim);
-      calcInterpolatedRotation(next_rotation, next_anim_time, next_node_anim);
+void AnimatedMeshRenderer::updateGlobalTransforms(Animation& anim,
+                                                  SkinningMode mode) const {
+   const std::vector<SkinningData::NodeInfo>& nodes = skinning_data_.nodes;
+   const LocalPose& pose = anim.pose_;
+   std::vector<glm::mat4x3>& global_transforms = anim.global_transforms_;
+   std::vector<glm::vec4>& bone_palette = anim.bone_palette_;
+   size_t stride = PaletteVectorsPerBone(mode);
+   global_transforms.resize(nodes.size());
+   bone_palette.resize(stride * skinning_data_.num_bones);
+
+   // The nodes are in pre-order, so the parents are always updated before
+   // their children.
+   for (size_t i = 0; i < nodes.size(); i++) {
+      glm::mat4x3 local_transform = ComposeAffine(
+         pose.translations[i], pose.rotations[i], pose.scales[i]);
+
+      int parent = nodes[i].parent;
+      if (parent < 0) {
+         global_transforms[i] = local_transform;
+      } else {
+         global_transforms[i] =
+            MultiplyAffine(global_transforms[parent], local_transform);
+      }
 
-      // Spherical linear interpolation, that chooses the shorter path.
-      aiQuaternion::Interpolate(rotation, prev_rotation, next_rotation, factor);
-      glm::mat4 rotationM = engine::convertMatrix(rotation.GetMatrix());
-
-      aiVector3D prev_translation, next_translation;
-      calcInterpolatedPosition(prev_translation, prev_anim_time, prev_node_anim);
-      calcInterpolatedPosition(next_translation, next_anim_time, next_node_anim);
-      aiVector3D translation = mix(prev_translation, next_translation, factor);
-      glm::mat4 translationM;
-      if (node_name == skinning_data_.root_bone) {
-         anim.current_anim_.offset =
-            glm::vec3(next_translation.x, 0, next_translation.z);
-         if (anim.current_anim_.flags.test(AnimFlag::Mirrored)) {
-            anim.current_anim_.offset *= -1;
+      int bone_idx = nodes[i].bone_idx;
+      if (bone_idx >= 0) {
+         const SkinningData::BoneInfo& bone_info =
+            skinning_data_.bone_info[bone_idx];
+         glm::vec4* out = &bone_palette[stride * bone_idx];
+         if (bone_info.external == false) {
+            PackBone(MultiplyAffine(global_transforms[i],
+                                    glm::mat4x3(bone_info.bone_offset)),
+                     mode, out);
+         } else {
+            // Set from outside, through an ExternalBoneTree
+            PackBone(glm::mat4x3(bone_info.final_transform), mode, out);
          }
-         translationM = glm::translate(glm::mat4(), glm::vec3(0, translation.y, 0));
-      } else {
-         translationM = glm::translate(glm::mat4(), glm::vec3(translation.x, translation.y, translation.z));
       }
-      // Combine the transformations
-      local_transform = translationM * rotationM * scalingM;
+   }
+}
+
+void AnimatedMeshRenderer::updatePose(Animation& anim, float time) const {
+   const AnimLod& lod = anim.lod_;
+   if (lod.update_interval == 1) {
+      evaluatePose(anim, time);
+      return;
    }
 
-   glm::mat4 global_transform = parent_transform * local_transform;
+   // The pose lags behind with one interval, and so does the root motion:
+   // the motion between the last two evaluated poses is handed out over the
+   // interval, with the same factor as the bones.
+   if (anim.lod_skipped_updates_ == 0) {
+      evaluatePose(anim, time);
+      std::swap(anim.lod_prev_palette_, anim.lod_next_palette_);
+      anim.lod_next_palette_ = anim.bone_palette_;
+      anim.lod_prev_time_ = anim.lod_next_time_;
+      anim.lod_next_time_ = time;
+   }
+   anim.lod_skipped_updates_ = (anim.lod_skipped_updates_ + 1) % lod.update_interval;
+
+   const std::vector<glm::vec4>& prev = anim.lod_prev_palette_;
+   const std::vector<glm::vec4>& next = anim.lod_next_palette_;
+   float interval = anim.lod_next_time_ - anim.lod_prev_time_;
+   if (prev.size() != next.size() || interval <= 0) {
+      anim.bone_palette_ = next;
+      anim.lod_pending_motion_ = glm::vec3();
+      return;
+   }
 
-   if (skinning_data_.bone_mapping.find(node_name) != skinning_data_.bone_mapping.end()) {
-      unsigned bone_idx = skinning_data_.bone_mapping[node_name];
-      if (skinning_data_.bone_info[bone_idx].external == false) {
-         skinning_data_.bone_info[bone_idx].final_transform =
-            global_transform * skinning_data_.bone_info[bone_idx].bone_offset;
+   float factor = glm::clamp((time - anim.lod_next_time_) / interval, 0.0f, 1.0f);
+   anim.lod_pending_motion_ = anim.lod_root_motion_ * (1 - factor);
+   if (skinning_data_.skinning_mode == SkinningMode::Linear) {
+      for (size_t i = 0; i < next.size(); i++) {
+         anim.bone_palette_[i] = prev[i] * (1 - factor) + next[i] * factor;
       }
-      if (skinning_data_.bone_info[bone_idx].pinned == true) {
-         *skinning_data_.bone_info[bone_idx].global_transform_ptr = global_transform;
-         // A pinned bone has all external child
-         return;
+   } else {
+      for (size_t i = 0; i + 1 < next.size(); i += 2) {
+         // A dual quaternion and its negation are the same transformation,
+         // but only the ones in the same hemisphere can be interpolated.
+         float sign = glm::dot(prev[i], next[i]) < 0 ? -1.0f : 1.0f;
+         anim.bone_palette_[i] = prev[i] * (1 - factor) + next[i] * (sign * factor);
+         anim.bone_palette_[i+1] =
+            prev[i+1] * (1 - factor) + next[i+1] * (sign * factor);
       }
    }
-   for (unsigned i = 0; i < node->mNumChildren; i++) {
-      updateBoneTreeInTransition(
-         anim, prev_anim_time, next_anim_time, factor,
-         node->mChildren[i], global_transform
-      );
-   }
 }
 
-void AnimatedMeshRenderer::updateBoneInfo(Animation& anim,
-                                          float time) {
-   if (!anim.current_anim_.handle || anim.current_anim_.handle->mAnimations == 0
-      || !anim.last_anim_.handle || anim.last_anim_.handle->mAnimations == 0) {
+void AnimatedMeshRenderer::evaluatePose(Animation& anim, float time) const {
+   if (!anim.current_anim_.handle || !anim.last_anim_.handle) {
       throw std::runtime_error("Tried to run an invalid animation.");
    }
 
-   float last_ticks_per_second = anim.last_anim_.handle->mAnimations[0]->mTicksPerSecond > 1e-10 ? // != 0
-                                 anim.last_anim_.handle->mAnimations[0]->mTicksPerSecond : 24.0f;
+   float last_ticks_per_second = anim.last_anim_.handle->ticks_per_second();
    float last_time_in_ticks = anim.anim_meta_info_.last_period_time * (anim.last_anim_.speed * last_ticks_per_second);
    float last_anim_time;
    if (anim.last_anim_.flags.test(AnimFlag::Repeat)) {
-      last_anim_time = fmod(last_time_in_ticks, (float)anim.last_anim_.handle->mAnimations[0]->mDuration);
+      last_anim_time = fmod(last_time_in_ticks, anim.last_anim_.handle->duration());
    } else {
-      last_anim_time = std::min(last_time_in_ticks, (float)anim.last_anim_.handle->mAnimations[0]->mDuration);
+      last_anim_time = std::min(last_time_in_ticks, anim.last_anim_.handle->duration());
    }
    if (anim.last_anim_.flags.test(AnimFlag::Backwards)) {
-      last_anim_time = (float)anim.last_anim_.handle->mAnimations[0]->mDuration - last_anim_time;
+      last_anim_time = anim.last_anim_.handle->duration() - last_anim_time;
    }
 
-   float current_ticks_per_second = anim.current_anim_.handle->mAnimations[0]->mTicksPerSecond > 1e-10 ? // != 0
-                                    anim.current_anim_.handle->mAnimations[0]->mTicksPerSecond : 24.0f;
+   float current_ticks_per_second = anim.current_anim_.handle->ticks_per_second();
    float current_time_in_ticks =
       (time - anim.anim_meta_info_.end_of_last_anim) * (anim.current_anim_.speed * current_ticks_per_second);
    float current_anim_time;
    if (anim.current_anim_.flags.test(AnimFlag::Repeat)) {
-      current_anim_time = fmod(current_time_in_ticks, (float)anim.current_anim_.handle->mAnimations[0]->mDuration);
+      current_anim_time = fmod(current_time_in_ticks, anim.current_anim_.handle->duration());
    } else {
-      if (current_time_in_ticks < (float)anim.current_anim_.handle->mAnimations[0]->mDuration) {
+      if (current_time_in_ticks < anim.current_anim_.handle->duration()) {
          current_anim_time = current_time_in_ticks;
       } else {
          anim.animationEnded(time);
-         updateBoneInfo(anim, time);
+         evaluatePose(anim, time);
          return;
       }
    }
 
    if (anim.current_anim_.flags.test(AnimFlag::Backwards)) {
-      current_anim_time = (float)anim.current_anim_.handle->mAnimations[0]->mDuration - current_anim_time;
+      current_anim_time = anim.current_anim_.handle->duration() - current_anim_time;
    }
 
    bool in_transition =
@@ -287,19 +401,31 @@ void AnimatedMeshRenderer::updateBoneInfo(Animation& anim,
    float transition_factor =
       (time - anim.anim_meta_info_.end_of_last_anim) / anim.anim_meta_info_.transition_time;
 
-   if (in_transition) {
-      // Normal animation
-      updateBoneTree(anim, current_anim_time, scene_->mRootNode);
-   } else {
+   unsigned skipped_levels = anim.lod_.skipped_leaf_levels;
+   LocalPose& pose = anim.pose_;
+   samplePose(anim.current_anim_.idx, current_anim_time, skipped_levels, pose);
+   glm::vec3 last_offset = anim.current_anim_.offset;
+   anim.current_anim_.offset = removeRootMotion(pose);
+   if (anim.current_anim_.flags.test(AnimFlag::Mirrored)) {
+      anim.current_anim_.offset *= -1;
+   }
+   anim.lod_root_motion_ = anim.current_anim_.offset - last_offset;
+
+   if (!in_transition) {
       // Transition between two animations.
-      updateBoneTreeInTransition(anim, last_anim_time, current_anim_time,
-                                 transition_factor, scene_->mRootNode);
+      LocalPose& prev_pose = anim.prev_pose_;
+      samplePose(anim.last_anim_.idx, last_anim_time, skipped_levels, prev_pose);
+      // The offset only comes from the current animation.
+      removeRootMotion(prev_pose);
+      blendPoses(prev_pose, transition_factor, pose);
    }
 
+   updateGlobalTransforms(anim, skinning_data_.skinning_mode);
+
    // Start a new loop if necessary
    if (anim.current_anim_.flags.test(AnimFlag::Repeat)) {
       unsigned loop_count = current_time_in_ticks /
-                        (float)anim.current_anim_.handle->mAnimations[0]->mDuration;
+                        anim.current_anim_.handle->duration();
       if (loop_count > anim.anim_meta_info_.last_loop_count) {
          if (anim.current_anim_.flags.test(AnimFlag::MirroredRepeat)) {
             anim.current_anim_.flags ^= AnimFlag::Mirrored;
@@ -316,26 +442,68 @@ void AnimatedMeshRenderer::updateBoneInfo(Animation& anim,
             anim.last_anim_.offset *= -1;
             anim.current_anim_.offset *= -1;
          }
+         // The offset restarted, so no motion is left to hand out
+         anim.lod_root_motion_ = glm::vec3();
       }
       anim.anim_meta_info_.last_loop_count = loop_count;
    }
 }
 
-/// Updates the bones transformations.
-/** @param time_in_seconds - Expected to be a time value in seconds. */
-void AnimatedMeshRenderer::uploadBoneInfo(
-                                    gl::LazyUniform<glm::mat4>& bones) {
-  for (unsigned i = 0; i < skinning_data_.num_bones; i++) {
-      bones[i] = skinning_data_.bone_info[i].final_transform;
-  }
+float AnimatedMeshRenderer::getAnimationDuration(
+      const std::string& anim_name) const {
+   const AnimInfo& anim_info = anims_[anim_name];
+   const BakedClip& clip = *anim_info.handle;
+   return clip.duration() / (clip.ticks_per_second() * anim_info.speed);
+}
+
+std::vector<glm::vec4> AnimatedMeshRenderer::bakeBonePalettes(
+      const std::string& anim_name, unsigned frame_count) const {
+   size_t anim_idx = anims_.names.at(anim_name);
+   float duration = anims_[anim_idx].handle->duration();
+
+   Animation anim(anims_);
+   std::vector<glm::vec4> palettes;
+   for (unsigned frame = 0; frame < frame_count; frame++) {
+      samplePose(anim_idx, duration * frame / frame_count, 0, anim.pose_);
+      removeRootMotion(anim.pose_);
+      updateGlobalTransforms(anim, SkinningMode::Linear);
+      palettes.insert(palettes.end(), anim.bone_palette_.begin(),
+                      anim.bone_palette_.end());
+   }
+
+   return palettes;
+}
+
+void AnimatedMeshRenderer::updateBoneInfo(Animation& anim, float time) {
+   updatePose(anim, time);
+
+   // Only the instances that are updated this way move the external bones
+   const std::vector<SkinningData::NodeInfo>& nodes = skinning_data_.nodes;
+   for (size_t i = 0; i < nodes.size(); i++) {
+      int bone_idx = nodes[i].bone_idx;
+      if (bone_idx >= 0 && skinning_data_.bone_info[bone_idx].pinned) {
+         *skinning_data_.bone_info[bone_idx].global_transform_ptr =
+            glm::mat4(anim.global_transforms_[i]);
+      }
+   }
+}
+
+void AnimatedMeshRenderer::uploadBoneInfo(const Animation& anim,
+                                          BonePaletteUniform& bones) {
+  bones.set(anim.bone_palette_);
+}
+
+void AnimatedMeshRenderer::uploadBoneInfo(const Animation& anim,
+                                          BonePaletteBuffer& bones) {
+  bones.set(anim.bone_palette_);
 }
 
 void AnimatedMeshRenderer::updateAndUploadBoneInfo(
                                     Animation& anim,
                                     float time,
-                                    gl::LazyUniform<glm::mat4>& bones) {
+                                    BonePaletteUniform& bones) {
   updateBoneInfo(anim, time);
-  uploadBoneInfo(bones);
+  uploadBoneInfo(anim, bones);
 }
 
 } // namespace engine
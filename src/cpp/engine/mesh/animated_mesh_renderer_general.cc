@@ -1,51 +1,102 @@
 // Copyright (c) 2014, Tamas Csala
 
+#include <algorithm>
 #include "animated_mesh_renderer.h"
+#include "../misc.h"
 
 namespace engine {
 
 AnimatedMeshRenderer::AnimatedMeshRenderer(
                                   const std::string& filename,
-                                  gl::Bitfield<aiPostProcessSteps> flags)
-  : MeshRenderer(filename, flags)
-  , skinning_data_(scene_->mNumMeshes) {
+                                  gl::Bitfield<aiPostProcessSteps> flags,
+                                  unsigned max_bone_influences,
+                                  SkinningMode skinning_mode)
+  : AnimatedMeshRenderer(ImportedScene::Import(filename, flags),
+                         max_bone_influences, skinning_mode) {}
+
+AnimatedMeshRenderer::AnimatedMeshRenderer(ImportedScene imported,
+                                           unsigned max_bone_influences,
+                                           SkinningMode skinning_mode)
+  : MeshRenderer(std::move(imported))
+  , skinning_data_(scene_->mNumMeshes,
+                   std::min(std::max(max_bone_influences, 1u), 32u),
+                   skinning_mode) {
+  mapBones();
+  mapNodes(scene_->mRootNode);
+}
+
+std::unique_ptr<BakedClip> AnimatedMeshRenderer::loadClip(
+                                              const std::string& filename) {
+  std::string baked_filename = filename + ".clip";
+  std::unique_ptr<BakedClip> clip;
+  if (IsNewer(baked_filename, filename)) {
+    clip = BakedClip::load(baked_filename);
+  }
+  if (!clip) {
+    Assimp::Importer importer;
+    const aiScene* anim_scene = importer.ReadFile(filename, aiProcess_Debone);
+    if (!anim_scene || anim_scene->mNumAnimations == 0) {
+      throw std::runtime_error("Error parsing " + filename
+                                + " : " + importer.GetErrorString());
+    }
+    clip = bakeAnimation(anim_scene->mAnimations[0]);
+    if (!clip->save(baked_filename)) {
+      std::cerr << "Couldn't write the animation cache '"
+                << baked_filename << "'" << std::endl;
+    }
+  }
+
+  return clip;
 }
 
 void AnimatedMeshRenderer::addAnimation(const std::string& filename,
                                         const std::string& anim_name,
                                         gl::Bitfield<AnimFlag> flags,
                                         float speed) {
+  addAnimation(loadClip(filename), anim_name, flags, speed);
+}
+
+void AnimatedMeshRenderer::addAnimation(std::unique_ptr<BakedClip> clip,
+                                        const std::string& anim_name,
+                                        gl::Bitfield<AnimFlag> flags,
+                                        float speed) {
   if (anims_.canFind(anim_name)) {
     throw std::runtime_error(
-      "Animation name '" + anim_name + "' isn't unique for '" + filename + "'"
+      "Animation name '" + anim_name + "' isn't unique for '" + filename_ + "'"
     );
   }
   size_t idx = anims_.data.size();
   anims_.names[anim_name] = idx;
   anims_.data.push_back(AnimInfo());
   anims_[idx].name = anim_name;
-  anims_[idx].handle = anims_[idx].importer->ReadFile(filename, aiProcess_Debone);
-  if (!anims_[idx].handle) {
-    throw std::runtime_error("Error parsing " + filename
-                              + " : " + anims_[idx].importer->GetErrorString());
-  }
 
-  auto node = getRootBone(scene_->mRootNode, anims_[idx].handle);
-  if (!node) {
+  anims_[idx].clip = std::move(clip);
+  anims_[idx].handle = anims_[idx].clip.get();
+
+  const BakedClip& baked_clip = *anims_[idx].handle;
+  int root_track = getRootBone(scene_->mRootNode, baked_clip);
+  if (root_track < 0) {
     throw std::runtime_error(
       "Animation error: The mesh's skeleton, and the animated skeleton '"
       + anim_name + "' doesn't have a single bone in common."
     );
   }
 
-  aiVector3D v = node->mPositionKeys[0].mValue;
-  anims_[idx].start_offset = glm::vec3(v.x, v.y, v.z);
+  glm::vec3 translation, scale;
+  glm::quat rotation;
+  baked_clip.sample(root_track, 0, &translation, &rotation, &scale);
+  anims_[idx].start_offset = translation;
 
-  v = node->mPositionKeys[node->mNumPositionKeys - 1].mValue;
-  anims_[idx].end_offset =  glm::vec3(v.x, v.y, v.z);
+  baked_clip.sample(root_track, baked_clip.duration(),
+                    &translation, &rotation, &scale);
+  anims_[idx].end_offset = translation;
 
   anims_[idx].flags = flags;
   anims_[idx].speed = speed;
+
+  std::vector<int>& node_channels = anims_[idx].node_channels;
+  node_channels.reserve(skinning_data_.nodes.size());
+  mapChannels(scene_->mRootNode, baked_clip, node_channels);
 }
 
 } // namespace engine
@@ -2,8 +2,11 @@
 
 #include <vector>
 #include <limits>
+#include <cstddef>
+#include <algorithm>
 #include <string>
 #include "./animated_mesh_renderer.h"
+#include "../gl_state.h"
 
 namespace engine {
 
@@ -30,21 +33,55 @@ void AnimatedMeshRenderer::mapBones() {
   }
 }
 
+/// Fills SkinningData::nodes and the default pose with data.
+unsigned AnimatedMeshRenderer::mapNodes(const aiNode* node, int parent) {
+  size_t node_idx = skinning_data_.nodes.size();
+  skinning_data_.nodes.push_back(SkinningData::NodeInfo());
+
+  aiVector3D scaling, translation;
+  aiQuaternion rotation;
+  node->mTransformation.Decompose(scaling, rotation, translation);
+  LocalPose& default_pose = skinning_data_.default_pose;
+  default_pose.translations.push_back(engine::convertVector(translation));
+  default_pose.rotations.push_back(engine::convertQuaternion(rotation));
+  default_pose.scales.push_back(engine::convertVector(scaling));
+
+  auto iter = skinning_data_.bone_mapping.find(node->mName.data);
+  int bone_idx = -1;
+  if (iter != skinning_data_.bone_mapping.end()) {
+    bone_idx = iter->second;
+  }
+
+  unsigned subtree_size = 1, height = 0;
+  for (size_t i = 0; i < node->mNumChildren; i++) {
+    size_t child_idx = node_idx + subtree_size;
+    subtree_size += mapNodes(node->mChildren[i], node_idx);
+    height = std::max(height, skinning_data_.nodes[child_idx].height + 1);
+  }
+
+  // Don't take a reference before the recursion, push_back invalidates it.
+  skinning_data_.nodes[node_idx].parent = parent;
+  skinning_data_.nodes[node_idx].bone_idx = bone_idx;
+  skinning_data_.nodes[node_idx].subtree_size = subtree_size;
+  skinning_data_.nodes[node_idx].height = height;
+
+  return subtree_size;
+}
+
 /**
  * @brief A recursive functions that should be started from the root node, and
- *        it returns the first bone under it.
+ *        it returns the track of the first bone under it, or -1.
  *
  * @param node   The current root node.
- * @param anim   The animation to seek the root bone in.
+ * @param clip   The animation to seek the root bone in.
  */
-const aiNodeAnim* AnimatedMeshRenderer::getRootBone(const aiNode* node,
-                                                    const aiScene* anim) {
+int AnimatedMeshRenderer::getRootBone(const aiNode* node,
+                                      const BakedClip& clip) {
   std::string node_name(node->mName.data);
 
-  const aiAnimation* animation = anim->mAnimations[0];
-  const aiNodeAnim* node_anim = findNodeAnim(animation, node_name);
+  int track = clip.findTrack(node_name);
 
-  if (node_anim) {
+  if (track >= 0) {
     if (skinning_data_.root_bone.empty()) {
       skinning_data_.root_bone = node_name;
     } else {
@@ -53,17 +90,17 @@ const aiNodeAnim* AnimatedMeshRenderer::getRootBone(const aiNode* node,
                                  "different root bones.");
       }
     }
-    return node_anim;
+    return track;
   } else {
     for (size_t i = 0; i < node->mNumChildren; i++) {
-      auto childsReturn = getRootBone(node->mChildren[i], anim);
-      if (childsReturn) {
+      int childsReturn = getRootBone(node->mChildren[i], clip);
+      if (childsReturn >= 0) {
         return childsReturn;
       }
     }
   }
 
-  return nullptr;
+  return -1;
 }
 
 template <typename Index_t>
@@ -101,51 +138,36 @@ void AnimatedMeshRenderer::loadBones() {
     gl::Bind(entries_[entry].vao);
     gl::Bind(skinning_data_.vertex_bone_data_buffers[entry]);
 
-    // I can't just upload to the buffer with .data(), as bones aren't stored
-    // in a continuous buffer, and it is an array of not fixed sized arrays,
-    // but OpenGL needs it in fix sized parts.
+    // Only keep the strongest influences, the rest is usually barely
+    // noticeable, but would make every vertex bigger.
+    size_t max_influences = 0;
+    for (size_t i = 0; i < vertices.size(); i++) {
+      vertices[i].KeepStrongest(skinning_data_.max_bone_influences);
+      max_influences = std::max(max_influences, vertices[i].influences.size());
+    }
 
     // Get the current number of max bone attributes.
     unsigned char& current_attrib_max =
         skinning_data_.per_mesh_attrib_max[entry];
-    for (size_t i = 0; i < vertices.size(); i++) {
-      if (vertices[i].data.size() > current_attrib_max) {
-        current_attrib_max = vertices[i].data.size();
-      }
-    }
+    current_attrib_max = (max_influences + 3) / 4;
 
     if (current_attrib_max > skinning_data_.max_bone_attrib_num) {
       skinning_data_.max_bone_attrib_num = current_attrib_max;
     }
 
-    size_t per_vertex_size = current_attrib_max * per_attrib_size;
-    size_t buffer_size = vertices.size() * per_vertex_size;
+    size_t buffer_size = vertices.size() * current_attrib_max * per_attrib_size;
 
-    // Upload the bones data into a continuous
+    // Pack the bones data into a continuous
     // buffer then upload that to OpenGL.
-    std::unique_ptr<GLbyte> data{new GLbyte[buffer_size]};
-    GLintptr offset = 0;
+    std::vector<SkinningData::VertexBoneData_PerAttribute<Index_t>> data(
+        vertices.size() * current_attrib_max);
     for (size_t i = 0; i < vertices.size(); i++) {
-      size_t curr_size = vertices[i].data.size() * per_attrib_size;
-
-      // Copy the bone data
-      memcpy(data.get() + offset,  // destination
-             vertices[i].data.data(),  // source
-             curr_size);  // length
-
-      // Zero out all the remaining memory. Remember a
-      // bone with a 0.0f weight doesn't have any influence
-      if (per_vertex_size > curr_size) {
-        memset(data.get() + offset + curr_size,  // memory place
-               0,  // value
-               per_vertex_size - curr_size);  // length
-      }
-
-      offset += per_vertex_size;
+      vertices[i].Pack(&data[i * current_attrib_max], current_attrib_max);
     }
 
     // upload
-    skinning_data_.vertex_bone_data_buffers[entry].data(buffer_size, data.get());
+    skinning_data_.vertex_bone_data_buffers[entry].data(buffer_size,
+                                                        data.data());
   }
 
   // Unbind our things, so they won't be modified from outside
@@ -160,8 +182,6 @@ void AnimatedMeshRenderer::loadBones() {
  * with the appropriate template parameter
  */
 void AnimatedMeshRenderer::createBonesData() {
-  mapBones();
-
   if (skinning_data_.num_bones < std::numeric_limits<GLubyte>::max()) {
     loadBones<GLubyte>();
   } else if (skinning_data_.num_bones < std::numeric_limits<GLushort>::max()) {
@@ -217,8 +237,10 @@ void AnimatedMeshRenderer::shaderPlumbBones(
                                        (const void*)baseOffset).enable();
       }
 
-      bone_weights[boneAttribSet].setup(4, gl::DataType::kFloat, stride,
-                                        (const void*)weightOffset).enable();
+      // The weights are normalized unsigned bytes
+      bone_weights[boneAttribSet].pointer(4, gl::DataType::kUnsignedByte, true,
+                                          stride, (const void*)weightOffset)
+                                 .enable();
     }
 
     // static setup the VertexArrays that aren't enabled, to all zero.
@@ -394,4 +416,178 @@ if (!skinning_data_.is_setup_bones) {
   }
 }
 
+bool AnimatedMeshRenderer::isPreSkinningSupported() {
+#if defined(glBeginTransformFeedback) && defined(GLEW_VERSION_3_0)
+  // The skinning uses the core entry points (and GL_RASTERIZER_DISCARD),
+  // GLEW doesn't load those for a context that only has the extension.
+  return GLEW_VERSION_3_0;
+#else
+  return false;
+#endif
+}
+
+void AnimatedMeshRenderer::setupSkinningProgram(ShaderProgram* program) {
+  program->transformFeedbackVaryings({"vSkinnedPosition", "vSkinnedNormal"},
+                                     GL_INTERLEAVED_ATTRIBS);
+}
+
+void AnimatedMeshRenderer::setupSkinnedVertices(SkinnedVertices& vertices,
+                                                gl::VertexAttrib positions,
+                                                gl::VertexAttrib normals,
+                                                gl::VertexAttrib tex_coords) {
+  // The skinned position and normal of a vertex are next to each other
+  const size_t stride = 2 * sizeof(glm::vec3);
+
+  vertices.entries_ = std::vector<SkinnedVertices::Entry>(entries_.size());
+  for (size_t i = 0; i < entries_.size(); i++) {
+    SkinnedVertices::Entry& entry = vertices.entries_[i];
+    entry.vertex_count = scene_->mMeshes[i]->mNumVertices;
+
+    gl::Bind(entry.vao);
+
+    gl::Bind(entry.buffer);
+    entry.buffer.data(entry.vertex_count * stride, nullptr, gl::kDynamicCopy);
+    positions.pointer(3, gl::kFloat, false, stride, nullptr).enable();
+    normals.pointer(3, gl::kFloat, false, stride,
+                    (const void*)sizeof(glm::vec3)).enable();
+
+    // The tex coords and the indices are shared with the unskinned mesh
+    gl::Bind(entries_[i].tex_coords);
+    tex_coords.setup<float>(2).enable();
+    gl::Bind(entries_[i].indices);
+  }
+
+  gl::Unbind(gl::kArrayBuffer);
+  gl::Unbind(gl::kVertexArray);
+}
+
+void AnimatedMeshRenderer::skinVertices(SkinnedVertices& vertices) {
+#ifdef glBeginTransformFeedback
+  // Only the captured varyings matter, nothing should be rasterized
+  GlState::TemporarySet discard{{GL_RASTERIZER_DISCARD, true}};
+
+  for (size_t i = 0; i < entries_.size(); i++) {
+    SkinnedVertices::Entry& entry = vertices.entries_[i];
+    GlState::BindVertexArray(entries_[i].vao);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, entry.buffer.expose());
+
+    glBeginTransformFeedback(GL_POINTS);
+    gl::DrawArrays(gl::kPoints, 0, entry.vertex_count);
+    glEndTransformFeedback();
+  }
+
+  glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+  GlState::UnbindVertexArray();
+#endif
+}
+
+void AnimatedMeshRenderer::render(const SkinnedVertices& vertices) {
+  if (vertices.entries_.size() != entries_.size()) {
+    return;  // the skinned vertices aren't set up
+  }
+
+  renderEntries([&vertices](size_t idx) -> const gl::VertexArray& {
+    return vertices.entries_[idx].vao;
+  });
+}
+
+#if defined(glVertexAttribDivisor) && defined(GLEW_VERSION_3_3)
+/// Copies the vertex attribute arrays and the index buffer binding of a VAO
+/// to another one. Changes the currently active VAO and ArrayBuffer.
+static void CopyVertexArray(gl::VertexArray& source, gl::VertexArray& dest) {
+  struct Attrib {
+    GLint enabled, size, type, normalized, stride, buffer, integer;
+    GLvoid* pointer;
+  };
+
+  GLint max_attribs = 0;
+  glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &max_attribs);
+  std::vector<Attrib> attribs(max_attribs);
+
+  gl::Bind(source);
+  GLint indices = 0;
+  glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &indices);
+  for (GLuint i = 0; i < attribs.size(); i++) {
+    Attrib& attrib = attribs[i];
+    glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_ENABLED, &attrib.enabled);
+    glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_SIZE, &attrib.size);
+    glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_TYPE, &attrib.type);
+    glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_NORMALIZED,
+                        &attrib.normalized);
+    glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_STRIDE, &attrib.stride);
+    glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_BUFFER_BINDING,
+                        &attrib.buffer);
+    glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_INTEGER, &attrib.integer);
+    glGetVertexAttribPointerv(i, GL_VERTEX_ATTRIB_ARRAY_POINTER,
+                              &attrib.pointer);
+  }
+
+  gl::Bind(dest);
+  for (GLuint i = 0; i < attribs.size(); i++) {
+    const Attrib& attrib = attribs[i];
+    if (!attrib.enabled) {
+      continue;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, attrib.buffer);
+    if (attrib.integer) {
+      glVertexAttribIPointer(i, attrib.size, attrib.type, attrib.stride,
+                             attrib.pointer);
+    } else {
+      glVertexAttribPointer(i, attrib.size, attrib.type, attrib.normalized,
+                            attrib.stride, attrib.pointer);
+    }
+    glEnableVertexAttribArray(i);
+  }
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices);
+}
+#endif
+
+void AnimatedMeshRenderer::setupInstances(gl::LazyVertexAttrib transform,
+                                          gl::VertexAttrib animation) {
+#if defined(glVertexAttribDivisor) && defined(GLEW_VERSION_3_3)
+  if (!GLEW_VERSION_3_3 && !GLEW_ARB_instanced_arrays) {
+    return;
+  }
+
+  // The per instance attributes might use the same locations as the regular
+  // ones, so they get their own copy of the vertex arrays.
+  instance_vaos_ = std::vector<gl::VertexArray>(entries_.size());
+
+  const size_t stride = sizeof(VertexAnimationInstance);
+  for (size_t i = 0; i < entries_.size(); i++) {
+    CopyVertexArray(entries_[i].vao, instance_vaos_[i]);
+    gl::Bind(instance_buffer_);
+
+    for (int row = 0; row < 3; row++) {
+      intptr_t offset = offsetof(VertexAnimationInstance, transform) +
+                        row * sizeof(glm::vec4);
+      transform[row].pointer(4, gl::kFloat, false, stride,
+                             (const void*)offset).enable();
+      transform[row].divisor(1);
+    }
+    animation.pointer(4, gl::kFloat, false, stride,
+        (const void*)offsetof(VertexAnimationInstance, animation)).enable();
+    animation.divisor(1);
+  }
+
+  gl::Unbind(gl::kArrayBuffer);
+  gl::Unbind(gl::kVertexArray);
+#endif
+}
+
+void AnimatedMeshRenderer::renderInstances(
+    const std::vector<VertexAnimationInstance>& instances) {
+  if (instance_vaos_.empty() || instances.empty()) {
+    return;
+  }
+
+  gl::Bind(instance_buffer_);
+  instance_buffer_.data(instances);
+  gl::Unbind(gl::kArrayBuffer);
+
+  renderEntries([this](size_t idx) -> const gl::VertexArray& {
+    return instance_vaos_[idx];
+  }, instances.size());
+}
+
 }  // namespace engine
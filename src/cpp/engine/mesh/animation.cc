@@ -46,6 +46,8 @@ void Animation::changeAnimation(size_t anim_idx,
   }
 
   last_anim_.offset = current_anim_.offset;
+  // The offset restarts, the motion of the previous animation is dropped
+  lod_root_motion_ = lod_pending_motion_ = glm::vec3();
 
   if (speed > 0.0f) {
     current_anim_.speed = speed;
@@ -146,8 +148,8 @@ void Animation::animationEnded(float current_time) {
 }
 
 glm::vec2 Animation::offsetSinceLastFrame() {
-  auto ret = current_anim_.offset - last_anim_.offset;
-  last_anim_.offset = current_anim_.offset;
+  auto ret = current_anim_.offset - lod_pending_motion_ - last_anim_.offset;
+  last_anim_.offset = current_anim_.offset - lod_pending_motion_;
   return glm::vec2(ret.x, ret.z);
 }
 
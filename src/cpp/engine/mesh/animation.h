@@ -24,12 +24,61 @@ class Animation {
   /// The last animation.
   AnimationState last_anim_;
 
+  /// The current pose, and the pose of the previous animation during a
+  /// transition. They are only stored here to avoid reallocations.
+  LocalPose pose_, prev_pose_;
+
+  /// The transformations of the skeleton's nodes in model space.
+  std::vector<glm::mat4x3> global_transforms_;
+
+  /// The final transformations of the bones, that should be uploaded.
+  /** Its format depends on the mesh's SkinningMode. */
+  std::vector<glm::vec4> bone_palette_;
+
+  /// The level of detail of this instance.
+  AnimLod lod_;
+
+  /// The number of updates since the last evaluated pose.
+  unsigned lod_skipped_updates_;
+
+  /// The bones' transformations of the last two evaluated poses, and the
+  /// times of their evaluation. The updates in between interpolate them.
+  std::vector<glm::vec4> lod_prev_palette_, lod_next_palette_;
+  float lod_prev_time_, lod_next_time_;
+
+  /// The root motion between the last two evaluated poses.
+  glm::vec3 lod_root_motion_;
+
+  /// The part of lod_root_motion_, that the interpolated pose hasn't reached
+  /// yet. offsetSinceLastFrame() holds it back, so the character moves
+  /// together with its interpolated pose, instead of in jumps.
+  glm::vec3 lod_pending_motion_;
+
   friend class AnimatedMeshRenderer;
 
 public:
 
   Animation(const AnimData& anim_data)
-    : anims_(anim_data) {}
+    : anims_(anim_data)
+    , lod_skipped_updates_(0)
+    , lod_prev_time_(0.0f)
+    , lod_next_time_(0.0f) {}
+
+  /// Sets the level of detail of this instance.
+  void setLod(const AnimLod& lod) {
+    if (lod.update_interval != lod_.update_interval) {
+      // Don't interpolate with a pose from a different update rate
+      lod_skipped_updates_ = 0;
+      lod_prev_palette_.clear();
+      lod_pending_motion_ = glm::vec3();
+    }
+    lod_ = lod;
+  }
+
+  /// Returns the level of detail of this instance.
+  const AnimLod& getLod() const {
+    return lod_;
+  }
 
   /// Returns the currently running animation's name.
   std::string getCurrentAnimation() const {
@@ -41,6 +90,13 @@ public:
     return current_anim_;
   }
 
+  /// Returns the final transformations of the bones, after the last update.
+  /** Every bone is stored as the first three rows of its transformation, or
+    * as a unit dual quaternion, depending on the mesh's SkinningMode. */
+  const std::vector<glm::vec4>& getBonePalette() const {
+    return bone_palette_;
+  }
+
   /// Returns the currently running animation's AnimFlags.
   gl::Bitfield<AnimFlag> getCurrentAnimFlags() const {
     return current_anim_.flags;
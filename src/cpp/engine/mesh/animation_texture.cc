@@ -0,0 +1,73 @@
+// Copyright (c) 2014, Tamas Csala
+
+#include "./animation_texture.h"
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include "./animated_mesh_renderer.h"
+
+namespace engine {
+
+AnimationTexture::AnimationTexture(const AnimatedMeshRenderer& mesh,
+                                   float frames_per_second)
+    : size_(0, 0) {
+  std::vector<glm::vec4> texels;
+
+  for (const auto& pair : mesh.getAnimData().names) {
+    const std::string& anim_name = pair.first;
+    float duration = mesh.getAnimationDuration(anim_name);
+
+    Clip clip;
+    clip.first_row = size_.y;
+    clip.frame_count = std::max(1, static_cast<int>(
+        std::round(duration * frames_per_second)));
+    clip.frames_per_second = duration > 0 ? clip.frame_count / duration : 0;
+
+    std::vector<glm::vec4> palettes =
+        mesh.bakeBonePalettes(anim_name, clip.frame_count);
+    size_.x = palettes.size() / clip.frame_count;
+    texels.insert(texels.end(), palettes.begin(), palettes.end());
+
+    // The first frame is repeated after the last one, so the filtering can
+    // interpolate between them when the animation wraps around.
+    texels.insert(texels.end(), palettes.begin(), palettes.begin() + size_.x);
+    size_.y += clip.frame_count + 1;
+
+    clips_[anim_name] = clip;
+  }
+
+  gl::Bind(texture_);
+  texture_.upload(gl::kRgba32F, size_.x, size_.y, gl::kRgba, gl::kFloat,
+                  texels.empty() ? nullptr : texels.data());
+  // The shader samples the middle of the texels horizontally, so only
+  // the consecutive frames get interpolated.
+  texture_.minFilter(gl::kLinear);
+  texture_.magFilter(gl::kLinear);
+  texture_.wrapS(gl::kClampToEdge);
+  texture_.wrapT(gl::kClampToEdge);
+  gl::Unbind(texture_);
+}
+
+VertexAnimationInstance AnimationTexture::makeInstance(
+    const glm::mat4& transform, const std::string& anim_name,
+    float time_offset, float speed) const {
+  auto iter = clips_.find(anim_name);
+  if (iter == clips_.end()) {
+    throw std::runtime_error("AnimationTexture doesn't have any animation "
+                             "named '" + anim_name + "'.");
+  }
+  const Clip& clip = iter->second;
+
+  VertexAnimationInstance instance;
+  instance.transform = glm::transpose(glm::mat4x3(transform));
+  float frames_per_second = clip.frames_per_second * speed;
+  instance.animation = glm::vec4(clip.first_row, clip.frame_count,
+                                 time_offset * frames_per_second,
+                                 frames_per_second);
+  return instance;
+}
+
+}  // namespace engine
@@ -0,0 +1,85 @@
+// Copyright (c) 2014, Tamas Csala
+
+#ifndef ENGINE_MESH_ANIMATION_TEXTURE_H_
+#define ENGINE_MESH_ANIMATION_TEXTURE_H_
+
+#include <map>
+#include <string>
+
+#include "../oglwrap_config.h"
+#include "../../oglwrap/textures/texture_2D.h"
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+namespace engine {
+
+class AnimatedMeshRenderer;
+
+/// The per instance data of a character, that is animated by an
+/// AnimationTexture.
+struct VertexAnimationInstance {
+  /// The first three rows of the model matrix.
+  glm::mat3x4 transform;
+
+  /// x: the first row of the animation in the texture, y: its number of
+  /// frames, z: the frame at time 0, w: the frames per second.
+  glm::vec4 animation;
+};
+
+/// The bone palettes of all the animations of a mesh, baked into a texture.
+/** Every row of the texture is a frame, and every bone takes three texels
+  * (the first three rows of its transformation). The shader can play the
+  * animations back without any CPU work, and the linear filtering
+  * interpolates between the frames. It needs float textures and vertex
+  * texture fetch. The animations don't have transitions or root motion, so
+  * it is meant for distant characters. */
+class AnimationTexture {
+ public:
+  /**
+   * @brief Bakes every animation of a mesh.
+   *
+   * Changes the currently active Texture2D binding.
+   *
+   * @param mesh                The mesh, with all its animations added.
+   * @param frames_per_second   The sampling rate of the animations.
+   */
+  explicit AnimationTexture(const AnimatedMeshRenderer& mesh,
+                            float frames_per_second = 30.0f);
+
+  /**
+   * @brief Returns the per instance data for an instance playing an animation.
+   *
+   * @param transform     The model matrix of the instance.
+   * @param anim_name     The name of the animation to play.
+   * @param time_offset   The number of seconds the animation is ahead of
+   *                      the others. Randomize it, so the crowd doesn't move
+   *                      in sync.
+   * @param speed         The speed of the animation, relative to the one
+   *                      specified at the addAnimation.
+   */
+  VertexAnimationInstance makeInstance(const glm::mat4& transform,
+                                       const std::string& anim_name,
+                                       float time_offset = 0.0f,
+                                       float speed = 1.0f) const;
+
+  /// Returns the baked texture.
+  const gl::Texture2D& texture() const { return texture_; }
+
+  /// Returns the size of the texture in texels.
+  glm::vec2 size() const { return glm::vec2(size_); }
+
+ private:
+  struct Clip {
+    unsigned first_row, frame_count;
+    float frames_per_second;
+  };
+
+  std::map<std::string, Clip> clips_;
+  gl::Texture2D texture_;
+  glm::ivec2 size_;
+};
+
+}  // namespace engine
+
+#endif
@@ -0,0 +1,285 @@
+// Copyright (c) 2014, Tamas Csala
+
+#include "./baked_clip.h"
+
+#include <cmath>
+#include <fstream>
+#include <algorithm>
+
+namespace engine {
+
+// The components of a normalized quaternion, except for the largest one, are
+// always in the [-sqrt(0.5), sqrt(0.5)] range.
+static const float kMaxSmallComponent = std::sqrt(0.5f);
+
+static void EncodeRotation(glm::quat q, uint16_t* out) {
+  q = glm::normalize(q);
+  float c[4] = {q.x, q.y, q.z, q.w};
+  int largest = 0;
+  for (int i = 1; i < 4; ++i) {
+    if (std::abs(c[i]) > std::abs(c[largest])) { largest = i; }
+  }
+  // q and -q are the same rotation, so the largest one can be positive
+  float sign = c[largest] < 0 ? -1.0f : 1.0f;
+
+  uint16_t small[3];
+  for (int i = 0, j = 0; i < 4; ++i) {
+    if (i == largest) { continue; }
+    float x = glm::clamp(sign * c[i] / kMaxSmallComponent, -1.0f, 1.0f);
+    small[j++] = static_cast<uint16_t>(std::round((x*0.5f + 0.5f) * 32767));
+  }
+
+  // 3 * 15 bits for the small components, 2 bits for the index of the largest
+  out[0] = small[0] | ((largest & 1) << 15);
+  out[1] = small[1] | ((largest >> 1) << 15);
+  out[2] = small[2];
+}
+
+static glm::quat DecodeRotation(const uint16_t* in) {
+  int largest = (in[0] >> 15) | ((in[1] >> 15) << 1);
+  float c[4];
+  float sqr_sum = 0;
+  for (int i = 0, j = 0; i < 4; ++i) {
+    if (i == largest) { continue; }
+    float x = (in[j++] & 0x7FFF) / 32767.0f;
+    c[i] = (x*2.0f - 1.0f) * kMaxSmallComponent;
+    sqr_sum += c[i] * c[i];
+  }
+  c[largest] = std::sqrt(std::max(1.0f - sqr_sum, 0.0f));
+
+  return glm::quat(c[3], c[0], c[1], c[2]);
+}
+
+static glm::vec3 DecodeVector(const uint16_t* in, const glm::vec3& min,
+                              const glm::vec3& extent) {
+  return min + extent * (glm::vec3(in[0], in[1], in[2]) / 65535.0f);
+}
+
+BakedClip::BakedClip(float duration, float ticks_per_second,
+                     unsigned sample_count)
+    : duration_(duration)
+    , ticks_per_second_(ticks_per_second)
+    , sample_count_(std::max(sample_count, 1u)) {}
+
+void BakedClip::addTrack(const std::string& name,
+                         const glm::vec3* translations,
+                         const glm::quat* rotations,
+                         const glm::vec3* scales) {
+  Track track;
+  track.translation_offset = addVectors(translations, &track.translation_min,
+                                        &track.translation_extent,
+                                        &track.translation_count);
+  track.rotation_offset = addRotations(rotations, &track.rotation_count);
+  track.scale_offset = addVectors(scales, &track.scale_min,
+                                  &track.scale_extent, &track.scale_count);
+  tracks_.push_back(track);
+  track_names_.push_back(name);
+}
+
+uint32_t BakedClip::addVectors(const glm::vec3* values, glm::vec3* min,
+                               glm::vec3* extent, uint32_t* count) {
+  glm::vec3 max = values[0];
+  *min = values[0];
+  for (unsigned i = 1; i < sample_count_; ++i) {
+    *min = glm::min(*min, values[i]);
+    max = glm::max(max, values[i]);
+  }
+  *extent = max - *min;
+
+  uint32_t offset = data_.size();
+  if (glm::all(glm::lessThan(*extent, glm::vec3(1e-5f)))) {
+    // A constant track, the min is the value itself
+    *extent = glm::vec3(0.0f);
+    *count = 1;
+    data_.insert(data_.end(), 3, 0);
+    return offset;
+  }
+
+  *count = sample_count_;
+  for (unsigned i = 0; i < sample_count_; ++i) {
+    for (int c = 0; c < 3; ++c) {
+      float x = 0.0f;
+      if ((*extent)[c] > 0) {
+        x = (values[i][c] - (*min)[c]) / (*extent)[c];
+      }
+      data_.push_back(static_cast<uint16_t>(std::round(x * 65535)));
+    }
+  }
+  return offset;
+}
+
+uint32_t BakedClip::addRotations(const glm::quat* values, uint32_t* count) {
+  bool constant = true;
+  for (unsigned i = 1; i < sample_count_ && constant; ++i) {
+    constant = std::abs(glm::dot(values[0], values[i])) > 1.0f - 1e-6f;
+  }
+  *count = constant ? 1 : sample_count_;
+
+  uint32_t offset = data_.size();
+  data_.resize(offset + 3 * (*count));
+  for (unsigned i = 0; i < *count; ++i) {
+    EncodeRotation(values[i], &data_[offset + 3*i]);
+  }
+  return offset;
+}
+
+int BakedClip::findTrack(const std::string& name) const {
+  for (size_t i = 0; i < track_names_.size(); ++i) {
+    if (track_names_[i] == name) { return i; }
+  }
+  return -1;
+}
+
+void BakedClip::sample(size_t track_idx, float time, glm::vec3* translation,
+                       glm::quat* rotation, glm::vec3* scale) const {
+  const Track& track = tracks_[track_idx];
+
+  unsigned i0 = 0, i1 = 0;
+  float factor = 0.0f;
+  if (sample_count_ > 1 && duration_ > 0) {
+    float s = glm::clamp(time / duration_, 0.0f, 1.0f) * (sample_count_ - 1);
+    i0 = std::min(static_cast<unsigned>(s), sample_count_ - 2);
+    i1 = i0 + 1;
+    factor = s - i0;
+  }
+
+  const uint16_t* t = &data_[track.translation_offset];
+  if (track.translation_count == 1) {
+    *translation = DecodeVector(t, track.translation_min,
+                                track.translation_extent);
+  } else {
+    *translation = glm::mix(
+        DecodeVector(t + 3*i0, track.translation_min, track.translation_extent),
+        DecodeVector(t + 3*i1, track.translation_min, track.translation_extent),
+        factor);
+  }
+
+  const uint16_t* r = &data_[track.rotation_offset];
+  if (track.rotation_count == 1) {
+    *rotation = DecodeRotation(r);
+  } else {
+    glm::quat q0 = DecodeRotation(r + 3*i0), q1 = DecodeRotation(r + 3*i1);
+    // The samples are close to each other, so normalized lerp is enough
+    if (glm::dot(q0, q1) < 0) { q1 = -q1; }
+    *rotation = glm::normalize(q0 * (1 - factor) + q1 * factor);
+  }
+
+  const uint16_t* s = &data_[track.scale_offset];
+  if (track.scale_count == 1) {
+    *scale = DecodeVector(s, track.scale_min, track.scale_extent);
+  } else {
+    *scale = glm::mix(
+        DecodeVector(s + 3*i0, track.scale_min, track.scale_extent),
+        DecodeVector(s + 3*i1, track.scale_min, track.scale_extent),
+        factor);
+  }
+}
+
+namespace {
+
+const char kMagic[4] = {'C', 'L', 'I', 'P'};
+const uint32_t kVersion = 1;
+
+struct FileHeader {
+  char magic[4];
+  uint32_t version;
+  float duration, ticks_per_second;
+  uint32_t sample_count, track_count, data_size;
+};
+
+}  // namespace
+
+bool BakedClip::save(const std::string& filename) const {
+  std::ofstream file(filename, std::ios::binary);
+  if (!file) { return false; }
+
+  FileHeader header;
+  std::copy(kMagic, kMagic + 4, header.magic);
+  header.version = kVersion;
+  header.duration = duration_;
+  header.ticks_per_second = ticks_per_second_;
+  header.sample_count = sample_count_;
+  header.track_count = tracks_.size();
+  header.data_size = data_.size();
+
+  // The header, the tracks and the samples are written as they are in the
+  // memory, so they can be read back in a few big blocks.
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(tracks_.data()),
+             tracks_.size() * sizeof(Track));
+  file.write(reinterpret_cast<const char*>(data_.data()),
+             data_.size() * sizeof(uint16_t));
+  for (const std::string& name : track_names_) {
+    uint32_t length = name.size();
+    file.write(reinterpret_cast<const char*>(&length), sizeof(length));
+    file.write(name.data(), length);
+  }
+
+  return file.good();
+}
+
+std::unique_ptr<BakedClip> BakedClip::load(const std::string& filename) {
+  std::ifstream file(filename, std::ios::binary);
+  if (!file) { return nullptr; }
+
+  file.seekg(0, std::ios::end);
+  uint64_t file_size = file.tellg();
+  file.seekg(0, std::ios::beg);
+
+  FileHeader header;
+  file.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (!file || !std::equal(kMagic, kMagic + 4, header.magic) ||
+      header.version != kVersion || header.sample_count == 0) {
+    return nullptr;
+  }
+
+  // A truncated or corrupted file shouldn't make us allocate, or read more
+  // than what is actually there.
+  uint64_t blocks_size = sizeof(header) +
+      uint64_t(header.track_count) * (sizeof(Track) + sizeof(uint32_t)) +
+      uint64_t(header.data_size) * sizeof(uint16_t);
+  if (blocks_size > file_size) {
+    return nullptr;
+  }
+
+  std::unique_ptr<BakedClip> clip{new BakedClip{}};
+  clip->duration_ = header.duration;
+  clip->ticks_per_second_ = header.ticks_per_second;
+  clip->sample_count_ = header.sample_count;
+  clip->tracks_.resize(header.track_count);
+  clip->data_.resize(header.data_size);
+  clip->track_names_.resize(header.track_count);
+
+  file.read(reinterpret_cast<char*>(clip->tracks_.data()),
+            header.track_count * sizeof(Track));
+  file.read(reinterpret_cast<char*>(clip->data_.data()),
+            header.data_size * sizeof(uint16_t));
+  uint64_t names_size = file_size - blocks_size;
+  for (std::string& name : clip->track_names_) {
+    uint32_t length = 0;
+    file.read(reinterpret_cast<char*>(&length), sizeof(length));
+    if (!file || length > names_size) { return nullptr; }
+    names_size -= length;
+    name.resize(length);
+    file.read(&name[0], length);
+  }
+  if (!file || names_size != 0) { return nullptr; }
+
+  // Every sample that sample() can read has to be inside the data
+  for (const Track& track : clip->tracks_) {
+    const uint32_t offsets[3] = {track.translation_offset,
+                                 track.rotation_offset, track.scale_offset};
+    const uint32_t counts[3] = {track.translation_count,
+                                track.rotation_count, track.scale_count};
+    for (int i = 0; i < 3; ++i) {
+      if ((counts[i] != 1 && counts[i] != header.sample_count) ||
+          uint64_t(offsets[i]) + 3 * uint64_t(counts[i]) > header.data_size) {
+        return nullptr;
+      }
+    }
+  }
+
+  return clip;
+}
+
+}  // namespace engine
@@ -0,0 +1,106 @@
+// Copyright (c) 2014, Tamas Csala
+
+#ifndef ENGINE_MESH_BAKED_CLIP_H_
+#define ENGINE_MESH_BAKED_CLIP_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+namespace engine {
+
+/// An animation clip, that is resampled with a uniform rate, and compressed.
+/** Every track (the animation of one node) stores its translations and scales
+  * as 16 bit values, quantized in the track's range, and its rotations as
+  * 48 bit "smallest three" quaternions. A track that doesn't change over
+  * time only stores a single sample. All the samples are stored in one array,
+  * so the clip can be written to, and read from the disk in a few big
+  * blocks. */
+class BakedClip {
+ public:
+  /**
+   * @brief Creates an empty clip.
+   *
+   * @param duration           The length of the clip in ticks.
+   * @param ticks_per_second   The number of ticks in a second.
+   * @param sample_count       The number of samples per track, including the
+   *                           ones at the start and at the end of the clip.
+   */
+  BakedClip(float duration, float ticks_per_second, unsigned sample_count);
+
+  /**
+   * @brief Compresses and adds a track to the clip.
+   *
+   * @param name           The name of the animated node.
+   * @param translations   sample_count() translations.
+   * @param rotations      sample_count() rotations.
+   * @param scales         sample_count() scales.
+   */
+  void addTrack(const std::string& name,
+                const glm::vec3* translations,
+                const glm::quat* rotations,
+                const glm::vec3* scales);
+
+  /// Returns the index of the track that animates a node, or -1.
+  int findTrack(const std::string& name) const;
+
+  /**
+   * @brief Samples a track, interpolating between the two nearest samples.
+   *
+   * @param track         The index of the track.
+   * @param time          The animation time in ticks.
+   * @param translation   Returns the translation here.
+   * @param rotation      Returns the rotation here.
+   * @param scale         Returns the scale here.
+   */
+  void sample(size_t track, float time, glm::vec3* translation,
+              glm::quat* rotation, glm::vec3* scale) const;
+
+  float duration() const { return duration_; }
+  float ticks_per_second() const { return ticks_per_second_; }
+  unsigned sample_count() const { return sample_count_; }
+  size_t track_count() const { return tracks_.size(); }
+
+  /// Writes the clip to a file. Returns false on failure.
+  bool save(const std::string& filename) const;
+
+  /// Loads a clip, written by save(). Returns nullptr if the file doesn't
+  /// exist, if it was written by an incompatible version, or if it is
+  /// truncated or corrupted.
+  static std::unique_ptr<BakedClip> load(const std::string& filename);
+
+ private:
+  /// The layout of a track in the sample data. It is written to the disk
+  /// as it is.
+  struct Track {
+    glm::vec3 translation_min, translation_extent;
+    glm::vec3 scale_min, scale_extent;
+
+    /// The offsets of the first samples, in uint16_t units.
+    uint32_t translation_offset, rotation_offset, scale_offset;
+
+    /// Either 1 for constant tracks, or sample_count_.
+    uint32_t translation_count, rotation_count, scale_count;
+  };
+
+  float duration_, ticks_per_second_;
+  unsigned sample_count_;
+  std::vector<Track> tracks_;
+  std::vector<std::string> track_names_;
+  std::vector<uint16_t> data_;
+
+  BakedClip() = default;
+
+  uint32_t addVectors(const glm::vec3* values, glm::vec3* min,
+                      glm::vec3* extent, uint32_t* count);
+  uint32_t addRotations(const glm::quat* values, uint32_t* count);
+};
+
+}  // namespace engine
+
+#endif
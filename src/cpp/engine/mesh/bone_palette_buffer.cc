@@ -0,0 +1,60 @@
+// Copyright (c) 2014, Tamas Csala
+
+#include "./bone_palette_buffer.h"
+
+namespace engine {
+
+bool BonePaletteBuffer::IsSupported() {
+#if defined(glUniformBlockBinding) && defined(GLEW_ARB_uniform_buffer_object)
+  return GLEW_ARB_uniform_buffer_object;
+#else
+  return false;
+#endif
+}
+
+size_t BonePaletteBuffer::MaxVectors() {
+#ifdef GL_MAX_UNIFORM_BLOCK_SIZE
+  if (IsSupported()) {
+    GLint max_size = 0;
+    glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &max_size);
+    return max_size / sizeof(glm::vec4);
+  }
+#endif
+  return 0;
+}
+
+void BonePaletteBuffer::bindBlock(const gl::Program& program,
+                                  const std::string& block_name) const {
+#ifdef glUniformBlockBinding
+  GLuint index = glGetUniformBlockIndex(program.expose(), block_name.c_str());
+  if (index != GL_INVALID_INDEX) {
+    glUniformBlockBinding(program.expose(), index, binding_);
+  }
+#endif
+}
+
+void BonePaletteBuffer::set(const std::vector<glm::vec4>& palette) {
+#ifdef glUniformBlockBinding
+  if (palette.empty()) {
+    return;
+  }
+
+  // The vec4 array has the same layout in std140 as on the CPU. Specifying
+  // the whole store orphans the previous frame's palette, that the GPU might
+  // still be reading, instead of waiting for it.
+  glBindBuffer(GL_UNIFORM_BUFFER, buffer_.expose());
+  glBufferData(GL_UNIFORM_BUFFER, palette.size() * sizeof(glm::vec4),
+               palette.data(), GL_STREAM_DRAW);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+  bind();
+#endif
+}
+
+void BonePaletteBuffer::bind() const {
+#ifdef glUniformBlockBinding
+  glBindBufferBase(GL_UNIFORM_BUFFER, binding_, buffer_.expose());
+#endif
+}
+
+}  // namespace engine
@@ -0,0 +1,66 @@
+// Copyright (c) 2014, Tamas Csala
+
+#ifndef ENGINE_MESH_BONE_PALETTE_BUFFER_H_
+#define ENGINE_MESH_BONE_PALETTE_BUFFER_H_
+
+#include <string>
+#include <vector>
+
+#include "../oglwrap_config.h"
+#include "../../oglwrap/buffer.h"
+#include "../../oglwrap/program.h"
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+namespace engine {
+
+/// A bone palette in a uniform buffer, declared as
+/// "layout(std140) uniform BonePalette { vec4 uBones[N * BONE_NUM]; }".
+/** The palette of an instance is written into its own buffer once per frame,
+  * and every pass that draws the instance (like the main and the shadow pass)
+  * only binds it, instead of uploading it into each program. A uniform block
+  * can be a lot larger than the default uniforms, so it fits much bigger
+  * skeletons too. Needs ARB_uniform_buffer_object, see BonePaletteUniform for
+  * the fallback. */
+class BonePaletteBuffer {
+ public:
+  /// Returns if the shaders can read the palette from a uniform buffer.
+  /** The skinning shader is #version 120, so the extension has to be exposed
+    * even on the contexts, where the uniform buffers are core. */
+  static bool IsSupported();
+
+  /// Returns the number of vec4s that fit in a uniform block.
+  static size_t MaxVectors();
+
+  /**
+   * @brief Creates the buffer of an instance.
+   *
+   * @param binding   The uniform buffer binding point, that the palette is
+   *                  bound to. The instances drawn with the same programs
+   *                  should use the same binding point.
+   */
+  explicit BonePaletteBuffer(GLuint binding = 0) : binding_(binding) {}
+
+  /// Connects the program's uniform block to this palette's binding point.
+  /** It doesn't need the program to be in use, but it has to be linked. */
+  void bindBlock(const gl::Program& program,
+                 const std::string& block_name = "BonePalette") const;
+
+  /// Uploads the palette with a single call, and binds it.
+  void set(const std::vector<glm::vec4>& palette);
+
+  /// Binds the palette to its binding point, it should be called before
+  /// drawing the instance if more instances share the binding point.
+  void bind() const;
+
+ private:
+  /// The buffer object names aren't tied to a target, the ArrayBuffer is
+  /// only used to own the buffer.
+  gl::ArrayBuffer buffer_;
+  GLuint binding_;
+};
+
+}  // namespace engine
+
+#endif
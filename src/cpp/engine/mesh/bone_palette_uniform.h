@@ -0,0 +1,51 @@
+// Copyright (c) 2014, Tamas Csala
+
+#ifndef ENGINE_MESH_BONE_PALETTE_UNIFORM_H_
+#define ENGINE_MESH_BONE_PALETTE_UNIFORM_H_
+
+#include <string>
+#include <vector>
+
+#include "../oglwrap_config.h"
+#include "../../oglwrap/oglwrap.h"
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+namespace engine {
+
+/// A bone palette in a shader, declared as "uniform vec4 name[N * BONE_NUM]".
+/** Every bone is an affine transformation, stored as its first three rows
+  * (N = 3), or as a unit dual quaternion (N = 2), and the whole palette is
+  * uploaded with a single call. Like gl::LazyUniform, the location is only
+  * queried at the first upload. It has to be uploaded into every program that
+  * draws the instance, so it's only the fallback for the contexts that can't
+  * use a BonePaletteBuffer. */
+class BonePaletteUniform {
+ public:
+  BonePaletteUniform(const gl::Program& program, const std::string& name)
+      : program_(program), name_(name), location_(-1), queried_(false) {}
+
+  /// Uploads the palette. The program has to be in use.
+  void set(const std::vector<glm::vec4>& palette) {
+    if (!queried_) {
+      location_ = glGetUniformLocation(program_.expose(), name_.c_str());
+      queried_ = true;
+    }
+    if (location_ != -1 && !palette.empty()) {
+      glUniform4fv(location_, palette.size(),
+                   glm::value_ptr(palette.front()));
+    }
+  }
+
+ private:
+  const gl::Program& program_;
+  std::string name_;
+  GLint location_;
+  bool queried_;
+};
+
+}  // namespace engine
+
+#endif
@@ -0,0 +1,103 @@
+// Copyright (c) 2014, Tamas Csala
+
+#include "./crowd_animator.h"
+
+#include <algorithm>
+
+namespace engine {
+
+CrowdAnimator::CrowdAnimator(unsigned thread_count)
+    : generation_(0)
+    , busy_workers_(0)
+    , should_quit_(false)
+    , time_(0.0f)
+    , next_instance_(0) {
+  // The thread calling update() works too
+  for (unsigned i = 1; i < thread_count; ++i) {
+    workers_.emplace_back([this](){ workerLoop(); });
+  }
+}
+
+CrowdAnimator::~CrowdAnimator() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    should_quit_ = true;
+  }
+  work_ready_.notify_all();
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+}
+
+void CrowdAnimator::addInstance(const AnimatedMeshRenderer* mesh,
+                                Animation* animation) {
+  instances_.push_back(Instance{mesh, animation});
+}
+
+void CrowdAnimator::removeInstance(const Animation* animation) {
+  instances_.erase(std::remove_if(instances_.begin(), instances_.end(),
+      [animation](const Instance& instance) {
+        return instance.animation == animation;
+      }), instances_.end());
+}
+
+void CrowdAnimator::evaluateInstances() {
+  size_t idx;
+  while ((idx = next_instance_++) < instances_.size()) {
+    const Instance& instance = instances_[idx];
+    try {
+      instance.mesh->updatePose(*instance.animation, time_);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!error_) { error_ = std::current_exception(); }
+    }
+  }
+}
+
+void CrowdAnimator::workerLoop() {
+  unsigned last_generation = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      work_ready_.wait(lock, [&]() {
+        return should_quit_ || generation_ != last_generation;
+      });
+      if (should_quit_) { return; }
+      last_generation = generation_;
+    }
+
+    evaluateInstances();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--busy_workers_ == 0) {
+      work_done_.notify_one();
+    }
+  }
+}
+
+void CrowdAnimator::update(float time) {
+  if (instances_.empty()) { return; }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    time_ = time;
+    next_instance_ = 0;
+    busy_workers_ = workers_.size();
+    ++generation_;
+  }
+  work_ready_.notify_all();
+
+  evaluateInstances();
+
+  std::exception_ptr error;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    work_done_.wait(lock, [this]() { return busy_workers_ == 0; });
+    std::swap(error, error_);
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+}  // namespace engine
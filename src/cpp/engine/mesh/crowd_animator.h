@@ -0,0 +1,82 @@
+// Copyright (c) 2014, Tamas Csala
+
+#ifndef ENGINE_MESH_CROWD_ANIMATOR_H_
+#define ENGINE_MESH_CROWD_ANIMATOR_H_
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <exception>
+#include <condition_variable>
+
+#include "./animation.h"
+#include "./animated_mesh_renderer.h"
+
+namespace engine {
+
+/// Updates the poses of many animated instances in parallel.
+/** The instances can share their meshes, as the pose evaluation only reads the
+  * mesh's data. The AnimationEndedCallbacks are called on the worker threads,
+  * so they should only modify the state of their own instance. */
+class CrowdAnimator {
+ public:
+  /**
+   * @brief Starts the worker threads.
+   *
+   * @param thread_count   The number of threads that evaluate the poses,
+   *                       including the thread that calls update().
+   */
+  explicit CrowdAnimator(
+      unsigned thread_count = std::thread::hardware_concurrency());
+  ~CrowdAnimator();
+
+  /// Registers an instance. Both the mesh and the animation have to outlive
+  /// the registration.
+  void addInstance(const AnimatedMeshRenderer* mesh, Animation* animation);
+
+  /// Unregisters an instance.
+  void removeInstance(const Animation* animation);
+
+  /// Returns the number of registered instances.
+  size_t instance_count() const { return instances_.size(); }
+
+  /**
+   * @brief Updates the poses of all the registered instances, and returns
+   *        when all of them are ready.
+   *
+   * @param time_in_seconds  Expect a time value as a float, optimally since
+   *                         the start of the program.
+   */
+  void update(float time_in_seconds);
+
+ private:
+  struct Instance {
+    const AnimatedMeshRenderer* mesh;
+    Animation* animation;
+  };
+
+  std::vector<Instance> instances_;
+  std::vector<std::thread> workers_;
+
+  std::mutex mutex_;
+  std::condition_variable work_ready_, work_done_;
+  unsigned generation_;
+  unsigned busy_workers_;
+  bool should_quit_;
+
+  float time_;
+  std::atomic<size_t> next_instance_;
+  std::exception_ptr error_;
+
+  /// Evaluates instances until there's none left in this update.
+  void evaluateInstances();
+  void workerLoop();
+
+  CrowdAnimator(const CrowdAnimator&) = delete;
+  CrowdAnimator& operator=(const CrowdAnimator&) = delete;
+};
+
+}  // namespace engine
+
+#endif
@@ -0,0 +1,449 @@
+// Copyright (c) 2014, Tamas Csala
+
+#include "./mesh_lods.h"
+
+#include <map>
+#include <cmath>
+#include <tuple>
+#include <cstdint>
+#include <fstream>
+#include <algorithm>
+
+namespace engine {
+
+namespace {
+
+// The allowed error of the first simplified level, relative to the size of
+// the mesh. It is multiplied by kLodErrorGrowth with every level.
+const float kFirstLodError = 0.01f;
+const float kLodErrorGrowth = 2.0f;
+
+/// The symmetric 4x4 matrix of the squared distance to a set of planes.
+struct Quadric {
+  // The upper triangle of the matrix, row by row.
+  double q[10];
+
+  Quadric() { std::fill(q, q + 10, 0.0); }
+
+  /// The quadric of a plane, with the normal n and the offset d.
+  Quadric(const glm::dvec3& n, double d, double weight) {
+    double values[10] = {n.x*n.x, n.x*n.y, n.x*n.z, n.x*d,
+                                  n.y*n.y, n.y*n.z, n.y*d,
+                                           n.z*n.z, n.z*d,
+                                                    d*d};
+    for (int i = 0; i < 10; ++i) { q[i] = weight * values[i]; }
+  }
+
+  Quadric& operator+=(const Quadric& rhs) {
+    for (int i = 0; i < 10; ++i) { q[i] += rhs.q[i]; }
+    return *this;
+  }
+
+  Quadric operator+(const Quadric& rhs) const {
+    Quadric result = *this;
+    return result += rhs;
+  }
+
+  /// Returns the sum of the squared distances of a point from the planes.
+  double error(const glm::vec3& p) const {
+    double x = p.x, y = p.y, z = p.z;
+    return q[0]*x*x + 2*q[1]*x*y + 2*q[2]*x*z + 2*q[3]*x
+                    +   q[4]*y*y + 2*q[5]*y*z + 2*q[6]*y
+                                 +   q[7]*z*z + 2*q[8]*z
+                                              +   q[9];
+  }
+};
+
+/// Moving a border vertex away from its border costs this many times more.
+const double kBorderWeight = 10.0;
+
+/// Changing the bone weights of a vertex by one (summed over the bones) costs
+/// as much as moving it by this fraction of the mesh's size.
+const double kSkinWeightDistance = 0.25;
+
+struct Collapse {
+  unsigned from, to;
+  double error;
+
+  bool operator<(const Collapse& rhs) const { return error < rhs.error; }
+};
+
+glm::vec3 TriangleNormal(const glm::vec3& a, const glm::vec3& b,
+                         const glm::vec3& c) {
+  return glm::cross(b - a, c - a);
+}
+
+/// Returns the sum of the absolute differences of two vertices' weights.
+double InfluenceDifference(const BoneInfluences& a, const BoneInfluences& b) {
+  double difference = 0;
+  size_t i = 0, j = 0;
+  while (i < a.size() || j < b.size()) {
+    if (j == b.size() || (i < a.size() && a[i].first < b[j].first)) {
+      difference += std::abs(a[i++].second);
+    } else if (i == a.size() || b[j].first < a[i].first) {
+      difference += std::abs(b[j++].second);
+    } else {
+      difference += std::abs(a[i++].second - b[j++].second);
+    }
+  }
+  return difference;
+}
+
+}  // namespace
+
+/// Returns true if a collapse would flip (or degenerate) any triangle,
+/// that isn't removed by the collapse.
+static bool FlipsTriangles(const std::vector<glm::vec3>& positions,
+                           const std::vector<unsigned>& indices,
+                           const std::vector<unsigned>& triangles,
+                           const Collapse& collapse) {
+  for (unsigned triangle : triangles) {
+    const unsigned* tri = &indices[3*triangle];
+    if (tri[0] == collapse.to || tri[1] == collapse.to ||
+        tri[2] == collapse.to) {
+      continue;  // this one will be removed
+    }
+
+    glm::vec3 old_pos[3], new_pos[3];
+    for (int k = 0; k < 3; ++k) {
+      old_pos[k] = positions[tri[k]];
+      new_pos[k] = positions[tri[k] == collapse.from ? collapse.to : tri[k]];
+    }
+    glm::vec3 old_normal = TriangleNormal(old_pos[0], old_pos[1], old_pos[2]);
+    glm::vec3 new_normal = TriangleNormal(new_pos[0], new_pos[1], new_pos[2]);
+    if (glm::dot(old_normal, new_normal) <= 0) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+std::vector<unsigned> SimplifyMesh(
+    const std::vector<glm::vec3>& positions,
+    const std::vector<unsigned>& indices,
+    size_t target_index_count,
+    float max_error,
+    const std::vector<BoneInfluences>& influences) {
+  const size_t vertex_count = positions.size();
+  std::vector<unsigned> result = indices;
+  if (result.size() <= target_index_count) {
+    return result;
+  }
+
+  // The weight differences are converted to squared distances, like the
+  // quadric errors.
+  double skin_weight = 0;
+  if (influences.size() == vertex_count) {
+    glm::vec3 mins = positions[0], maxes = positions[0];
+    for (const glm::vec3& p : positions) {
+      mins = glm::min(mins, p);
+      maxes = glm::max(maxes, p);
+    }
+    double distance = kSkinWeightDistance * glm::length(maxes - mins);
+    skin_weight = distance * distance;
+  }
+
+  // The vertices at the seams share their position with an other vertex.
+  // Moving them would tear the seam open, so they are locked.
+  std::vector<bool> locked(vertex_count, false);
+  std::map<std::tuple<float, float, float>, unsigned> vertex_at;
+  for (unsigned v = 0; v < vertex_count; ++v) {
+    const glm::vec3& p = positions[v];
+    auto inserted = vertex_at.insert({std::make_tuple(p.x, p.y, p.z), v});
+    if (!inserted.second) {
+      locked[v] = true;
+      locked[inserted.first->second] = true;
+    }
+  }
+
+  // The initial quadrics are the planes of the adjacent triangles.
+  std::vector<Quadric> quadrics(vertex_count);
+  std::map<std::pair<unsigned, unsigned>, unsigned> edge_count;
+  for (size_t i = 0; i + 2 < result.size(); i += 3) {
+    const unsigned* tri = &result[i];
+    glm::dvec3 normal{TriangleNormal(positions[tri[0]], positions[tri[1]],
+                                     positions[tri[2]])};
+    double length = glm::length(normal);
+    if (length == 0) { continue; }
+    normal /= length;
+
+    Quadric plane{normal, -glm::dot(normal, glm::dvec3(positions[tri[0]])), 1};
+    for (int k = 0; k < 3; ++k) {
+      quadrics[tri[k]] += plane;
+      unsigned a = tri[k], b = tri[(k+1) % 3];
+      edge_count[std::make_pair(std::min(a, b), std::max(a, b))]++;
+    }
+  }
+
+  // The border edges also add a plane, that is perpendicular to the
+  // triangle, so that the vertices can't slide off the border.
+  for (size_t i = 0; i + 2 < result.size(); i += 3) {
+    const unsigned* tri = &result[i];
+    glm::dvec3 normal{TriangleNormal(positions[tri[0]], positions[tri[1]],
+                                     positions[tri[2]])};
+    for (int k = 0; k < 3; ++k) {
+      unsigned a = tri[k], b = tri[(k+1) % 3];
+      if (edge_count[std::make_pair(std::min(a, b), std::max(a, b))] != 1) {
+        continue;
+      }
+      glm::dvec3 edge = glm::dvec3(positions[b]) - glm::dvec3(positions[a]);
+      glm::dvec3 border_normal = glm::cross(edge, normal);
+      double length = glm::length(border_normal);
+      if (length == 0) { continue; }
+      border_normal /= length;
+
+      Quadric border{border_normal,
+                     -glm::dot(border_normal, glm::dvec3(positions[a])),
+                     kBorderWeight};
+      quadrics[a] += border;
+      quadrics[b] += border;
+    }
+  }
+
+  // Every pass collapses the cheapest edges of the mesh, but every vertex is
+  // touched by at most one collapse, so the costs don't get outdated.
+  const double max_quadric_error = double(max_error) * max_error;
+  std::vector<unsigned> remap(vertex_count);
+  while (result.size() > target_index_count) {
+    std::vector<std::vector<unsigned>> vertex_triangles(vertex_count);
+    for (size_t i = 0; i < result.size(); ++i) {
+      vertex_triangles[result[i]].push_back(i / 3);
+    }
+
+    std::vector<Collapse> collapses;
+    for (unsigned v = 0; v < vertex_count; ++v) {
+      if (locked[v] || vertex_triangles[v].empty()) { continue; }
+
+      Collapse best{v, v, 0};
+      for (unsigned triangle : vertex_triangles[v]) {
+        for (int k = 0; k < 3; ++k) {
+          unsigned w = result[3*triangle + k];
+          if (w == v) { continue; }
+          double error = (quadrics[v] + quadrics[w]).error(positions[w]);
+          if (skin_weight != 0) {
+            double difference = InfluenceDifference(influences[v],
+                                                    influences[w]);
+            error += skin_weight * difference * difference;
+          }
+          if (best.to == v || error < best.error) {
+            best = Collapse{v, w, error};
+          }
+        }
+      }
+      if (best.to != v) {
+        collapses.push_back(best);
+      }
+    }
+    std::sort(collapses.begin(), collapses.end());
+
+    for (unsigned v = 0; v < vertex_count; ++v) { remap[v] = v; }
+    std::vector<bool> touched(vertex_count, false);
+    size_t removed_indices = 0, collapse_count = 0;
+    for (const Collapse& collapse : collapses) {
+      if (collapse.error > max_quadric_error ||
+          result.size() - removed_indices <= target_index_count) {
+        break;
+      }
+      if (touched[collapse.from] || touched[collapse.to]) { continue; }
+
+      const auto& triangles = vertex_triangles[collapse.from];
+      if (FlipsTriangles(positions, result, triangles, collapse)) {
+        continue;
+      }
+
+      remap[collapse.from] = collapse.to;
+      quadrics[collapse.to] += quadrics[collapse.from];
+      for (unsigned triangle : triangles) {
+        bool removed = false;
+        for (int k = 0; k < 3; ++k) {
+          unsigned w = result[3*triangle + k];
+          touched[w] = true;
+          removed = removed || w == collapse.to;
+        }
+        if (removed) { removed_indices += 3; }
+      }
+      collapse_count++;
+    }
+
+    if (collapse_count == 0) {
+      break;
+    }
+
+    // Apply the collapses, and remove the degenerate triangles.
+    size_t write = 0;
+    for (size_t i = 0; i + 2 < result.size(); i += 3) {
+      unsigned a = remap[result[i]], b = remap[result[i+1]],
+               c = remap[result[i+2]];
+      if (a != b && b != c && a != c) {
+        result[write++] = a;
+        result[write++] = b;
+        result[write++] = c;
+      }
+    }
+    result.resize(write);
+  }
+
+  return result;
+}
+
+std::unique_ptr<MeshLods> MeshLods::generate(const aiScene* scene,
+                                             unsigned lod_count) {
+  lod_count = std::max(lod_count, 1u);
+  std::unique_ptr<MeshLods> lods{new MeshLods{lod_count, scene->mNumMeshes}};
+
+  for (unsigned mesh_idx = 0; mesh_idx < scene->mNumMeshes; ++mesh_idx) {
+    const aiMesh* mesh = scene->mMeshes[mesh_idx];
+    lods->vertex_counts_[mesh_idx] = mesh->mNumVertices;
+    if (mesh->mNumVertices == 0) { continue; }
+
+    std::vector<glm::vec3> positions;
+    positions.reserve(mesh->mNumVertices);
+    glm::vec3 mins{mesh->mVertices[0].x, mesh->mVertices[0].y,
+                   mesh->mVertices[0].z};
+    glm::vec3 maxes = mins;
+    for (unsigned i = 0; i < mesh->mNumVertices; ++i) {
+      const aiVector3D& v = mesh->mVertices[i];
+      positions.push_back(glm::vec3(v.x, v.y, v.z));
+      mins = glm::min(mins, positions.back());
+      maxes = glm::max(maxes, positions.back());
+    }
+    float size = glm::length(maxes - mins);
+
+    std::vector<BoneInfluences> influences;
+    if (mesh->HasBones()) {
+      influences.resize(mesh->mNumVertices);
+      for (unsigned bone = 0; bone < mesh->mNumBones; ++bone) {
+        const aiBone* ai_bone = mesh->mBones[bone];
+        for (unsigned i = 0; i < ai_bone->mNumWeights; ++i) {
+          const aiVertexWeight& weight = ai_bone->mWeights[i];
+          if (weight.mVertexId < mesh->mNumVertices) {
+            // The bones are iterated in order, so these stay sorted
+            influences[weight.mVertexId].push_back({bone, weight.mWeight});
+          }
+        }
+      }
+    }
+
+    std::vector<unsigned> indices;
+    indices.reserve(mesh->mNumFaces * 3);
+    for (unsigned i = 0; i < mesh->mNumFaces; ++i) {
+      const aiFace& face = mesh->mFaces[i];
+      if (face.mNumIndices == 3) {
+        indices.insert(indices.end(), face.mIndices, face.mIndices + 3);
+      }
+    }
+
+    float max_error = kFirstLodError * size;
+    for (unsigned level = 1; level < lod_count; ++level) {
+      indices = SimplifyMesh(positions, indices, indices.size() / 6 * 3,
+                             max_error, influences);
+      lods->indices_[mesh_idx * (lod_count - 1) + level - 1] = indices;
+      max_error *= kLodErrorGrowth;
+    }
+  }
+
+  return lods;
+}
+
+namespace {
+
+const char kMagic[4] = {'L', 'O', 'D', 'S'};
+const uint32_t kVersion = 3;
+
+struct FileHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t lod_count, mesh_count;
+  // The simplification parameters the levels were generated with.
+  float first_lod_error, lod_error_growth;
+};
+
+}  // namespace
+
+bool MeshLods::save(const std::string& filename) const {
+  std::ofstream file(filename, std::ios::binary);
+  if (!file) { return false; }
+
+  FileHeader header;
+  std::copy(kMagic, kMagic + 4, header.magic);
+  header.version = kVersion;
+  header.lod_count = lod_count_;
+  header.mesh_count = mesh_count_;
+  header.first_lod_error = kFirstLodError;
+  header.lod_error_growth = kLodErrorGrowth;
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(vertex_counts_.data()),
+             vertex_counts_.size() * sizeof(uint32_t));
+
+  for (const auto& indices : indices_) {
+    uint32_t size = indices.size();
+    file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    file.write(reinterpret_cast<const char*>(indices.data()),
+               size * sizeof(unsigned));
+  }
+
+  return file.good();
+}
+
+std::unique_ptr<MeshLods> MeshLods::load(const std::string& filename) {
+  std::ifstream file(filename, std::ios::binary);
+  if (!file) { return nullptr; }
+
+  file.seekg(0, std::ios::end);
+  uint64_t file_size = file.tellg();
+  file.seekg(0, std::ios::beg);
+
+  FileHeader header;
+  file.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (!file || !std::equal(kMagic, kMagic + 4, header.magic) ||
+      header.version != kVersion || header.lod_count == 0 ||
+      header.first_lod_error != kFirstLodError ||
+      header.lod_error_growth != kLodErrorGrowth) {
+    return nullptr;
+  }
+
+  // A truncated or corrupted file shouldn't make us allocate, or read more
+  // than what is actually there. Every mesh has a vertex count, and every
+  // simplified level has a size, even if its index list is empty.
+  uint64_t fixed_size = sizeof(header) + uint64_t(header.mesh_count) *
+      uint64_t(header.lod_count) * sizeof(uint32_t);
+  if (fixed_size > file_size) {
+    return nullptr;
+  }
+
+  std::unique_ptr<MeshLods> lods{
+    new MeshLods{header.lod_count, header.mesh_count}};
+  file.read(reinterpret_cast<char*>(lods->vertex_counts_.data()),
+            header.mesh_count * sizeof(uint32_t));
+  uint64_t indices_size = file_size - fixed_size;
+  for (auto& indices : lods->indices_) {
+    uint32_t size = 0;
+    file.read(reinterpret_cast<char*>(&size), sizeof(size));
+    if (!file || size % 3 != 0 ||
+        uint64_t(size) * sizeof(unsigned) > indices_size) {
+      return nullptr;
+    }
+    indices_size -= uint64_t(size) * sizeof(unsigned);
+    indices.resize(size);
+    file.read(reinterpret_cast<char*>(indices.data()),
+              size * sizeof(unsigned));
+  }
+
+  if (!file || indices_size != 0) { return nullptr; }
+  return lods;
+}
+
+bool MeshLods::matches(const aiScene* scene, unsigned lod_count) const {
+  if (lod_count_ != lod_count || mesh_count_ != scene->mNumMeshes) {
+    return false;
+  }
+  for (size_t i = 0; i < mesh_count_; ++i) {
+    if (vertex_counts_[i] != scene->mMeshes[i]->mNumVertices) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace engine
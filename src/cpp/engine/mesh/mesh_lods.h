@@ -0,0 +1,105 @@
+// Copyright (c) 2014, Tamas Csala
+
+#ifndef ENGINE_MESH_MESH_LODS_H_
+#define ENGINE_MESH_MESH_LODS_H_
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <memory>
+#include <cstdint>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "../assimp.h"
+
+namespace engine {
+
+/// The bone influences of a vertex, as (bone index, weight) pairs, sorted by
+/// the bone index. Empty for the vertices of static meshes.
+typedef std::vector<std::pair<unsigned, float>> BoneInfluences;
+
+/**
+ * @brief Simplifies a triangle mesh with quadric error metric edge collapses.
+ *
+ * Only half edge collapses are done (a vertex is merged into one of its
+ * neighbours), so the result uses a subset of the original vertices, and
+ * their attributes stay valid. The vertices that share their position with
+ * another vertex (UV or normal seams) are never moved, and the open borders
+ * (for ex. leaf cards) are kept by extra quadrics.
+ *
+ * A merged vertex is skinned with the bone weights of the vertex it was
+ * merged into, so the collapses between vertices with different influences
+ * are penalized, as if the difference of the weights moved the surface by
+ * a fraction of the mesh's size. The ones between differently skinned body
+ * parts are above any sensible max_error.
+ *
+ * @param positions           The positions of the vertices.
+ * @param indices             The triangles, with three indices each.
+ * @param target_index_count  The simplification stops when the result has
+ *                            at most this many indices.
+ * @param max_error           The simplification also stops before a collapse
+ *                            that would move the surface farther than this.
+ * @param influences          The bone influences of the vertices, or an
+ *                            empty vector for static meshes.
+ * @return The indices of the simplified triangles.
+ */
+std::vector<unsigned> SimplifyMesh(
+    const std::vector<glm::vec3>& positions,
+    const std::vector<unsigned>& indices,
+    size_t target_index_count,
+    float max_error,
+    const std::vector<BoneInfluences>& influences = {});
+
+/// The simplified triangle lists of a scene's meshes.
+/** Every level of detail uses the vertices of the original meshes, only the
+  * indices are different. Each level has about half as many triangles as
+  * the previous one. The 0th level is the original mesh, it isn't stored. */
+class MeshLods {
+ public:
+  /// Generates the levels of detail for every mesh of the scene.
+  /** @param scene       The scene to simplify (it should be triangulated).
+    * @param lod_count   The number of levels, including the original one. */
+  static std::unique_ptr<MeshLods> generate(const aiScene* scene,
+                                            unsigned lod_count);
+
+  /// Writes the index lists to a file. Returns false on failure.
+  bool save(const std::string& filename) const;
+
+  /// Loads the index lists written by save(). Returns nullptr if the file
+  /// doesn't exist, if it was written by an incompatible version, if it
+  /// was generated with different simplification parameters, or if its
+  /// sizes don't match its length.
+  static std::unique_ptr<MeshLods> load(const std::string& filename);
+
+  /// Checks if the levels were generated for a scene with lod_count levels.
+  /** The number of the meshes, and the vertex count of every mesh have to
+    * match the ones that the levels were generated from. */
+  bool matches(const aiScene* scene, unsigned lod_count) const;
+
+  /// Returns the indices of a mesh in a level of detail (level > 0).
+  const std::vector<unsigned>& indices(size_t mesh, unsigned level) const {
+    return indices_[mesh * (lod_count_ - 1) + level - 1];
+  }
+
+  unsigned lod_count() const { return lod_count_; }
+  size_t mesh_count() const { return mesh_count_; }
+
+ private:
+  unsigned lod_count_;
+  size_t mesh_count_;
+  std::vector<std::vector<unsigned>> indices_;
+
+  /// The vertex counts of the source meshes.
+  std::vector<uint32_t> vertex_counts_;
+
+  MeshLods(unsigned lod_count, size_t mesh_count)
+      : lod_count_(lod_count), mesh_count_(mesh_count)
+      , indices_(mesh_count * (lod_count - 1))
+      , vertex_counts_(mesh_count) {}
+};
+
+}  // namespace engine
+
+#endif
@@ -5,6 +5,7 @@
 
 #include <vector>
 #include "./mesh_renderer.h"
+#include "../gl_state.h"
 
 namespace engine {
 
@@ -29,6 +30,26 @@ std::vector<IdxType> MeshRenderer::indices() {
   return indices_vector;
 }
 
+template <typename VaoOf>
+/// Renders every entry with its materials, in the order of the materials.
+void MeshRenderer::renderEntries(VaoOf vao_of, GLsizei instance_count) {
+  const unsigned kNoMaterial = MeshEntry::kInvalidMaterial;
+  unsigned bound_material = kNoMaterial;
+
+  for (size_t idx : render_order_) {
+    unsigned material_index = entries_[idx].material_index;
+    if (textures_enabled_ && material_index != bound_material) {
+      bindMaterial(material_index);
+      bound_material = material_index;
+    }
+
+    GlState::BindVertexArray(vao_of(idx));
+    drawEntry(idx, instance_count);
+  }
+
+  GlState::UnbindVertexArray();
+}
+
 }  // namespace engine
 
 #endif
@@ -1,34 +1,199 @@
 // Copyright (c) 2014, Tamas Csala
 
+#include <cmath>
+#include <string>
 #include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstddef>
+#include <limits>
+#include <assimp/Exporter.hpp>
 #include "./mesh_renderer.h"
+#include "../misc.h"
+#include "../gl_state.h"
+#include "../texture_cache.h"
+#include "../async_loader.h"
 #include "../../oglwrap/context.h"
 #include "../../oglwrap/smart_enums.h"
+#include <glm/gtc/packing.hpp>
 
 namespace engine {
 
+template <typename T>
+/// Reorders an array, so that its i-th element will be the order[i]-th one.
+static void Reorder(T* array, const std::vector<unsigned>& order) {
+  if (!array) {
+    return;
+  }
+  std::vector<T> copy(array, array + order.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    array[i] = copy[order[i]];
+  }
+}
+
+template <typename Mesh>
+/// Reorders every per vertex attribute array of an aiMesh or aiAnimMesh.
+static void ReorderVertices(Mesh* mesh, const std::vector<unsigned>& order) {
+  Reorder(mesh->mVertices, order);
+  Reorder(mesh->mNormals, order);
+  Reorder(mesh->mTangents, order);
+  Reorder(mesh->mBitangents, order);
+  for (unsigned i = 0; i < AI_MAX_NUMBER_OF_COLOR_SETS; i++) {
+    Reorder(mesh->mColors[i], order);
+  }
+  for (unsigned i = 0; i < AI_MAX_NUMBER_OF_TEXTURECOORDS; i++) {
+    Reorder(mesh->mTextureCoords[i], order);
+  }
+}
+
+/// Reorders the vertices in the order they are first used by the triangles.
+/** The triangles are already sorted for the post-transform vertex cache (by
+  * aiProcess_ImproveCacheLocality), this makes the vertex fetches follow them,
+  * and access the memory almost sequentially. The vertices that aren't used
+  * by any triangle are moved to the end. */
+static void OptimizeVertexFetch(const aiScene* scene) {
+  const unsigned kUnused = unsigned(-1);
+
+  for (unsigned mesh_idx = 0; mesh_idx < scene->mNumMeshes; ++mesh_idx) {
+    aiMesh* mesh = scene->mMeshes[mesh_idx];
+    std::vector<unsigned> new_index(mesh->mNumVertices, kUnused);
+    std::vector<unsigned> order;
+    order.reserve(mesh->mNumVertices);
+
+    for (unsigned i = 0; i < mesh->mNumFaces; i++) {
+      aiFace& face = mesh->mFaces[i];
+      for (unsigned j = 0; j < face.mNumIndices; j++) {
+        unsigned& index = face.mIndices[j];
+        if (new_index[index] == kUnused) {
+          new_index[index] = order.size();
+          order.push_back(index);
+        }
+        index = new_index[index];
+      }
+    }
+    for (unsigned i = 0; i < mesh->mNumVertices; i++) {
+      if (new_index[i] == kUnused) {
+        new_index[i] = order.size();
+        order.push_back(i);
+      }
+    }
+
+    ReorderVertices(mesh, order);
+    for (unsigned i = 0; i < mesh->mNumAnimMeshes; i++) {
+      ReorderVertices(mesh->mAnimMeshes[i], order);
+    }
+    for (unsigned i = 0; i < mesh->mNumBones; i++) {
+      aiBone* bone = mesh->mBones[i];
+      for (unsigned j = 0; j < bone->mNumWeights; j++) {
+        bone->mWeights[j].mVertexId = new_index[bone->mWeights[j].mVertexId];
+      }
+    }
+  }
+}
+
+/// Returns the name of a cache file, that belongs to the post-processed scene.
+static std::string CacheFilename(const std::string& filename, unsigned flags,
+                                 const std::string& extension) {
+  char flags_str[16];
+  snprintf(flags_str, sizeof(flags_str), "%08x", flags);
+  return filename + "." + flags_str + extension;
+}
+
+/// Imports a scene, through a cache of the post-processed scene.
+/** The cache is stored next to the original file in assimp's binary format,
+  * its name contains the post-process flags. It is used until the original
+  * file gets modified, or assimp can't read it anymore (for ex. because of
+  * a format version change). */
+static const aiScene* ImportScene(Assimp::Importer& importer,
+                                  const std::string& filename,
+                                  unsigned flags) {
+  std::string cache_filename = CacheFilename(filename, flags, ".assbin");
+
+  if (IsNewer(cache_filename, filename)) {
+    // Everything is already done on the cached scene
+    const aiScene* scene = importer.ReadFile(cache_filename, 0);
+    if (scene) {
+      // This is a no-op for up-to-date caches, but it is cheap enough
+      // to not care about the versioning of the cache files.
+      OptimizeVertexFetch(scene);
+      return scene;
+    }
+  }
+
+  const aiScene* scene = importer.ReadFile(filename, flags);
+  if (scene) {
+    OptimizeVertexFetch(scene);
+
+    Assimp::Exporter exporter;
+    if (exporter.Export(scene, "assbin", cache_filename) != aiReturn_SUCCESS) {
+      std::cerr << "Couldn't write the mesh cache '"
+                << cache_filename << "'" << std::endl;
+    }
+  }
+  return scene;
+}
+
+/// Imports a scene, and does some post-processing on it. Throws on failure.
+ImportedScene ImportedScene::Import(const std::string& filename,
+                                    gl::Bitfield<aiPostProcessSteps> flags) {
+  ImportedScene imported;
+  imported.importer.reset(new Assimp::Importer{});
+  imported.filename = filename;
+  imported.flags = flags | aiProcess_Triangulate |
+                   aiProcess_ImproveCacheLocality;
+  imported.scene = ImportScene(*imported.importer, filename, imported.flags);
+  if (!imported.scene) {
+    throw std::runtime_error("Error parsing " + filename + " : " +
+                             imported.importer->GetErrorString());
+  }
+
+  return imported;
+}
+
 /// Loads in the mesh from a file, and does some post-processing on it.
 /** @param filename - The name of the file to load in.
   * @param flags - The assimp post-process flags. */
 MeshRenderer::MeshRenderer(const std::string& filename,
                            gl::Bitfield<aiPostProcessSteps> flags)
-    : scene_(importer_.ReadFile(filename.c_str(), flags|aiProcess_Triangulate))
-    , filename_(filename)
+    : MeshRenderer(ImportedScene::Import(filename, flags)) {}
+
+/// Creates the mesh from an already imported scene.
+MeshRenderer::MeshRenderer(ImportedScene imported)
+    : importer_(std::move(imported.importer))
+    , scene_(imported.scene)
+    , filename_(imported.filename)
+    , import_flags_(imported.flags)
     , entries_(scene_->mNumMeshes)
     , is_setup_positions_(false)
     , is_setup_normals_(false)
     , is_setup_tex_coords_(false)
-    , textures_enabled_(true) {
-  if (!scene_) {
-    throw std::runtime_error("Error parsing " + filename_ + " : " +
-                             importer_.GetErrorString());
-  }
-
+    , textures_enabled_(true)
+    , lod_(0) {
   // The world transform is the transform that takes the root node to it's
   // parent's space, which is the OpenGL style world space. The inverse of this
   // is stored as an attribute of the scene's root node.
   world_transformation_ =
     glm::inverse(engine::convertMatrix(scene_->mRootNode->mTransformation));
+
+  // The bounding box is needed a lot of times (for ex. for every placed
+  // instance of the mesh), so it is only calculated once.
+  glm::vec3 mins{std::numeric_limits<float>::max()};
+  glm::vec3 maxes{-std::numeric_limits<float>::max()};
+  for (unsigned mesh_idx = 0; mesh_idx < scene_->mNumMeshes; ++mesh_idx) {
+    const aiMesh* mesh = scene_->mMeshes[mesh_idx];
+    for (unsigned i = 0; i < mesh->mNumVertices; i++) {
+      glm::vec3 vert{mesh->mVertices[i].x, mesh->mVertices[i].y,
+                     mesh->mVertices[i].z};
+      mins = glm::min(mins, vert);
+      maxes = glm::max(maxes, vert);
+    }
+  }
+  bbox_ = BoundingBox{mins, maxes};
+
+  imported_lods_ = std::move(imported.lods);
+  imported_textures_ = std::move(imported.textures);
+
+  sortEntriesByMaterial();
 }
 
 std::vector<int> MeshRenderer::btTriangles(btTriangleIndexVertexArray* triangles) {
@@ -104,9 +269,116 @@ void MeshRenderer::setIndices(size_t index) {
                  "This might result in rendering artifacts." << std::endl;
   }
 
+  auto& lods = entries_[index].lods;
+  lods.clear();
+  lods.push_back(MeshEntry::Lod{0, unsigned(indices_vector.size())});
+
+  // The simplified levels are stored after the original indices.
+  for (unsigned level = 1; level < lodCount(); ++level) {
+    const std::vector<unsigned>& lod_indices = lods_->indices(index, level);
+    lods.push_back(MeshEntry::Lod{unsigned(indices_vector.size()),
+                                  unsigned(lod_indices.size())});
+    indices_vector.insert(indices_vector.end(), lod_indices.begin(),
+                          lod_indices.end());
+  }
+
   gl::Bind(entries_[index].indices);
   entries_[index].indices.data(indices_vector);
-  entries_[index].idx_count = indices_vector.size();
+}
+
+/// Uploads the indices of an entry, using the smallest possible index type.
+/** This expects the correct vao to be already bound!
+  * @param index - The index of the entry */
+void MeshRenderer::setupIndices(size_t index) {
+  const aiMesh* mesh = scene_->mMeshes[index];
+
+  // The type only has to be able to address every vertex. Byte indices
+  // aren't used, because a lot of drivers convert them to shorts on the CPU.
+  if (mesh->mNumVertices < USHRT_MAX) {
+    entries_[index].idx_type = gl::kUnsignedShort;
+    setIndices<unsigned short>(index);
+  } else {
+    entries_[index].idx_type = gl::kUnsignedInt;
+    setIndices<unsigned int>(index);
+  }
+}
+
+/// Loads the levels of detail of a scene from the cache, or generates them.
+static std::unique_ptr<MeshLods> LoadLods(const aiScene* scene,
+                                          const std::string& filename,
+                                          unsigned import_flags,
+                                          unsigned lod_count) {
+  std::string cache_filename = CacheFilename(
+    filename, import_flags, "." + std::to_string(lod_count) + ".lod");
+
+  std::unique_ptr<MeshLods> lods;
+  if (IsNewer(cache_filename, filename)) {
+    lods = MeshLods::load(cache_filename);
+
+    // Don't trust a cache that doesn't match the scene.
+    bool valid = lods && lods->matches(scene, lod_count);
+    for (size_t i = 0; valid && i < scene->mNumMeshes; ++i) {
+      for (unsigned level = 1; valid && level < lod_count; ++level) {
+        for (unsigned index : lods->indices(i, level)) {
+          if (index >= scene->mMeshes[i]->mNumVertices) {
+            valid = false;
+            break;
+          }
+        }
+      }
+    }
+    if (!valid) {
+      lods.reset();
+    }
+  }
+
+  if (!lods) {
+    lods = MeshLods::generate(scene, lod_count);
+    if (!lods->save(cache_filename)) {
+      std::cerr << "Couldn't write the mesh lod cache '"
+                << cache_filename << "'" << std::endl;
+    }
+  }
+
+  return lods;
+}
+
+void ImportedScene::generateLods(unsigned lod_count) {
+  lods = LoadLods(scene, filename, flags, std::max(lod_count, 1u));
+}
+
+/// Generates simplified levels of detail for the meshes.
+void MeshRenderer::setupLods(unsigned lod_count) {
+  lod_count = std::max(lod_count, 1u);
+  if (imported_lods_ && imported_lods_->lod_count() == lod_count) {
+    lods_ = std::move(imported_lods_);
+  } else {
+    lods_ = LoadLods(scene_, filename_, import_flags_, lod_count);
+  }
+  imported_lods_.reset();
+
+  // Upload the new levels, if the indices are already set up.
+  if (is_setup_positions_) {
+    for (size_t i = 0; i < entries_.size(); i++) {
+      gl::Bind(entries_[i].vao);
+      setupIndices(i);
+    }
+    gl::Unbind(gl::kVertexArray);
+  }
+}
+
+/// Selects the level of detail from the size of the mesh on the screen.
+void MeshRenderer::selectLod(float screen_size) {
+  // The original mesh is used above this size, and every halving of the
+  // size drops a level, which halves the triangle count.
+  const float kFullDetailScreenSize = 0.25f;
+
+  unsigned lod = 0;
+  for (float size = kFullDetailScreenSize;
+       screen_size < size && lod + 1 < lodCount(); size /= 2) {
+    lod++;
+  }
+  lod_ = lod;
 }
 
 /// Loads in vertex positions and indices, and uploads the former into an attribute array.
@@ -141,16 +413,7 @@ void MeshRenderer::setupPositions(gl::VertexAttrib attrib) {
 
     // ~~~~~~<{ Load the indices }>~~~~~~
 
-    if (mesh->mNumFaces * 3 < UCHAR_MAX) {
-      entries_[i].idx_type = gl::kUnsignedByte;
-      setIndices<unsigned char>(i);
-    } else if (mesh->mNumFaces * 3 < USHRT_MAX) {
-      entries_[i].idx_type = gl::kUnsignedShort;
-      setIndices<unsigned short>(i);
-    } else {
-      entries_[i].idx_type = gl::kUnsignedInt;
-      setIndices<unsigned int>(i);
-    }
+    setupIndices(i);
   }
 
   gl::Unbind(gl::kArrayBuffer);
@@ -255,9 +518,242 @@ void MeshRenderer::setupTexCoords(gl::VertexAttrib attrib,
 
   gl::Unbind(gl::kArrayBuffer);
   gl::Unbind(gl::kVertexArray);
+
+  sortEntriesByMaterial();
+}
+
+/// A vertex of the VertexFormat::Float layout.
+struct FloatVertex {
+  glm::vec3 position, normal;
+  glm::vec2 tex_coord;
+};
+
+template <typename TexCoord_t>
+/// A vertex of the VertexFormat::Compact layout. The w coordinate of the
+/// position is always 1 (32767), so the shaders can read it as a vec4.
+struct CompactVertex {
+  GLshort position[4];
+  GLbyte normal[4];
+  TexCoord_t tex_coord[2];
+};
+
+static GLshort PackSnorm16(float value) {
+  return static_cast<GLshort>(
+    std::round(glm::clamp(value, -1.0f, 1.0f) * 32767.0f));
+}
+
+static GLbyte PackSnorm8(float value) {
+  return static_cast<GLbyte>(
+    std::round(glm::clamp(value, -1.0f, 1.0f) * 127.0f));
+}
+
+static void PackTexCoord(float value, GLushort* out) {
+  *out = glm::packHalf1x16(value);
+}
+
+static void PackTexCoord(float value, GLfloat* out) {
+  *out = value;
+}
+
+/// Checks if vertex attributes can be specified as half floats.
+static bool IsHalfFloatVertexAttribSupported() {
+#if defined(GL_HALF_FLOAT) && defined(GLEW_VERSION_3_0)
+  return GLEW_VERSION_3_0 || GLEW_ARB_half_float_vertex;
+#else
+  return false;
+#endif
+}
+
+template <typename TexCoord_t>
+/// Uploads the vertices of a mesh in the VertexFormat::Compact layout.
+/** @param quantization - Takes the model coordinates into the [-1, 1] cube. */
+static void UploadCompactVertices(gl::ArrayBuffer& buffer,
+                                  const aiMesh* mesh,
+                                  unsigned char tex_coord_set,
+                                  const glm::mat4& quantization) {
+  std::vector<CompactVertex<TexCoord_t>> vertices(mesh->mNumVertices);
+  bool has_normals = mesh->HasNormals();
+  bool has_tex_coords = mesh->HasTextureCoords(tex_coord_set);
+
+  for (size_t i = 0; i < mesh->mNumVertices; i++) {
+    auto& vertex = vertices[i];
+    const aiVector3D& pos = mesh->mVertices[i];
+    glm::vec3 quantized = glm::vec3(quantization * glm::vec4(pos.x, pos.y, pos.z, 1));
+    for (int j = 0; j < 3; j++) {
+      vertex.position[j] = PackSnorm16(quantized[j]);
+    }
+    vertex.position[3] = 32767;
+
+    glm::vec3 normal;
+    if (has_normals) {
+      const aiVector3D& n = mesh->mNormals[i];
+      normal = glm::normalize(glm::vec3(n.x, n.y, n.z));
+    }
+    for (int j = 0; j < 3; j++) {
+      vertex.normal[j] = PackSnorm8(normal[j]);
+    }
+    vertex.normal[3] = 0;
+
+    glm::vec2 tex_coord;
+    if (has_tex_coords) {
+      const aiVector3D& t = mesh->mTextureCoords[tex_coord_set][i];
+      tex_coord = glm::vec2(t.x, t.y);
+    }
+    PackTexCoord(tex_coord.x, &vertex.tex_coord[0]);
+    PackTexCoord(tex_coord.y, &vertex.tex_coord[1]);
+  }
+
+  buffer.data(vertices);
+}
+
+/// Uploads positions, normals and texture coordinates interleaved into a single buffer.
+/** This replaces the setupPositions, setupNormals, setupTexCoords calls, and
+  * shouldn't be mixed with them. With the compact format, the model matrix
+  * has to be right multiplied with positionTransform().
+  * Calling this function changes the currently active VAO, ArrayBuffer and IndexBuffer.
+  * @param positions - The attribute array for the positions (should be a vec4 in the shader).
+  * @param normals - The attribute array for the normals.
+  * @param tex_coords - The attribute array for the texture coordinates.
+  * @param format - The layout of a vertex in the buffer.
+  * @param tex_coord_set - Specifies the index of the texture coordinate set that should be used */
+void MeshRenderer::setupVertexAttribs(gl::VertexAttrib positions,
+                                      gl::VertexAttrib normals,
+                                      gl::VertexAttrib tex_coords,
+                                      VertexFormat format,
+                                      unsigned char tex_coord_set) {
+  if (is_setup_positions_ || is_setup_normals_ || is_setup_tex_coords_) {
+    std::cerr << "MeshRenderer::setupVertexAttribs is called on an object, "
+                 "that already has vertex attributes set up. It sets up "
+                 "every attribute at once, so it shouldn't be mixed with the "
+                 "setupPositions, setupNormals and setupTexCoords calls, nor "
+                 "should it be called multiple times.";
+    std::terminate();
+  }
+  is_setup_positions_ = is_setup_normals_ = is_setup_tex_coords_ = true;
+
+  bool half_tex_coords = IsHalfFloatVertexAttribSupported();
+  glm::mat4 quantization;
+  if (format == VertexFormat::Compact) {
+    // Every mesh entry is quantized into the same box, so the same model
+    // matrix can be used for all of them.
+    BoundingBox bbox = boundingBox();
+    glm::vec3 half_extent = glm::max(bbox.extent() / 2.0f, glm::vec3(1e-6f));
+    position_transformation_ =
+      glm::scale(glm::translate(glm::mat4(), bbox.center()), half_extent);
+    quantization = glm::inverse(position_transformation_);
+  }
+
+  for (size_t i = 0; i < entries_.size(); i++) {
+    const aiMesh* mesh = scene_->mMeshes[i];
+    entries_[i].material_index = mesh->mMaterialIndex;
+    gl::Bind(entries_[i].vao);
+    gl::Bind(entries_[i].verts);
+
+    if (format == VertexFormat::Float) {
+      std::vector<FloatVertex> vertices(mesh->mNumVertices);
+      bool has_normals = mesh->HasNormals();
+      bool has_tex_coords = mesh->HasTextureCoords(tex_coord_set);
+      for (size_t v = 0; v < mesh->mNumVertices; v++) {
+        const aiVector3D& pos = mesh->mVertices[v];
+        vertices[v].position = glm::vec3(pos.x, pos.y, pos.z);
+        if (has_normals) {
+          const aiVector3D& n = mesh->mNormals[v];
+          vertices[v].normal = glm::vec3(n.x, n.y, n.z);
+        }
+        if (has_tex_coords) {
+          const aiVector3D& t = mesh->mTextureCoords[tex_coord_set][v];
+          vertices[v].tex_coord = glm::vec2(t.x, t.y);
+        }
+      }
+      entries_[i].verts.data(vertices);
+
+      const GLsizei stride = sizeof(FloatVertex);
+      positions.pointer(3, gl::kFloat, false, stride,
+                        (const void*)offsetof(FloatVertex, position)).enable();
+      normals.pointer(3, gl::kFloat, false, stride,
+                      (const void*)offsetof(FloatVertex, normal)).enable();
+      tex_coords.pointer(2, gl::kFloat, false, stride,
+                         (const void*)offsetof(FloatVertex, tex_coord)).enable();
+    } else if (half_tex_coords) {
+    #ifdef GL_HALF_FLOAT
+      typedef CompactVertex<GLushort> Vertex;
+      UploadCompactVertices<GLushort>(entries_[i].verts, mesh,
+                                      tex_coord_set, quantization);
+
+      const GLsizei stride = sizeof(Vertex);
+      positions.pointer(4, gl::DataType::kShort, true, stride,
+                        (const void*)offsetof(Vertex, position)).enable();
+      normals.pointer(3, gl::DataType::kByte, true, stride,
+                      (const void*)offsetof(Vertex, normal)).enable();
+      tex_coords.pointer(2, gl::DataType::kHalfFloat, false, stride,
+                         (const void*)offsetof(Vertex, tex_coord)).enable();
+    #endif
+    } else {
+      typedef CompactVertex<GLfloat> Vertex;
+      UploadCompactVertices<GLfloat>(entries_[i].verts, mesh,
+                                     tex_coord_set, quantization);
+
+      const GLsizei stride = sizeof(Vertex);
+      positions.pointer(4, gl::DataType::kShort, true, stride,
+                        (const void*)offsetof(Vertex, position)).enable();
+      normals.pointer(3, gl::DataType::kByte, true, stride,
+                      (const void*)offsetof(Vertex, normal)).enable();
+      tex_coords.pointer(2, gl::kFloat, false, stride,
+                         (const void*)offsetof(Vertex, tex_coord)).enable();
+    }
+
+    setupIndices(i);
+  }
+
+  gl::Unbind(gl::kArrayBuffer);
+  gl::Unbind(gl::kVertexArray);
+
+  sortEntriesByMaterial();
 }
 
 #if OGLWRAP_USE_IMAGEMAGICK
+/// Returns the path of a material's texture, or an empty string if the
+/// material doesn't have that type of texture.
+static std::string TexturePath(const std::string& mesh_filename,
+                               const aiMaterial* material,
+                               aiTextureType tex_type) {
+  aiString filepath;
+  if (material->GetTexture(tex_type, 0, &filepath) != AI_SUCCESS) {
+    return "";
+  }
+
+  // The path is relative to the mesh file's directory
+  std::string::size_type slash_idx = mesh_filename.find_last_of("/");
+  std::string dir;
+  if (slash_idx == std::string::npos) {
+    dir = "./";
+  } else if (slash_idx == 0) {
+    dir = "/";
+  } else {
+    dir = mesh_filename.substr(0, slash_idx + 1);
+  }
+
+  return dir + filepath.data;
+}
+
+static const char* TextureFormat(bool srgb) {
+  return srgb ? "CSRGBA" : "CRGBA";
+}
+
+void ImportedScene::loadTextures(AsyncLoader* loader, aiTextureType tex_type,
+                                 bool srgb) {
+  if (!textures) {
+    textures =
+      std::make_shared<std::vector<std::shared_ptr<gl::Texture2D>>>();
+  }
+  for (unsigned int i = 0; i < scene->mNumMaterials; ++i) {
+    std::string path = TexturePath(filename, scene->mMaterials[i], tex_type);
+    if (!path.empty()) {
+      TextureCache::LoadAsync(loader, path, TextureFormat(srgb), textures);
+    }
+  }
+}
+
 /**
  * @brief Loads in a specified type of texture for every mesh. If no texture but
  *        a single color is specified, then sets up an 1x1 texture with that
@@ -281,43 +777,28 @@ void MeshRenderer::setupTextures(unsigned short texture_unit,
                                  bool srgb) {
   gl::ActiveTexture(texture_unit);
 
-  materials_[tex_type].active = true;
+  if (!materials_[tex_type].active) {
+    materials_[tex_type].active = true;
+    active_materials_.push_back(&materials_[tex_type]);
+  }
   materials_[tex_type].tex_unit = texture_unit;
 
   if (scene_->mNumMaterials) {
-    // Extract the directory part from the file name
-    std::string::size_type slash_idx = filename_.find_last_of("/");
-    std::string dir;
-
-    if (slash_idx == std::string::npos) {
-      dir = "./";
-    } else if (slash_idx == 0) {
-      dir = "/";
-    } else {
-      dir = filename_.substr(0, slash_idx + 1);
-    }
-
-    // Initialize the materials
+    // Initialize the materials. The textures (and the colors) are shared
+    // with every other mesh that uses the same ones.
+    auto& textures = materials_[tex_type].textures;
+    textures.clear();
     for (unsigned int i = 0; i < scene_->mNumMaterials; ++i) {
       const aiMaterial* mat = scene_->mMaterials[i];
-      materials_[tex_type].textures.push_back(gl::Texture2D{});
-
-      aiString filepath;
-      if (mat->GetTexture(tex_type, 0, &filepath) == AI_SUCCESS) {
-        gl::Bind(materials_[tex_type].textures[i]);
-        materials_[tex_type].textures[i].loadTexture(dir + filepath.data,
-                                                     srgb ? "CSRGBA" : "CRGBA");
-        materials_[tex_type].textures[i].minFilter(gl::kLinear);
-        materials_[tex_type].textures[i].magFilter(gl::kLinear);
+
+      std::string path = TexturePath(filename_, mat, tex_type);
+      if (!path.empty()) {
+        textures.push_back(TextureCache::load(path, TextureFormat(srgb)));
       } else {
         aiColor4D color(0.f, 0.f, 0.f, 1.0f);
         mat->Get(pKey, type, idx, color);
-
-        gl::Bind(materials_[tex_type].textures[i]);
-        materials_[tex_type].textures[i].upload(gl::kRgba32F, 1, 1, gl::kRgba,
-                                                gl::kFloat, &color.r);
-        materials_[tex_type].textures[i].minFilter(gl::kNearest);
-        materials_[tex_type].textures[i].magFilter(gl::kNearest);
+        textures.push_back(TextureCache::color(
+            glm::vec4(color.r, color.g, color.b, color.a)));
       }
     }
   }
@@ -348,35 +829,50 @@ void MeshRenderer::render() {
   if (!is_setup_positions_) {
     return;  // we can't render the mesh, if we don't have any vertex.
   }
-  for (size_t i = 0 ; i < entries_.size(); i++) {
-    gl::Bind(entries_[i].vao);
-
-    const size_t material_index = entries_[i].material_index;
 
-    if (textures_enabled_) {
-      for (auto iter = materials_.begin(); iter != materials_.end(); iter++) {
-        auto& material = iter->second;
-        if (material.active == true && material_index < scene_->mNumMaterials) {
-          gl::ActiveTexture(material.tex_unit);
-        }
-        gl::Bind(material.textures[material_index]);
-      }
-    }
+  renderEntries([this](size_t idx) -> const gl::VertexArray& {
+    return entries_[idx].vao;
+  });
+}
 
-    gl::DrawElements(gl::kTriangles, entries_[i].idx_count, entries_[i].idx_type);
+/// Sorts the entries by their materials, into render_order_.
+void MeshRenderer::sortEntriesByMaterial() {
+  render_order_.resize(entries_.size());
+  for (size_t i = 0; i < entries_.size(); i++) {
+    render_order_[i] = i;
+  }
+  std::stable_sort(render_order_.begin(), render_order_.end(),
+                   [this](size_t a, size_t b) {
+    return entries_[a].material_index < entries_[b].material_index;
+  });
+}
 
-    if (textures_enabled_) {
-      for (auto iter = materials_.begin(); iter != materials_.end(); iter++) {
-        auto& material = iter->second;
-        if (material.active == true && material_index < scene_->mNumMaterials) {
-          gl::ActiveTexture(material.tex_unit);
-        }
-        gl::Unbind(material.textures[material_index]);
-      }
+/// Binds the textures of a material to their texture units.
+void MeshRenderer::bindMaterial(unsigned material_index) {
+  for (MaterialInfo* material : active_materials_) {
+    if (material_index < material->textures.size()) {
+      GlState::BindTexture(material->tex_unit,
+                           *material->textures[material_index]);
     }
   }
+}
 
-  gl::Unbind(gl::kVertexArray);
+/// Draws a mesh entry, using the currently bound VAO and textures.
+void MeshRenderer::drawEntry(size_t idx, GLsizei instance_count) {
+  const MeshEntry::Lod& lod = entries_[idx].lods[lod_];
+  size_t index_size = entries_[idx].idx_type == gl::kUnsignedShort ?
+                      sizeof(GLushort) : sizeof(GLuint);
+  const void* offset = (const void*)(lod.first * index_size);
+
+  if (instance_count == 1) {
+    gl::DrawElements(gl::kTriangles, lod.count,
+                     entries_[idx].idx_type, offset);
+  } else {
+  #ifdef glDrawElementsInstanced
+    gl::DrawElementsInstanced(gl::kTriangles, lod.count,
+                              entries_[idx].idx_type, instance_count, offset);
+  #endif
+  }
 }
 
 /// The transformation that takes the model's world coordinates to the OpenGL style world coordinates.
@@ -387,42 +883,22 @@ glm::mat4 MeshRenderer::worldTransform() const {
   return world_transformation_;
 }
 
+/// Returns the transformation that takes the uploaded positions to the model's coordinates.
+glm::mat4 MeshRenderer::positionTransform() const {
+  return position_transformation_;
+}
+
 /// Gives information about the mesh's bounding cuboid.
 BoundingBox MeshRenderer::boundingBox(const glm::mat4& matrix) const {
-  float zero = 0.0f;  // This is needed to bypass a visual c++ compile error
-  float infty = 1.0f / zero;
-  glm::vec3 mins{infty, infty, infty}, maxes{-infty, -infty, -infty};
-  for (size_t entry = 0; entry < entries_.size(); entry++) {
-    const aiMesh* mesh = scene_->mMeshes[entry];
-
-    for (size_t i = 0; i < mesh->mNumVertices; i++) {
-      glm::vec4 vert {mesh->mVertices[i].x, mesh->mVertices[i].y,
-                      mesh->mVertices[i].z, 1};
-      vert = matrix * vert;
-
-      if (vert.x < mins.x) {
-        mins.x = vert.x;
-      }
-      if (vert.y < mins.y) {
-        mins.y = vert.y;
-      }
-      if (vert.z < mins.z) {
-        mins.z = vert.z;
-      }
-
-      if (maxes.x < vert.x) {
-        maxes.x = vert.x;
-      }
-      if (maxes.y < vert.y) {
-        maxes.y = vert.y;
-      }
-      if (maxes.z < vert.z) {
-        maxes.z = vert.z;
-      }
-    }
-  }
-
-  return BoundingBox{mins, maxes};
+  // The transformed box's half extent is the sum of the absolute values of
+  // the transformed half axes (Arvo's method).
+  glm::vec3 center = glm::vec3(matrix * glm::vec4(bbox_.center(), 1));
+  glm::mat3 abs_matrix{glm::abs(glm::vec3(matrix[0])),
+                       glm::abs(glm::vec3(matrix[1])),
+                       glm::abs(glm::vec3(matrix[2]))};
+  glm::vec3 half_extent = abs_matrix * (bbox_.extent() / 2.0f);
+
+  return BoundingBox{center - half_extent, center + half_extent};
 }
 
 glm::vec4 MeshRenderer::bSphere(const BoundingBox& bbox) const {
@@ -438,12 +914,12 @@ glm::vec4 MeshRenderer::bSphere(const glm::mat4& model_matrix) const {
 
 /// Returns the center of the bounding sphere.
 glm::vec3 MeshRenderer::bSphereCenter() const {
-  return boundingBox().center();
+  return bbox_.center();
 }
 
 /// Returns the radius of the bounding sphere.
 float MeshRenderer::bSphereRadius() const {
-  glm::vec3 extent = boundingBox().extent();
+  glm::vec3 extent = bbox_.extent();
   return sqrt(glm::dot(extent, extent)) / 2;  // Pythagoras.
 }
 
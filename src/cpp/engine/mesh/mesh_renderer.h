@@ -5,6 +5,9 @@
 
 #include <map>
 #include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
 #include <climits>
 #include <btBulletDynamicsCommon.h>
 
@@ -16,9 +19,64 @@
 
 #include "../assimp.h"
 #include "../collision/bounding_box.h"
+#include "./mesh_lods.h"
 
 namespace engine {
 
+class AsyncLoader;
+
+/// The vertex layouts that MeshRenderer::setupVertexAttribs can upload.
+enum class VertexFormat {
+  /// 32 bytes per vertex: float positions, normals and texture coordinates.
+  Float,
+  /// 16 bytes per vertex: snorm16 positions relative to the mesh's bounding
+  /// box (see MeshRenderer::positionTransform()), snorm8 normals and half float
+  /// texture coordinates. Without half float vertex attribute support, the
+  /// texture coordinates stay floats (20 bytes per vertex).
+  Compact
+};
+
+/// A scene imported by assimp, that isn't uploaded to OpenGL yet.
+/** Importing is the slow part of loading a mesh, and it doesn't use OpenGL,
+  * so it can be done on a worker thread (see AsyncLoader). The MeshRenderer
+  * can be created from the result on the main thread. */
+struct ImportedScene {
+  /// The assimp importer. The scene actually belongs to this.
+  std::unique_ptr<Assimp::Importer> importer;
+  const aiScene* scene;
+  std::string filename;
+  /// The post-process flags, including the ones MeshRenderer always adds.
+  unsigned flags;
+
+  /// The levels of detail, if generateLods() was called.
+  std::unique_ptr<MeshLods> lods;
+
+  /// The textures loaded by loadTextures(). The MeshRenderer keeps them
+  /// alive, so its setupTextures() gets them from the TextureCache.
+  std::shared_ptr<std::vector<std::shared_ptr<gl::Texture2D>>> textures;
+
+  /// Imports a scene, and does some post-processing on it. Throws on failure.
+  /** The triangulation and the vertex cache optimizations are always done.
+    * It is thread safe (every scene has its own importer).
+    * @param filename - The name of the file to load in.
+    * @param flags - The assimp post-process flags. */
+  static ImportedScene Import(const std::string& filename,
+                              gl::Bitfield<aiPostProcessSteps> flags);
+
+  /// Generates the levels of detail for MeshRenderer::setupLods().
+  /** It doesn't use OpenGL, so it can be called on a worker thread. */
+  void generateLods(unsigned lod_count = 4);
+
+#if OGLWRAP_USE_IMAGEMAGICK
+  /// Starts loading the textures for MeshRenderer::setupTextures().
+  /** The images are decoded on worker threads, and uploaded by the loader's
+    * main thread tasks. It can be called from any thread.
+    * @param tex_type - The type of the textures, for ex aiTextureType_DIFFUSE.
+    * @param srgb - Should match the one given to setupTextures(). */
+  void loadTextures(AsyncLoader* loader, aiTextureType tex_type, bool srgb);
+#endif
+};
+
 /// A class that can load in and draw meshes using assimp.
 class MeshRenderer {
  protected:
@@ -30,15 +88,22 @@ class MeshRenderer {
     gl::VertexArray vao;
     gl::ArrayBuffer verts, normals, tex_coords;
     gl::IndexBuffer indices;
-    unsigned idx_count, material_index;
+    unsigned material_index;
     static const unsigned kInvalidMaterial = unsigned(-1);
     gl::IndexType idx_type;
 
+    /// The place of a level of detail in the index buffer.
+    struct Lod {
+      unsigned first, count;
+    };
+    /// The levels of detail, the 0th is the original mesh.
+    std::vector<Lod> lods;
+
     MeshEntry() : material_index(kInvalidMaterial) {}
   };
 
   /// The assimp importer. The scene actually belongs to this.
-  Assimp::Importer importer_;
+  std::unique_ptr<Assimp::Importer> importer_;
 
   /// A pointer to the scene stored by the importer. But this is the working interface for it.
   const aiScene* scene_;
@@ -46,17 +111,26 @@ class MeshRenderer {
   /// The name of the file loaded in. It is stored to be able to print it out if an error happens.
   std::string filename_;
 
+  /// The assimp post-process flags the scene was imported with.
+  unsigned import_flags_;
+
   /// The vao-s and buffers per mesh.
   std::vector<MeshEntry> entries_;
 
   /// The transformation that takes the model's world coordinates to the OpenGL style world coordinates.
   glm::mat4 world_transformation_;
 
+  /// The bounding box of every vertex, in the model's coordinates.
+  BoundingBox bbox_;
+
+  /// The transformation that takes the uploaded (maybe quantized) positions to the model's coordinates.
+  glm::mat4 position_transformation_;
+
   /// A struct containin the state and data of a material type.
   struct MaterialInfo {
     bool active;
     int tex_unit;
-    std::vector<gl::Texture2D> textures;
+    std::vector<std::shared_ptr<gl::Texture2D>> textures;
 
     MaterialInfo() : active(false), tex_unit(0) {}
   };
@@ -64,6 +138,26 @@ class MeshRenderer {
   /// The materials.
   std::map<aiTextureType, MaterialInfo> materials_;
 
+  /// The active materials, so rendering doesn't have to iterate the map.
+  std::vector<MaterialInfo*> active_materials_;
+
+  /// The indices of the entries, sorted by their materials.
+  std::vector<size_t> render_order_;
+
+  /// The simplified levels of detail, if setupLods was called.
+  std::unique_ptr<MeshLods> lods_;
+
+  /// The levels generated by ImportedScene::generateLods(), setupLods()
+  /// uses them instead of generating new ones.
+  std::unique_ptr<MeshLods> imported_lods_;
+
+  /// The textures loaded by ImportedScene::loadTextures().
+  std::shared_ptr<std::vector<std::shared_ptr<gl::Texture2D>>>
+      imported_textures_;
+
+  /// The level of detail used by the render calls.
+  unsigned lod_;
+
   /// Stores if the setupPositions function is called (they shouldn't be called more than once).
   bool is_setup_positions_;
   /// Stores if the setupNormals function is called (they shouldn't be called more than once).
@@ -73,6 +167,29 @@ class MeshRenderer {
   /// Textures can be disabled, and not used for rendering
   bool textures_enabled_;
 
+  /// Sorts the entries by their materials, into render_order_.
+  void sortEntriesByMaterial();
+
+  /// Binds the textures of a material to their texture units.
+  /** They are left bound, so that the next mesh that uses the same textures
+    * doesn't have to bind them again. */
+  void bindMaterial(unsigned material_index);
+
+  /// Draws a mesh entry, using the currently bound VAO and textures.
+  /** @param idx - The index of the entry.
+    * @param instance_count - If it's not 1, the entry is drawn with instanced
+    *                         rendering. */
+  void drawEntry(size_t idx, GLsizei instance_count);
+
+  template <typename VaoOf>
+  /// Renders every entry with its materials, in the order of the materials.
+  /** The textures are only bound when the material changes, and they are
+    * only unbound after the last entry.
+    * @param vao_of - Returns the VAO of an entry, from the entry's index.
+    * @param instance_count - If it's not 1, the entries are drawn with
+    *                         instanced rendering. */
+  void renderEntries(VaoOf vao_of, GLsizei instance_count = 1);
+
   /// It shouldn't be copyable.
   MeshRenderer(const MeshRenderer& src) = delete;
   /// It shouldn't be copyable.
@@ -80,11 +197,15 @@ class MeshRenderer {
 
 public:
   /// Loads in the mesh from a file, and does some post-processing on it.
-  /** @param filename - The name of the file to load in.
+  /** The triangulation and the vertex cache optimizations are always done.
+    * @param filename - The name of the file to load in.
     * @param flags - The assimp post-process flags. */
   MeshRenderer(const std::string& filename,
                gl::Bitfield<aiPostProcessSteps> flags);
 
+  /// Creates the mesh from an already imported scene.
+  explicit MeshRenderer(ImportedScene imported);
+
   template <typename IdxType>
   /// Returns a vector of the indices
   std::vector<IdxType> indices();
@@ -92,6 +213,28 @@ public:
   /// Returns a vector of the vertices
   std::vector<float> vertices();
 
+  /// Generates simplified levels of detail for the meshes.
+  /** Every level has about half as many triangles as the previous one, and
+    * they all use the original vertices, so this works with every vertex
+    * setup. The levels are cached next to the mesh file. If the indices are
+    * already set up, they are uploaded again.
+    * @param lod_count - The number of levels, including the original one. */
+  void setupLods(unsigned lod_count = 4);
+
+  /// Returns the number of the levels of detail (1 without setupLods).
+  unsigned lodCount() const { return lods_ ? lods_->lod_count() : 1; }
+
+  /// Returns the level of detail used by the render calls.
+  unsigned lod() const { return lod_; }
+
+  /// Sets the level of detail used by the render calls (0 is the most detailed).
+  void setLod(unsigned lod) { lod_ = std::min(lod, lodCount() - 1); }
+
+  /// Selects the level of detail from the size of the mesh on the screen.
+  /** @param screen_size - The projected radius of the bounding sphere,
+    *                      relative to the half of the screen's height. */
+  void selectLod(float screen_size);
+
   /// Sets up a btTriangleIndexVertexArray, and returns a vector of indices
   /// that should be stored throughout the lifetime of the bullet object
   std::vector<int> btTriangles(btTriangleIndexVertexArray* triangles);
@@ -103,6 +246,11 @@ private:
     * @param index - The index of the entry */
   void setIndices(size_t index);
 
+  /// Uploads the indices of an entry, using the smallest possible index type.
+  /** This expects the correct vao to be already bound!
+    * @param index - The index of the entry */
+  void setupIndices(size_t index);
+
 public:
   /// Loads in vertex positions and indices, and uploads the former into an attribute array.
   /** Uploads the vertex positions data to an attribute array, and sets it up for use.
@@ -133,6 +281,22 @@ public:
   void setupTexCoords(gl::VertexAttrib attrib,
                       unsigned char tex_coord_set = 0);
 
+  /// Uploads positions, normals and texture coordinates interleaved into a single buffer.
+  /** This replaces the setupPositions, setupNormals, setupTexCoords calls, and
+    * shouldn't be mixed with them. With the compact format, the model matrix
+    * has to be right multiplied with positionTransform().
+    * Calling this function changes the currently active VAO, ArrayBuffer and IndexBuffer.
+    * @param positions - The attribute array for the positions (should be a vec4 in the shader).
+    * @param normals - The attribute array for the normals.
+    * @param tex_coords - The attribute array for the texture coordinates.
+    * @param format - The layout of a vertex in the buffer.
+    * @param tex_coord_set - Specifies the index of the texture coordinate set that should be used */
+  void setupVertexAttribs(gl::VertexAttrib positions,
+                          gl::VertexAttrib normals,
+                          gl::VertexAttrib tex_coords,
+                          VertexFormat format = VertexFormat::Compact,
+                          unsigned char tex_coord_set = 0);
+
   /**
    * @brief Loads in a specified type of texture for every mesh. If no texture
    *        but a single color is specified, then sets up an 1x1 texture with
@@ -170,6 +334,9 @@ public:
   void render();
 
   /// Gives information about the mesh's bounding cuboid.
+  /** The box is calculated once at load time, the transformed box is the
+    * bounding box of the transformed original box (so it can be a bit
+    * bigger than the bounding box of the transformed vertices). */
   BoundingBox boundingBox(const glm::mat4& matrix = glm::mat4{}) const;
 
   /// Returns the transformation that takes the model's world coordinates to the OpenGL style world coordinates.
@@ -178,6 +345,12 @@ public:
     * model matrix with this matrix will solve that problem. */
   glm::mat4 worldTransform() const;
 
+  /// Returns the transformation that takes the uploaded positions to the model's coordinates.
+  /** It is identity, unless the positions are quantized with VertexFormat::Compact,
+    * in which case the model matrix has to be right multiplied with it (but the
+    * normal matrix must not). */
+  glm::mat4 positionTransform() const;
+
   /// Returns the bounding sphere from the bounding box
   glm::vec4 bSphere(const BoundingBox& bbox) const;
 
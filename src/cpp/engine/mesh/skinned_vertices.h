@@ -0,0 +1,43 @@
+// Copyright (c) 2014, Tamas Csala
+
+#ifndef ENGINE_MESH_SKINNED_VERTICES_H_
+#define ENGINE_MESH_SKINNED_VERTICES_H_
+
+#include <vector>
+
+#include "../oglwrap_config.h"
+#include "../../oglwrap/buffer.h"
+#include "../../oglwrap/vertex_attrib.h"
+
+namespace engine {
+
+/// The pre-skinned vertices of an animated instance.
+/** An AnimatedMeshRenderer skins the vertices into these buffers once per
+  * frame with transform feedback, and every pass that draws the instance
+  * (like the shadow and the main pass) uses them as a static mesh. */
+class SkinnedVertices {
+  /// The per mesh buffers.
+  struct Entry {
+    /// Draws the skinned buffer, with the tex coords and the indices of
+    /// the AnimatedMeshRenderer.
+    gl::VertexArray vao;
+
+    /// The interleaved skinned positions and normals.
+    gl::ArrayBuffer buffer;
+
+    /// The number of vertices in the buffer.
+    size_t vertex_count;
+  };
+
+  std::vector<Entry> entries_;
+
+  friend class AnimatedMeshRenderer;
+
+ public:
+  /// Returns if setupSkinnedVertices was called with this object.
+  bool is_setup() const { return !entries_.empty(); }
+};
+
+}  // namespace engine
+
+#endif
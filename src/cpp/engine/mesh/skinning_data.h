@@ -5,12 +5,38 @@
 
 #include <map>
 #include <string>
+#include <algorithm>
 #include <vector>
 #include <memory>
 #include "./mesh_renderer.h"
 
 namespace engine {
 
+/// The local transformations of every node of a skeleton.
+/** Stored as a structure of arrays, indexed the same way as
+  * SkinningData::nodes. */
+struct LocalPose {
+  std::vector<glm::vec3> translations;
+  std::vector<glm::quat> rotations;
+  std::vector<glm::vec3> scales;
+};
+
+/// The ways the vertex shader can blend the bones' transformations.
+enum class SkinningMode {
+  /// Blends the affine matrices. A bone takes 3 vec4s in the palette.
+  Linear,
+  /// Blends unit dual quaternions. A bone takes 2 vec4s in the palette, and
+  /// the joints don't collapse when they are twisted, but it ignores the
+  /// scaling of the bones. Needs DUAL_QUATERNION_SKINNING defined to 1 in the
+  /// vertex shader.
+  DualQuaternion
+};
+
+/// Returns the number of vec4s a bone takes in the palette.
+inline size_t PaletteVectorsPerBone(SkinningMode mode) {
+  return mode == SkinningMode::DualQuaternion ? 2 : 3;
+}
+
 struct SkinningData {
   template<typename Index_t>
   /**
@@ -18,11 +44,13 @@ struct SkinningData {
    *        bone weights.
    *
    * The boneIDs part is not fixed to be int (unsigned), it becomes the
-   * smallest type that can store all the ids of the bones.
+   * smallest type that can store all the ids of the bones. The weights are
+   * stored as normalized unsigned bytes, so with less than 256 bones, an
+   * attribute set is only 8 bytes.
    */
   struct VertexBoneData_PerAttribute {
     Index_t ids[4];
-    float weights[4];
+    GLubyte weights[4];
 
     VertexBoneData_PerAttribute() {
       memset(ids, 0, sizeof(ids));
@@ -31,35 +59,95 @@ struct SkinningData {
   };
 
   template<class Index_t>
-  /// Contains an array of VertexBoneData_PerAttribute.
-  /** The size of that vector varies per vertex. */
+  /// Collects the bones influencing a vertex.
   struct VertexBoneData {
-    std::vector<VertexBoneData_PerAttribute<Index_t>> data;
+    struct Influence {
+      Index_t id;
+      float weight;
+    };
+    std::vector<Influence> influences;
 
     void AddBoneData(Index_t boneID, float weight) {
-      do {
-        for (size_t i = 0; i < data.size(); i++) {
-          for (int j = 0; j < 4; j++) {
-            if (data[i].weights[j] < 1e-10) {  // if equals 0
-              data[i].ids[j] = boneID;
-              data[i].weights[j] = weight;
-              return;
-            }
-          }
-        }
-
-        // If there isn't enough space yet, then make some new
-        data.push_back(VertexBoneData_PerAttribute<Index_t>());
-
-      // Bone attributes shouldn't use up all the 16 attribute slots.
-      // Knowing the positions of the vertices could be useful for
-      // rendering too.
-      } while (data.size() < 8);
+      if (weight > 0) {
+        influences.push_back(Influence{boneID, weight});
+      }
+    }
+
+    /// Sorts the influences by weight, and drops all but the strongest ones.
+    void KeepStrongest(size_t max_influences) {
+      auto stronger = [](const Influence& a, const Influence& b) {
+        return a.weight > b.weight;
+      };
+      if (influences.size() > max_influences) {
+        std::partial_sort(influences.begin(),
+                          influences.begin() + max_influences,
+                          influences.end(), stronger);
+        influences.resize(max_influences);
+      } else {
+        std::sort(influences.begin(), influences.end(), stronger);
+      }
+    }
+
+    /**
+     * @brief Renormalizes the weights, and packs them into attribute sets.
+     *
+     * The quantized weights always add up to exactly 1, so the vertices
+     * don't move, even if a lot of small influences were dropped.
+     *
+     * @param out          The attribute sets to write.
+     * @param attrib_num   The number of attribute sets, the unused ones are
+     *                     zeroed out.
+     */
+    void Pack(VertexBoneData_PerAttribute<Index_t>* out,
+              size_t attrib_num) const {
+      for (size_t i = 0; i < attrib_num; i++) {
+        out[i] = VertexBoneData_PerAttribute<Index_t>();
+      }
+      if (influences.empty()) {
+        return;
+      }
+
+      float sum = 0;
+      for (const Influence& influence : influences) {
+        sum += influence.weight;
+      }
+
+      int remaining = 255;
+      for (size_t i = 0; i < influences.size(); i++) {
+        int weight = static_cast<int>(influences[i].weight / sum * 255 + 0.5f);
+        weight = std::min(weight, remaining);
+        remaining -= weight;
+        out[i / 4].ids[i % 4] = influences[i].id;
+        out[i / 4].weights[i % 4] = weight;
+      }
+      // The rounding error goes to the strongest influence.
+      out[0].weights[0] += remaining;
     }
   };
 
+  /// Per node data of the skeleton.
+  struct NodeInfo {
+    /// The index of the parent node, or -1 for the root node.
+    int parent;
+
+    /// The index of the bone that belongs to this node, or -1 if it isn't
+    /// a bone.
+    int bone_idx;
+
+    /// The number of nodes in this node's subtree, including itself.
+    /** The first child of a node is the next node, and its next sibling comes
+      * after the child's subtree. */
+    unsigned subtree_size;
+
+    /// The number of levels of nodes below this one, 0 for the leaves.
+    unsigned height;
+  };
+
   /// A structure for storing the default, relative-to-parent,
   /// and current transformations.
+  /** The current transformations of the animated instances are stored in
+    * their Animation objects, final_transform is only used by the external
+    * bones, as they are shared by all the instances. */
   struct BoneInfo {
     glm::mat4 bone_offset;
     glm::mat4 final_transform;
@@ -82,6 +170,14 @@ struct SkinningData {
     * multiplies, is to reference them by their name */
   std::map<std::string, unsigned> bone_mapping;
 
+  /// The nodes of the skeleton, in depth-first pre-order.
+  /** The per frame animation uses these instead of the name based lookups. */
+  std::vector<NodeInfo> nodes;
+
+  /// The transformations of the nodes in their parents' space, when they
+  /// aren't animated.
+  LocalPose default_pose;
+
   /// The number of the bones.
   size_t num_bones;
 
@@ -92,6 +188,9 @@ struct SkinningData {
   /// The maximum of per mesh bone attribute number's maximum per mesh.
   std::vector<unsigned char> per_mesh_attrib_max;
 
+  /// The maximum number of bones that can influence a vertex.
+  unsigned max_bone_influences;
+
   /// Stores if setupBones is called. It shouldn't be called more than once.
   bool is_setup_bones;
 
@@ -99,11 +198,22 @@ struct SkinningData {
   /// It is need to get the offsets.
   std::string root_bone;
 
-  explicit SkinningData(size_t num_meshes = 0)
+  /// The index of the root bone's node, or -1 if it isn't known yet.
+  int root_bone_node;
+
+  /// The format of the bone palette.
+  SkinningMode skinning_mode;
+
+  explicit SkinningData(size_t num_meshes = 0,
+                        unsigned max_bone_influences = 4,
+                        SkinningMode skinning_mode = SkinningMode::Linear)
     : vertex_bone_data_buffers(num_meshes)
     , num_bones(0)
     , max_bone_attrib_num(0)
+    , max_bone_influences(max_bone_influences)
     , is_setup_bones(false)
+    , root_bone_node(-1)
+    , skinning_mode(skinning_mode)
   { }
 };
 
@@ -4,6 +4,8 @@
 #define ENGINE_MISC_H
 
 #include <memory>
+#include <string>
+#include <sys/stat.h>
 
 namespace engine {
 
@@ -22,6 +24,19 @@ T sqr(const T& x) {
   return x*x;
 }
 
+/// Returns true if the file exists, and it was modified after the other one.
+/** Used to check if a cache file is still up to date. */
+inline bool IsNewer(const std::string& filename, const std::string& other) {
+  struct stat file_stat, other_stat;
+  if (stat(filename.c_str(), &file_stat) != 0) {
+    return false;
+  }
+  if (stat(other.c_str(), &other_stat) != 0) {
+    return true;
+  }
+  return file_stat.st_mtime >= other_stat.st_mtime;
+}
+
 }  // namespace engine
 
 #endif
@@ -0,0 +1,28 @@
+// Copyright (c) 2014, Tamas Csala
+
+#ifndef ENGINE_PHYSICS_CONTACT_H_
+#define ENGINE_PHYSICS_CONTACT_H_
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+namespace engine {
+
+class GameObject;
+
+// A contact between two bodies in the last physics step, as seen by one of
+// them. There is one contact per touching pair, not per contact point.
+struct Contact {
+  // The owner of the other body, might be nullptr
+  const GameObject* other;
+  // The world space position of the contact point with the largest impulse
+  glm::vec3 point;
+  // The contact normal, pointing towards the receiver
+  glm::vec3 normal;
+  // The sum of the impulses applied on the contact points in the last step
+  float impulse;
+};
+
+}  // namespace engine
+
+#endif
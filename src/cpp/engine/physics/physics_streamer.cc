@@ -0,0 +1,220 @@
+// Copyright (c) 2014, Tamas Csala
+
+#include "./physics_streamer.h"
+
+#include <set>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <BulletCollision/CollisionShapes/btHeightfieldTerrainShape.h>
+
+#include "../misc.h"
+#include "../scene.h"
+
+namespace engine {
+
+// A part of a heightmap, that owns its height data and its shape.
+class HeightFieldChunk : public btCollisionObject {
+ public:
+  // w and h are the number of samples (not the number of quads)
+  HeightFieldChunk(const HeightMapInterface& height_map,
+                   int x0, int z0, int w, int h, void* user_pointer)
+      : data_(w*h) {
+    float min = std::numeric_limits<float>::max();
+    float max = std::numeric_limits<float>::lowest();
+    for (int z = 0; z < h; ++z) {
+      for (int x = 0; x < w; ++x) {
+        float height = height_map.heightAt(x0 + x, z0 + z);
+        data_[z*w + x] = height;
+        min = std::min(min, height);
+        max = std::max(max, height);
+      }
+    }
+    // bullet doesn't like flat heightfields
+    if (max <= min) { max = min + 1.0f; }
+
+    shape_ = make_unique<btHeightfieldTerrainShape>(
+        w, h, data_.data(), 1, min, max, 1, PHY_FLOAT, true);
+    setCollisionShape(shape_.get());
+
+    // bullet puts the heightfield's center to the origin
+    btTransform t;
+    t.setIdentity();
+    t.setOrigin(btVector3{x0 + (w-1)/2.0f, (min+max)/2.0f, z0 + (h-1)/2.0f});
+    setWorldTransform(t);
+    setRestitution(1.0f);
+    setUserPointer(user_pointer);
+  }
+
+ private:
+  std::vector<float> data_;
+  std::unique_ptr<btHeightfieldTerrainShape> shape_;
+};
+
+// Squared distance between a point and a bounding box on the xz plane
+static float SqrDistanceXZ(const BoundingBox& bbox, const glm::vec2& point) {
+  glm::vec2 mins{bbox.mins().x, bbox.mins().z};
+  glm::vec2 maxes{bbox.maxes().x, bbox.maxes().z};
+  glm::vec2 diff = point - glm::clamp(point, mins, maxes);
+  return glm::dot(diff, diff);
+}
+
+PhysicsStreamer::PhysicsStreamer(GameObject* parent, float radius,
+                                 float cell_size)
+    : GameObject(parent), radius_(radius), cell_size_(cell_size), frame_(0) {}
+
+PhysicsStreamer::~PhysicsStreamer() {
+  for (size_t idx : loaded_) {
+    unload(colliders_[idx]);
+  }
+}
+
+void PhysicsStreamer::addStaticCollider(btCollisionObject* collider,
+                                        const BoundingBox& bbox) {
+  addCollider(Collider{bbox, collider, nullptr, nullptr, false, 0});
+}
+
+void PhysicsStreamer::addStreamedCollider(ColliderFactory factory,
+                                          const BoundingBox& bbox) {
+  addCollider(Collider{bbox, nullptr, nullptr, factory, false, 0});
+}
+
+void PhysicsStreamer::addHeightField(const HeightMapInterface& height_map,
+                                     void* user_pointer, int chunk_size) {
+  int w = height_map.w(), h = height_map.h();
+  // neighbouring chunks share their border samples
+  for (int x0 = 0; x0 < w - 1; x0 += chunk_size) {
+    for (int z0 = 0; z0 < h - 1; z0 += chunk_size) {
+      int chunk_w = std::min(chunk_size, w - 1 - x0) + 1;
+      int chunk_h = std::min(chunk_size, h - 1 - z0) + 1;
+      // only the xz extent of the bbox is used
+      BoundingBox bbox{glm::vec3(x0, 0, z0),
+                       glm::vec3(x0 + chunk_w - 1, 255, z0 + chunk_h - 1)};
+      const HeightMapInterface* hmap = &height_map;
+      addStreamedCollider([=]() -> std::unique_ptr<btCollisionObject> {
+        return make_unique<HeightFieldChunk>(*hmap, x0, z0, chunk_w,
+                                             chunk_h, user_pointer);
+      }, bbox);
+    }
+  }
+}
+
+PhysicsStreamer::Cell PhysicsStreamer::cellAt(const glm::vec3& pos) const {
+  return Cell{static_cast<int>(std::floor(pos.x / cell_size_)),
+              static_cast<int>(std::floor(pos.z / cell_size_))};
+}
+
+void PhysicsStreamer::addCollider(Collider&& collider) {
+  size_t idx = colliders_.size();
+  Cell mins = cellAt(collider.bbox.mins());
+  Cell maxes = cellAt(collider.bbox.maxes());
+  for (int x = mins.first; x <= maxes.first; ++x) {
+    for (int z = mins.second; z <= maxes.second; ++z) {
+      cells_[Cell{x, z}].push_back(idx);
+    }
+  }
+  colliders_.push_back(std::move(collider));
+}
+
+void PhysicsStreamer::markCollidersAround(const glm::vec3& center,
+                                          float radius) {
+  float keep_radius = 1.25f * radius;
+  glm::vec2 center_xz{center.x, center.z};
+  glm::vec3 offset{keep_radius, 0, keep_radius};
+  Cell mins = cellAt(center - offset), maxes = cellAt(center + offset);
+
+  for (int x = mins.first; x <= maxes.first; ++x) {
+    for (int z = mins.second; z <= maxes.second; ++z) {
+      auto iter = cells_.find(Cell{x, z});
+      if (iter == cells_.end()) { continue; }
+
+      for (size_t idx : iter->second) {
+        Collider& collider = colliders_[idx];
+        if (collider.loaded && collider.last_needed == frame_) { continue; }
+
+        float sqr_dist = SqrDistanceXZ(collider.bbox, center_xz);
+        if (sqr_dist <= sqr(keep_radius)) {
+          collider.last_needed = frame_;
+          if (!collider.loaded && sqr_dist <= sqr(radius)) {
+            load(collider);
+            loaded_.push_back(idx);
+          }
+        }
+      }
+    }
+  }
+}
+
+void PhysicsStreamer::load(Collider& collider) {
+  if (collider.factory) {
+    collider.owned_object = collider.factory();
+    collider.object = collider.owned_object.get();
+  }
+  scene_->world()->addCollisionObject(
+      collider.object, btBroadphaseProxy::StaticFilter,
+      btBroadphaseProxy::AllFilter ^ btBroadphaseProxy::StaticFilter);
+  collider.loaded = true;
+}
+
+void PhysicsStreamer::unload(Collider& collider) {
+  scene_->world()->removeCollisionObject(collider.object);
+  if (collider.factory) {
+    collider.owned_object.reset();
+    collider.object = nullptr;
+  }
+  collider.loaded = false;
+}
+
+void PhysicsStreamer::update() {
+  btDynamicsWorld* world = scene_->world();
+  if (!world) { return; }
+  ++frame_;
+
+  // Bodies in the same cell would query the same colliders, so only the
+  // cells of the bodies are used, not the bodies themselves.
+  std::set<Cell> active_cells, resting_cells;
+  if (scene_->camera()) {
+    active_cells.insert(cellAt(scene_->camera()->transform()->pos()));
+  }
+
+  const btCollisionObjectArray& objects = world->getCollisionObjectArray();
+  for (int i = 0; i < objects.size(); ++i) {
+    const btCollisionObject* object = objects[i];
+    if (object->isStaticOrKinematicObject()) { continue; }
+
+    const btVector3& o = object->getWorldTransform().getOrigin();
+    Cell cell = cellAt(glm::vec3(o.x(), o.y(), o.z()));
+    // A sleeping body only needs the colliders it is resting on
+    if (object->isActive()) {
+      active_cells.insert(cell);
+    } else {
+      resting_cells.insert(cell);
+    }
+  }
+
+  float half_diagonal = cell_size_ * std::sqrt(0.5f);
+  for (const Cell& cell : active_cells) {
+    glm::vec3 center = cell_size_ * glm::vec3(cell.first + 0.5f, 0,
+                                              cell.second + 0.5f);
+    markCollidersAround(center, radius_ + half_diagonal);
+  }
+  for (const Cell& cell : resting_cells) {
+    if (active_cells.count(cell)) { continue; }
+    glm::vec3 center = cell_size_ * glm::vec3(cell.first + 0.5f, 0,
+                                              cell.second + 0.5f);
+    markCollidersAround(center, half_diagonal);
+  }
+
+  for (size_t i = 0; i < loaded_.size();) {
+    Collider& collider = colliders_[loaded_[i]];
+    if (collider.last_needed != frame_) {
+      unload(collider);
+      loaded_[i] = loaded_.back();
+      loaded_.pop_back();
+    } else {
+      ++i;
+    }
+  }
+}
+
+}  // namespace engine
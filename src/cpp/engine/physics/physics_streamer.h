@@ -0,0 +1,77 @@
+// Copyright (c) 2014, Tamas Csala
+
+#ifndef ENGINE_PHYSICS_PHYSICS_STREAMER_H_
+#define ENGINE_PHYSICS_PHYSICS_STREAMER_H_
+
+#include <map>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <btBulletDynamicsCommon.h>
+
+#include "../game_object.h"
+#include "../height_map_interface.h"
+#include "../collision/bounding_box.h"
+
+namespace engine {
+
+// Keeps only those static colliders in the physics world, that are near to an
+// active dynamic body or to the camera. Everything else is removed from the
+// broadphase (and generated colliders are freed), so the physics' cost scales
+// with the active area, and not with the size of the world.
+class PhysicsStreamer : public GameObject {
+ public:
+  using ColliderFactory = std::function<std::unique_ptr<btCollisionObject>()>;
+
+  // Colliders are streamed in if they are closer than radius to an active
+  // body, and are streamed out if they get farther than 1.25 * radius.
+  PhysicsStreamer(GameObject* parent, float radius, float cell_size = 64.0f);
+  virtual ~PhysicsStreamer();
+
+  // Registers a static collision object, that is owned by the caller, and has
+  // to outlive the streamer. The object shouldn't be added to the world, the
+  // streamer will do it when the object is needed.
+  void addStaticCollider(btCollisionObject* collider, const BoundingBox& bbox);
+
+  // Registers a collider, that will be created by the factory every time
+  // it is streamed in, and will be destroyed when it gets streamed out.
+  void addStreamedCollider(ColliderFactory factory, const BoundingBox& bbox);
+
+  // Splits the heightmap into chunk_size x chunk_size sized heightfield chunks
+  // that are only created when they are needed.
+  void addHeightField(const HeightMapInterface& height_map,
+                      void* user_pointer = nullptr, int chunk_size = 64);
+
+  size_t collider_count() const { return colliders_.size(); }
+  size_t loaded_collider_count() const { return loaded_.size(); }
+
+ private:
+  struct Collider {
+    BoundingBox bbox;
+    btCollisionObject* object;  // nullptr for generated, not loaded colliders
+    std::unique_ptr<btCollisionObject> owned_object;
+    ColliderFactory factory;
+    bool loaded;
+    unsigned last_needed;
+  };
+
+  using Cell = std::pair<int, int>;
+
+  float radius_, cell_size_;
+  unsigned frame_;
+  std::vector<Collider> colliders_;
+  std::vector<size_t> loaded_;
+  std::map<Cell, std::vector<size_t>> cells_;
+
+  Cell cellAt(const glm::vec3& pos) const;
+  void addCollider(Collider&& collider);
+  void markCollidersAround(const glm::vec3& center, float radius);
+  void load(Collider& collider);
+  void unload(Collider& collider);
+
+  virtual void update() override;
+};
+
+}  // namespace engine
+
+#endif
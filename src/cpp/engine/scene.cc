@@ -13,6 +13,7 @@ Scene::Scene()
         physics_can_run_.waitOne();
         if (physics_thread_should_quit_) { return; }
         updatePhysics();
+        collectContacts();
         physics_finished_.set();
       }
     }}
@@ -24,5 +25,61 @@ ShaderManager* Scene::shader_manager() {
   return GameEngine::shader_manager();
 }
 
+void Scene::collectContacts() {
+  contacts_.clear();
+  if (!world_) { return; }
+
+  btDispatcher* dispatcher = world_->getDispatcher();
+  int num_manifolds = dispatcher->getNumManifolds();
+  for (int i = 0; i < num_manifolds; ++i) {
+    const btPersistentManifold* manifold =
+        dispatcher->getManifoldByIndexInternal(i);
+    auto go_a = static_cast<GameObject*>(manifold->getBody0()->getUserPointer());
+    auto go_b = static_cast<GameObject*>(manifold->getBody1()->getUserPointer());
+    if (!go_a && !go_b) { continue; }
+
+    // Only the strongest contact point of a pair is reported
+    const btManifoldPoint* strongest = nullptr;
+    float impulse = 0.0f;
+    for (int j = 0; j < manifold->getNumContacts(); ++j) {
+      const btManifoldPoint& pt = manifold->getContactPoint(j);
+      if (pt.getDistance() < 1e-3f) {
+        impulse += pt.getAppliedImpulse();
+        if (!strongest ||
+            strongest->getAppliedImpulse() < pt.getAppliedImpulse()) {
+          strongest = &pt;
+        }
+      }
+    }
+
+    if (strongest) {
+      const btVector3& a = strongest->getPositionWorldOnA();
+      const btVector3& b = strongest->getPositionWorldOnB();
+      const btVector3& n = strongest->m_normalWorldOnB;
+      contacts_.push_back(ContactPair{go_a, go_b,
+                                      glm::vec3(a.x(), a.y(), a.z()),
+                                      glm::vec3(b.x(), b.y(), b.z()),
+                                      glm::vec3(n.x(), n.y(), n.z()),
+                                      impulse});
+    }
+  }
+}
+
+void Scene::dispatchContacts() {
+  if (contact_listeners_.empty()) { return; }
+
+  for (const ContactPair& pair : contacts_) {
+    // The normal on B points from B towards A
+    if (pair.a && contact_listeners_.count(pair.a)) {
+      pair.a->collision(Contact{pair.b, pair.point_on_a,
+                                pair.normal_on_b, pair.impulse});
+    }
+    if (pair.b && contact_listeners_.count(pair.b)) {
+      pair.b->collision(Contact{pair.a, pair.point_on_b,
+                                -pair.normal_on_b, pair.impulse});
+    }
+  }
+}
+
 
 }  // namespace engine
@@ -3,6 +3,7 @@
 #ifndef ENGINE_SCENE_H_
 #define ENGINE_SCENE_H_
 
+#include <set>
 #include <vector>
 #include <memory>
 #include <btBulletDynamicsCommon.h>
@@ -13,8 +14,10 @@
 #include "./timer.h"
 #include "./camera.h"
 #include "./game_object.h"
+#include "./gl_state.h"
 #include "./shader_manager.h"
 #include "./auto_reset_event.h"
+#include "./mesh/crowd_animator.h"
 
 #include "../shadow.h"
 
@@ -62,9 +65,21 @@ class Scene : public GameObject {
 
   ShaderManager* shader_manager();
 
+  // The poses of the registered animated instances are updated in parallel,
+  // at the start of every update, before the objects' update() is called.
+  const CrowdAnimator* crowd_animator() const { return &crowd_animator_; }
+  CrowdAnimator* crowd_animator() { return &crowd_animator_; }
+
   GLFWwindow* window() const { return window_; }
   void set_window(GLFWwindow* window) { window_ = window; }
 
+  // The object's collision() will be called for the contacts of those bodies,
+  // whose user pointer is the object. Don't forget to unsubscribe.
+  void subscribeToContacts(GameObject* obj) { contact_listeners_.insert(obj); }
+  void unsubscribeFromContacts(GameObject* obj) {
+    contact_listeners_.erase(obj);
+  }
+
   virtual void keyAction(int key, int scancode, int action, int mods) override {
     if (action == GLFW_PRESS) {
       switch (key) {
@@ -102,17 +117,29 @@ class Scene : public GameObject {
   bool physics_thread_should_quit_;
   std::thread physics_thread_;
 
+  // A touching pair of bodies, written by the physics thread
+  struct ContactPair {
+    GameObject *a, *b;
+    glm::vec3 point_on_a, point_on_b, normal_on_b;
+    float impulse;
+  };
+  std::vector<ContactPair> contacts_;
+  std::set<GameObject*> contact_listeners_;
+
   // Own data
   Camera* camera_;
   Shadow* shadow_;
   Timer game_time_, environment_time_, camera_time_;
   GLFWwindow* window_;
+  CrowdAnimator crowd_animator_;
 
   virtual void updateAll() override {
     game_time_.tick();
     environment_time_.tick();
     camera_time_.tick();
 
+    dispatchContacts();
+    crowd_animator_.update(game_time_.current);
     GameObject::updateAll();
   }
 
@@ -129,10 +156,10 @@ class Scene : public GameObject {
   }
 
   virtual void render2DAll() override {
-    gl::TemporarySet capabilities{{{gl::kBlend, true},
-                                   {gl::kCullFace, false},
-                                   {gl::kDepthTest, false}}};
-    gl::BlendFunc(gl::kSrcAlpha, gl::kOneMinusSrcAlpha);
+    GlState::TemporarySet capabilities{{{GL_BLEND, true},
+                                        {GL_CULL_FACE, false},
+                                        {GL_DEPTH_TEST, false}}};
+    GlState::BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
     GameObject::render2DAll();
   }
@@ -142,6 +169,14 @@ class Scene : public GameObject {
       world_->stepSimulation(game_time().dt, 0);
     }
   }
+
+  // Fills contacts_ from the world's contact manifolds. It's called on the
+  // physics thread, after every updatePhysics().
+  virtual void collectContacts();
+
+  // Notifies the subscribed objects about the contacts of the last step.
+  // It's called on the main thread, while the physics thread is waiting.
+  void dispatchContacts();
 };
 
 }  // namespace engine
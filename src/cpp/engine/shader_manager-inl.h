@@ -12,6 +12,8 @@ template<typename... Args>
 ShaderFile* ShaderManager::load(Args&&... args) {
   auto shader = new ShaderFile{std::forward<Args>(args)...};
   shaders_[shader->source_file()] = std::unique_ptr<ShaderFile>{shader};
+  // Nothing waits for it, the driver compiles it while the rest is loaded.
+  shader->startCompile();
   return shader;
 }
 
@@ -1,8 +1,249 @@
 #include "./shader_manager.h"
+
+#include <cstdio>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <utility>
+#include <algorithm>
+#include <sys/stat.h>
+#ifdef _WIN32
+  #include <direct.h>
+#endif
+
 #include "./game_engine.h"
 
 namespace engine {
 
+namespace {
+
+const char kProgramCacheDir[] = OGLWRAP_DEFAULT_SHADER_PATH "cache/";
+const char kMagic[4] = {'P', 'B', 'I', 'N'};
+const uint32_t kVersion = 1;
+
+struct FileHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t binary_format;
+  uint32_t size;
+};
+
+/// FNV-1a, that (unlike std::hash) is the same on every run.
+uint64_t Hash(const std::string& str,
+              uint64_t hash = 14695981039346656037ull) {
+  for (unsigned char c : str) {
+    hash ^= c;
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+bool IsProgramBinarySupported() {
+#if defined(glProgramBinary) && defined(GLEW_VERSION_4_1)
+  if (!GLEW_VERSION_4_1 && !GLEW_ARB_get_program_binary) {
+    return false;
+  }
+  // Some drivers expose the extension without supporting any format
+  GLint format_count = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &format_count);
+  return format_count > 0;
+#else
+  return false;
+#endif
+}
+
+/// Prints the info log of a shader or a program, if it isn't empty.
+void PrintInfoLog(GLuint object, bool is_program) {
+  GLint length = 0;
+  if (is_program) {
+    glGetProgramiv(object, GL_INFO_LOG_LENGTH, &length);
+  } else {
+    glGetShaderiv(object, GL_INFO_LOG_LENGTH, &length);
+  }
+  if (length <= 1) {
+    return;
+  }
+
+  std::vector<char> log(length);
+  if (is_program) {
+    glGetProgramInfoLog(object, length, nullptr, log.data());
+  } else {
+    glGetShaderInfoLog(object, length, nullptr, log.data());
+  }
+  std::cerr << log.data() << std::endl;
+}
+
+bool LoadProgramBinary(GLuint program, const std::string& filename) {
+#ifdef glProgramBinary
+  std::ifstream file(filename, std::ios::binary);
+  if (!file) { return false; }
+
+  file.seekg(0, std::ios::end);
+  uint64_t file_size = file.tellg();
+  file.seekg(0, std::ios::beg);
+
+  FileHeader header;
+  file.read(reinterpret_cast<char*>(&header), sizeof(header));
+  // A corrupted size shouldn't make us allocate more than the file.
+  if (!file || !std::equal(kMagic, kMagic + 4, header.magic) ||
+      header.version != kVersion ||
+      sizeof(header) + uint64_t(header.size) != file_size) {
+    return false;
+  }
+
+  std::vector<char> binary(header.size);
+  file.read(binary.data(), binary.size());
+  if (!file) { return false; }
+
+  glProgramBinary(program, header.binary_format, binary.data(), binary.size());
+
+  // The driver rejects the binaries of the other driver versions.
+  GLint status = GL_FALSE;
+  glGetProgramiv(program, GL_LINK_STATUS, &status);
+  return status == GL_TRUE;
+#else
+  return false;
+#endif
+}
+
+void SaveProgramBinary(GLuint program, const std::string& filename) {
+#ifdef glGetProgramBinary
+  GLint status = GL_FALSE, length = 0;
+  glGetProgramiv(program, GL_LINK_STATUS, &status);
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (status != GL_TRUE || length <= 0) {
+    return;
+  }
+
+  std::vector<char> binary(length);
+  GLenum binary_format = 0;
+  glGetProgramBinary(program, length, &length, &binary_format, binary.data());
+
+#ifdef _WIN32
+  _mkdir(kProgramCacheDir);
+#else
+  mkdir(kProgramCacheDir, 0755);
+#endif
+
+  // Failing to write the cache isn't an error, it is just slower next time.
+  std::ofstream file(filename, std::ios::binary);
+  if (!file) { return; }
+
+  FileHeader header;
+  std::copy(kMagic, kMagic + 4, header.magic);
+  header.version = kVersion;
+  header.binary_format = binary_format;
+  header.size = length;
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(binary.data(), length);
+#endif
+}
+
+}  // namespace
+
+void ShaderFile::startCompile() {
+  if (compile_started_) {
+    return;
+  }
+  compile_started_ = true;
+  for (ShaderFile *included : includes_) {
+    included->startCompile();
+  }
+  glCompileShader(expose());
+}
+
+bool ShaderFile::finishCompile() {
+  startCompile();
+  if (!compile_finished_) {
+    compile_finished_ = true;
+
+    bool includes_ok = true;
+    for (ShaderFile *included : includes_) {
+      includes_ok = included->finishCompile() && includes_ok;
+    }
+
+    GLint status = GL_FALSE;
+    glGetShaderiv(expose(), GL_COMPILE_STATUS, &status);
+    if (status != GL_TRUE) {
+      std::cerr << "Compilation of '" << source_file() << "' failed:\n";
+      PrintInfoLog(expose(), false);
+    }
+
+    state_ = includes_ok && status == GL_TRUE ? gl::Shader::kCompileSuccessful
+                                              : gl::Shader::kCompileFailure;
+  }
+
+  return state_ == gl::Shader::kCompileSuccessful;
+}
+
+void ShaderManager::finishLinks(bool wait) {
+  // The setup functions might link new programs, so the finished links are
+  // taken out of the list first.
+  std::vector<PendingLink> finished;
+  size_t unfinished_count = 0;
+  for (size_t i = 0; i < pending_links_.size(); ++i) {
+    bool skip = false;
+#ifdef GL_COMPLETION_STATUS_KHR
+    // Without the extension, the status query below waits for the link.
+    if (!wait && pending_links_[i].setup_funcs.empty() &&
+        (GLEW_KHR_parallel_shader_compile ||
+         GLEW_ARB_parallel_shader_compile)) {
+      GLint completed = GL_TRUE;
+      glGetProgramiv(pending_links_[i].program->expose(),
+                     GL_COMPLETION_STATUS_KHR, &completed);
+      skip = completed != GL_TRUE;
+    }
+#endif
+    if (skip) {
+      if (unfinished_count != i) {
+        pending_links_[unfinished_count] = std::move(pending_links_[i]);
+      }
+      unfinished_count++;
+    } else {
+      finished.push_back(std::move(pending_links_[i]));
+    }
+  }
+  pending_links_.resize(unfinished_count);
+
+  for (const PendingLink& link : finished) {
+    GLuint program = link.program->expose();
+    GLint status = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (status == GL_TRUE) {
+      if (!link.cache_filename.empty()) {
+        SaveProgramBinary(program, link.cache_filename);
+      }
+    } else {
+      const std::set<ShaderFile*>& shaders = link.program->shaders_;
+      // The compilation errors are printed by finishCompile()
+      for (ShaderFile *shader : shaders) {
+        shader->finishCompile();
+      }
+      std::cerr << "Linking the program of";
+      for (ShaderFile *shader : shaders) {
+        std::cerr << " '" << shader->source_file() << "'";
+      }
+      std::cerr << " failed:\n";
+      PrintInfoLog(program, true);
+    }
+  }
+
+  for (const PendingLink& link : finished) {
+    for (const auto& func : link.setup_funcs) {
+      func();
+    }
+  }
+}
+
+void ShaderManager::removePendingLink(const ShaderProgram* program) {
+  pending_links_.erase(
+      std::remove_if(pending_links_.begin(), pending_links_.end(),
+                     [program](const PendingLink& link) {
+                       return link.program == program;
+                     }),
+      pending_links_.end());
+}
+
 void ShaderFile::findExports(std::string &src) {
   // search for the exported functions
   size_t export_pos = src.find("#export");
@@ -50,4 +291,122 @@ void ShaderFile::findIncludes(std::string &src) {
   }
 }
 
+void ShaderManager::movePendingLink(const ShaderProgram* from,
+                                    const ShaderProgram* to) {
+  for (PendingLink& link : pending_links_) {
+    if (link.program == from) {
+      link.program = to;
+    }
+  }
+}
+
+ShaderProgram::ShaderProgram(ShaderProgram&& prog)
+    : gl::Program(std::move(prog))
+    , shaders_(std::move(prog.shaders_))
+    , attrib_locations_(std::move(prog.attrib_locations_))
+    , feedback_varyings_(std::move(prog.feedback_varyings_))
+    , feedback_buffer_mode_(prog.feedback_buffer_mode_) {
+  GameEngine::shader_manager()->movePendingLink(&prog, this);
+}
+
+ShaderProgram::~ShaderProgram() {
+  // The name of the program might be reused by a new one
+  GameEngine::shader_manager()->removePendingLink(this);
+}
+
+const gl::Program& ShaderProgram::link() {
+  static const bool binary_supported = IsProgramBinarySupported();
+
+  std::string cache_filename;
+  if (binary_supported) {
+    cache_filename = binaryCacheFilename();
+    if (LoadProgramBinary(expose(), cache_filename)) {
+      return *this;
+    }
+  }
+
+  // The ShaderManager has already started the compilations
+  for (auto shader_file : shaders_) {
+    glAttachShader(expose(), shader_file->expose());
+  }
+#ifdef glProgramParameteri
+  if (binary_supported) {
+    glProgramParameteri(expose(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  }
+#endif
+  // Nothing waits for the link here, ShaderManager::finishLinks() checks
+  // the status, when the link is finished.
+  glLinkProgram(expose());
+  ShaderManager* manager = GameEngine::shader_manager();
+  manager->removePendingLink(this);
+  manager->pending_links_.push_back({this, cache_filename});
+
+  return *this;
+}
+
+ShaderProgram& ShaderProgram::bindAttribLocation(const std::string& name,
+                                                 GLuint index) {
+  attrib_locations_[name] = index;
+  glBindAttribLocation(expose(), index, name.c_str());
+  return *this;
+}
+
+ShaderProgram& ShaderProgram::transformFeedbackVaryings(
+    const std::vector<std::string>& varyings, GLenum buffer_mode) {
+  feedback_varyings_ = varyings;
+  feedback_buffer_mode_ = buffer_mode;
+#ifdef glTransformFeedbackVaryings
+  std::vector<const char*> names;
+  for (const std::string& varying : varyings) {
+    names.push_back(varying.c_str());
+  }
+  glTransformFeedbackVaryings(expose(), names.size(), names.data(),
+                              buffer_mode);
+#endif
+  return *this;
+}
+
+void ShaderProgram::setup(std::function<void()> func) {
+  for (auto& link : GameEngine::shader_manager()->pending_links_) {
+    if (link.program == this) {
+      link.setup_funcs.push_back(std::move(func));
+      return;
+    }
+  }
+  func();
+}
+
+std::string ShaderProgram::binaryCacheFilename() const {
+  // The shaders_ set is ordered by address, that changes between runs
+  std::vector<const ShaderFile*> shaders(shaders_.begin(), shaders_.end());
+  std::sort(shaders.begin(), shaders.end(),
+            [](const ShaderFile* a, const ShaderFile* b) {
+    return a->source_file() < b->source_file();
+  });
+
+  uint64_t hash = Hash("");
+  for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+    const char* str = reinterpret_cast<const char*>(glGetString(name));
+    hash = Hash(str ? str : "", hash);
+  }
+  for (const ShaderFile* shader : shaders) {
+    hash = Hash(shader->source_file(), hash);
+    hash = Hash(shader->expanded_source(), hash);
+  }
+  // The attribute locations and the captured varyings are baked into the
+  // binary too (the std::map is already ordered by the names).
+  for (const auto& location : attrib_locations_) {
+    hash = Hash(location.first + '=' + std::to_string(location.second), hash);
+  }
+  for (const std::string& varying : feedback_varyings_) {
+    hash = Hash("varying " + varying, hash);
+  }
+  hash = Hash(std::to_string(feedback_buffer_mode_), hash);
+
+  char hash_str[32];
+  snprintf(hash_str, sizeof(hash_str), "%016llx",
+           static_cast<unsigned long long>(hash));
+  return std::string{kProgramCacheDir} + hash_str + ".bin";
+}
+
 }  // namespace engine
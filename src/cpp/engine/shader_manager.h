@@ -4,6 +4,7 @@
 #define ENGINE_SHADER_MANAGER_H_
 
 #include <map>
+#include <functional>
 #include <set>
 #include <string>
 #include <vector>
@@ -41,6 +42,30 @@ class ShaderManager {
  public:
   ShaderFile* publish(const std::string& filename, const gl::ShaderSource& src);
   ShaderFile* get(const std::string& filename);
+
+  // Checks the links issued by ShaderProgram::link(), prints the errors,
+  // saves the successful ones to the program binary cache, and calls the
+  // functions given to ShaderProgram::setup(). If wait is false, and the
+  // driver can tell it, the unfinished links without setup functions are
+  // skipped (and checked by a later call), so it is cheap to call every
+  // frame.
+  void finishLinks(bool wait = true);
+
+ private:
+  struct PendingLink {
+    const ShaderProgram* program;
+    std::string cache_filename;  // empty if the cache isn't supported
+    std::vector<std::function<void()>> setup_funcs;
+  };
+  std::vector<PendingLink> pending_links_;
+
+  // Forgets the pending link of a program (that is being deleted).
+  void removePendingLink(const ShaderProgram* program);
+
+  // Moves the pending link of a program to a new address.
+  void movePendingLink(const ShaderProgram* from, const ShaderProgram* to);
+
+  friend class ShaderProgram;
 };
 
 class ShaderFile : public gl::Shader {
@@ -52,18 +77,21 @@ class ShaderFile : public gl::Shader {
       : gl::Shader(shader_type(filename)) {
     std::string src_str = src.source();
     findIncludes(src_str);
-    for (ShaderFile *included : includes_) {
-      if (included->state_ == gl::Shader::kCompileFailure) {
-        state_ = gl::Shader::kCompileFailure;
-        return;
-      }
-    }
     findExports(src_str);
     set_source(src_str);
     set_source_file(filename);
-    compile();
+    expanded_source_ = src_str;
   }
 
+  // Issues the compilation of the shader and the included ones, but doesn't
+  // wait for it, so a driver with a threaded compiler can compile them in
+  // parallel. The ShaderManager calls it as soon as it loads the shader.
+  void startCompile();
+
+  // Waits for the compilation, prints the errors, and returns if it was
+  // successful (the included shaders have to be compiled successfully too).
+  bool finishCompile();
+
   void set_update_func(std::function<void(const gl::Program&)> func) {
     update_func_ = func;
   }
@@ -76,10 +104,14 @@ class ShaderFile : public gl::Shader {
 
   const std::string& exports() const { return exports_; }
 
+  // The source after the includes are resolved
+  const std::string& expanded_source() const { return expanded_source_; }
+
  private:
   std::function<void(const gl::Program&)> update_func_;
   std::vector<ShaderFile*> includes_;
-  std::string exports_;
+  std::string exports_, expanded_source_;
+  bool compile_started_ = false, compile_finished_ = false;
 
   void findExports(std::string &src);
   void findIncludes(std::string &src);
@@ -97,8 +129,13 @@ class ShaderProgram : public gl::Program {
     link();
   }
 
-  ShaderProgram(const ShaderProgram& prog) = default;
-  ShaderProgram(ShaderProgram&& prog) = default;
+  // The pending link of a program is tracked by its address, a copy
+  // wouldn't be checked by ShaderManager::finishLinks().
+  ShaderProgram(const ShaderProgram& prog) = delete;
+  // Takes over the pending link of the moved program.
+  ShaderProgram(ShaderProgram&& prog);
+
+  virtual ~ShaderProgram();
 
   void update() const {
     for (auto shader : shaders_) {
@@ -126,18 +163,42 @@ class ShaderProgram : public gl::Program {
     return *this;
   }
 
-  virtual const Program& link() override {
-    for (auto shader_file : shaders_) {
-      const gl::Shader& shader = *shader_file;
-      gl::Program::attachShader(shader);
-    }
-    gl::Program::link();
-
-    return *this;
-  }
+  // Loads the program from the binary cache if possible, otherwise issues
+  // the linking of the shaders. The result is checked (and saved to the
+  // cache) by ShaderManager::finishLinks(), that the GameEngine calls every
+  // frame.
+  virtual const Program& link() override;
+
+  // Calls func when the link is finished, or right now if the program isn't
+  // waiting for a link. Anything that queries the program (uniforms,
+  // attribute locations, validate()) should be done here, so that the
+  // components of a scene issue every link before the first one is waited
+  // for. The programs of a new scene are set up before its first frame.
+  void setup(std::function<void()> func);
+
+  // Binds a vertex attribute to a location. Like glBindAttribLocation, it
+  // only takes effect on the next link(). The binding is part of the binary
+  // cache's key, so use this instead of gl::VertexAttrib::bindLocation.
+  ShaderProgram& bindAttribLocation(const std::string& name, GLuint index);
+
+  // Specifies the varyings captured by transform feedback. It only takes
+  // effect on the next link(), and it is part of the binary cache's key too.
+  ShaderProgram& transformFeedbackVaryings(
+      const std::vector<std::string>& varyings, GLenum buffer_mode);
 
  private:
   std::set<ShaderFile*> shaders_;
+
+  friend class ShaderManager;
+
+  // The state that is set before the linking, and changes the binary.
+  std::map<std::string, GLuint> attrib_locations_;
+  std::vector<std::string> feedback_varyings_;
+  GLenum feedback_buffer_mode_ = GL_INTERLEAVED_ATTRIBS;
+
+  // The name of the program's cache file, that depends on the sources of the
+  // shaders, on the pre-link state and on the driver.
+  std::string binaryCacheFilename() const;
 };
 
 }  // namespace engine
@@ -0,0 +1,210 @@
+// Copyright (c) 2014, Tamas Csala
+
+#include "./texture_cache.h"
+
+#include <vector>
+#include <utility>
+#include "./async_loader.h"
+#include "./compressed_texture.h"
+#include "./texture_source.h"
+#include "../oglwrap/context.h"
+
+namespace engine {
+
+/// Removes the "." and "dir/.." parts of a path, so that the different
+/// relative paths of the same file share the same cache entry.
+static std::string NormalizePath(const std::string& path) {
+  std::vector<std::string> parts;
+  bool absolute = !path.empty() && path[0] == '/';
+  size_t begin = 0;
+  while (begin <= path.size()) {
+    size_t end = path.find('/', begin);
+    if (end == std::string::npos) { end = path.size(); }
+    std::string part = path.substr(begin, end - begin);
+    if (part == "..") {
+      if (!parts.empty() && parts.back() != "..") {
+        parts.pop_back();
+      } else if (!absolute) {
+        parts.push_back(part);
+      }
+    } else if (!part.empty() && part != ".") {
+      parts.push_back(part);
+    }
+    begin = end + 1;
+  }
+
+  std::string result = absolute ? "/" : "";
+  for (size_t i = 0; i < parts.size(); ++i) {
+    result += (i == 0 ? "" : "/") + parts[i];
+  }
+  return result;
+}
+
+std::map<std::string, std::weak_ptr<gl::Texture2D>> TextureCache::files_;
+std::map<std::array<float, 4>, std::weak_ptr<gl::Texture2D>>
+    TextureCache::colors_;
+
+#if OGLWRAP_USE_IMAGEMAGICK
+class TextureCache::DecodedImage {
+ public:
+  virtual ~DecodedImage() {}
+
+  /// Uploads the image with every mipmap level to the bound texture.
+  virtual void upload(gl::Texture2D& texture) const = 0;
+};
+
+namespace {
+
+class BlockCompressedImage : public TextureCache::DecodedImage {
+  std::unique_ptr<CompressedImage> image_;
+
+ public:
+  explicit BlockCompressedImage(std::unique_ptr<CompressedImage> image)
+      : image_(std::move(image)) {}
+
+  virtual void upload(gl::Texture2D& texture) const override {
+    image_->upload(texture);
+  }
+};
+
+template <char NUM_COMPONENTS>
+class UncompressedImage : public TextureCache::DecodedImage {
+  TextureSource<unsigned char, NUM_COMPONENTS> source_;
+
+ public:
+  UncompressedImage(const std::string& filename,
+                    const std::string& format_string)
+      : source_(filename, format_string) {}
+
+  virtual void upload(gl::Texture2D& texture) const override {
+    source_.upload(texture);
+    texture.generateMipmap();
+  }
+};
+
+}  // namespace
+
+std::map<std::string, std::unique_ptr<TextureCache::DecodedImage>>
+    TextureCache::decoded_;
+std::mutex TextureCache::decoded_mutex_;
+
+static std::string CacheKey(const std::string& filename,
+                            const std::string& format_string) {
+  return format_string + ':' + NormalizePath(filename);
+}
+
+std::unique_ptr<TextureCache::DecodedImage> TextureCache::DecodeImage(
+    const std::string& filename, const std::string& format_string) {
+  bool compressed = format_string.find('C') != std::string::npos;
+  bool srgb = format_string.find('S') != std::string::npos;
+  std::string channels;
+  for (char c : format_string) {
+    if (c != 'C' && c != 'S' && c != 'I') { channels += c; }
+  }
+
+  if (compressed && (channels == "RGBA" || channels == "RGB" ||
+                     channels == "RG")) {
+    BlockFormat format = channels == "RGBA" ? BlockFormat::BC3
+                       : channels == "RGB" ? BlockFormat::BC1
+                       : BlockFormat::BC5;
+    std::unique_ptr<CompressedImage> image =
+      LoadCompressedImage(filename, format, srgb);
+    if (image) {
+      return std::unique_ptr<DecodedImage>{
+        new BlockCompressedImage{std::move(image)}};
+    }
+  }
+
+  switch (channels.size()) {
+    case 1:
+      return std::unique_ptr<DecodedImage>{
+        new UncompressedImage<1>{filename, format_string}};
+    case 2:
+      return std::unique_ptr<DecodedImage>{
+        new UncompressedImage<2>{filename, format_string}};
+    case 3:
+      return std::unique_ptr<DecodedImage>{
+        new UncompressedImage<3>{filename, format_string}};
+    default:
+      return std::unique_ptr<DecodedImage>{
+        new UncompressedImage<4>{filename, format_string}};
+  }
+}
+
+TextureCache::TexturePtr TextureCache::load(const std::string& filename,
+                                            const std::string& format_string) {
+  std::string key = CacheKey(filename, format_string);
+
+  // The decoded image is taken out even if the texture exists, so that it
+  // doesn't stay in the memory.
+  std::unique_ptr<DecodedImage> decoded;
+  {
+    std::lock_guard<std::mutex> lock(decoded_mutex_);
+    auto iter = decoded_.find(key);
+    if (iter != decoded_.end()) {
+      decoded = std::move(iter->second);
+      decoded_.erase(iter);
+    }
+  }
+
+  std::weak_ptr<gl::Texture2D>& entry = files_[key];
+  TexturePtr texture = entry.lock();
+  if (!texture) {
+    if (!decoded) {
+      decoded = DecodeImage(filename, format_string);
+    }
+    texture = std::make_shared<gl::Texture2D>();
+    gl::Bind(*texture);
+    decoded->upload(*texture);
+    // Every level is uploaded, so they can be used for free
+    texture->minFilter(gl::kLinearMipmapLinear);
+    texture->magFilter(gl::kLinear);
+    entry = texture;
+  }
+
+  return texture;
+}
+
+void TextureCache::Decode(const std::string& filename,
+                          const std::string& format_string) {
+  std::unique_ptr<DecodedImage> decoded = DecodeImage(filename, format_string);
+
+  std::lock_guard<std::mutex> lock(decoded_mutex_);
+  decoded_[CacheKey(filename, format_string)] = std::move(decoded);
+}
+
+void TextureCache::LoadAsync(
+    AsyncLoader* loader, const std::string& filename,
+    const std::string& format_string,
+    std::shared_ptr<std::vector<TexturePtr>> keep_alive) {
+  loader->run([=]() {
+    try {
+      Decode(filename, format_string);
+    } catch (...) {
+      // load() decodes it again on the main thread, and the error is
+      // reported there.
+    }
+    loader->runOnMainThread([=]() {
+      keep_alive->push_back(load(filename, format_string));
+    });
+  });
+}
+#endif
+
+TextureCache::TexturePtr TextureCache::color(const glm::vec4& color) {
+  std::array<float, 4> key = {{color.r, color.g, color.b, color.a}};
+  std::weak_ptr<gl::Texture2D>& entry = colors_[key];
+  TexturePtr texture = entry.lock();
+  if (!texture) {
+    texture = std::make_shared<gl::Texture2D>();
+    gl::Bind(*texture);
+    texture->upload(gl::kRgba32F, 1, 1, gl::kRgba, gl::kFloat, &key[0]);
+    texture->minFilter(gl::kNearest);
+    texture->magFilter(gl::kNearest);
+    entry = texture;
+  }
+
+  return texture;
+}
+
+}  // namespace engine
@@ -0,0 +1,85 @@
+// Copyright (c) 2014, Tamas Csala
+
+#ifndef ENGINE_TEXTURE_CACHE_H_
+#define ENGINE_TEXTURE_CACHE_H_
+
+#include <map>
+#include <array>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "./oglwrap_config.h"
+#include "../oglwrap/textures/texture_2D.h"
+
+namespace engine {
+
+class AsyncLoader;
+
+/// An engine-wide cache of the textures used by the meshes.
+/** The textures are shared between everyone who requests the same file
+  * (with the same format) or the same color, and they are deleted when the
+  * last user releases them. */
+class TextureCache {
+ public:
+  using TexturePtr = std::shared_ptr<gl::Texture2D>;
+
+#if OGLWRAP_USE_IMAGEMAGICK
+  /// An image that is decoded, but isn't uploaded yet.
+  class DecodedImage;
+#endif
+
+#if OGLWRAP_USE_IMAGEMAGICK
+  /// Returns the texture loaded from a file, with trilinear filtering.
+  /** Changes the Texture2D binding of the active texture unit, if the texture
+    * isn't loaded yet. If the image was already decoded by Decode(), it is
+    * only uploaded. The compressed ('C') RGBA, RGB and RG images are loaded
+    * through the block compressed cache (see LoadCompressedImage) as BC3,
+    * BC1 and BC5.
+    * @param filename - The path of the image.
+    * @param format_string - The format string of engine::TextureSource. */
+  static TexturePtr load(const std::string& filename,
+                         const std::string& format_string);
+
+  /// Decodes an image for a later load() call with the same parameters.
+  /** It doesn't use OpenGL, so it can be called from any thread (only load()
+    * has to be called on the main thread). Every decoded image should be
+    * loaded, otherwise it is kept in the memory. */
+  static void Decode(const std::string& filename,
+                     const std::string& format_string);
+
+  /// Decodes an image on a worker thread, and loads it with a main thread
+  /// task of the loader. It can be called from any thread.
+  /** @param keep_alive - The texture is added to this when it is loaded, so
+    *                     it stays in the cache until the user gets it. */
+  static void LoadAsync(AsyncLoader* loader, const std::string& filename,
+                        const std::string& format_string,
+                        std::shared_ptr<std::vector<TexturePtr>> keep_alive);
+#endif
+
+  /// Returns an 1x1 texture with the specified color.
+  /** Changes the Texture2D binding of the active texture unit, if the texture
+    * doesn't exist yet. */
+  static TexturePtr color(const glm::vec4& color);
+
+ private:
+  static std::map<std::string, std::weak_ptr<gl::Texture2D>> files_;
+  static std::map<std::array<float, 4>, std::weak_ptr<gl::Texture2D>> colors_;
+
+#if OGLWRAP_USE_IMAGEMAGICK
+  /// The images decoded by Decode(), it is accessed from more threads.
+  static std::map<std::string, std::unique_ptr<DecodedImage>> decoded_;
+  static std::mutex decoded_mutex_;
+
+  static std::unique_ptr<DecodedImage> DecodeImage(
+      const std::string& filename, const std::string& format_string);
+#endif
+};
+
+}  // namespace engine
+
+#endif
@@ -29,6 +29,11 @@ class TextureSource {
   TextureSource(const std::string& file_name,
                 std::string format_string = "CSRGBA");
 
+  TextureSource(const TextureSource&) = default;
+  TextureSource(TextureSource&&) = default;
+  TextureSource& operator=(const TextureSource&) = default;
+  TextureSource& operator=(TextureSource&&) = default;
+
   virtual ~TextureSource() {}
 
   // getters
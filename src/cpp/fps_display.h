@@ -5,13 +5,15 @@
 
 #include "engine/scene.h"
 #include "engine/game_object.h"
+#include "engine/gl_state.h"
 #include "engine/gui/label.h"
 
 class FpsDisplay : public engine::GameObject {
  public:
   explicit FpsDisplay(engine::GameObject* parent)
       : engine::GameObject(parent), kRefreshInterval(0.1f)
-      , sum_frame_num_(0), sum_time_(0) {
+      , sum_frame_num_(0), sum_time_(0)
+      , sum_gl_issued_(0), sum_gl_filtered_(0), gl_frames_(0) {
     label_ = addComponent<engine::gui::Label>(L"FPS: ", glm::vec2{0.8f, 0.9f},
              engine::gui::Font{"src/resources/fonts/Vera.ttf", 30,
              glm::vec4(1, 0, 0, 1)});
@@ -19,17 +21,28 @@ class FpsDisplay : public engine::GameObject {
 
   ~FpsDisplay() {
     std::cout << "Average FPS: " << sum_frame_num_ / sum_time_ << std::endl;
+    if (gl_frames_ > 0) {
+      std::cout << "Average GL state changes per frame: "
+                << sum_gl_issued_ / gl_frames_ << " issued, "
+                << sum_gl_filtered_ / gl_frames_ << " filtered" << std::endl;
+    }
   }
 
  private:
   engine::gui::Label *label_;
   const float kRefreshInterval;
   double sum_frame_num_, sum_time_;
+  double sum_gl_issued_, sum_gl_filtered_, gl_frames_;
 
   virtual void update() override {
     static double accum_time = scene_->camera_time().dt;
     static int calls = 0;
 
+    const engine::GlState::Counters& gl_calls = engine::GlState::last_frame();
+    sum_gl_issued_ += gl_calls.issued;
+    sum_gl_filtered_ += gl_calls.filtered;
+    gl_frames_++;
+
     calls++;
     accum_time += scene_->camera_time().dt;
     if (accum_time > kRefreshInterval) {
@@ -11,6 +11,7 @@
 #include "oglwrap/smart_enums.h"
 
 #include "engine/game_object.h"
+#include "engine/gl_state.h"
 
 class LoadingScreen {
   gl::Texture2D tex_;
@@ -41,14 +42,15 @@ public:
   }
 
   void render() {
-    gl::Use(prog_);
-    gl::BindToTexUnit(tex_, 0);
+    // Rendered between the loading steps, that bind things directly
+    engine::GlState::BeginFrame();
+    engine::GlState::Use(prog_);
+    engine::GlState::BindTexture(0, tex_);
 
-    gl::TemporarySet capabilies{{{gl::kCullFace, false},
-                                 {gl::kDepthTest, false}}};
+    engine::GlState::TemporarySet capabilies{{GL_CULL_FACE, false},
+                                             {GL_DEPTH_TEST, false}};
 
     rect_.render();
-    gl::Unbind(tex_);
   }
 };
 
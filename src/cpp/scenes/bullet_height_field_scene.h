@@ -6,7 +6,6 @@
 #include <vector>
 #include <algorithm>
 #include <btBulletDynamicsCommon.h>
-#include <BulletCollision/CollisionShapes/btHeightfieldTerrainShape.h>
 
 // fck windows.h
 #undef min
@@ -16,8 +15,11 @@
 #include "../engine/scene.h"
 #include "../engine/camera.h"
 #include "../engine/game_object.h"
+#include "../engine/async_loader.h"
+#include "../engine/gl_state.h"
 #include "../engine/debug/debug_shape.h"
 #include "../engine/gui/label.h"
+#include "../engine/physics/physics_streamer.h"
 
 #include "../terrain.h"
 #include "../after_effects.h"
@@ -134,24 +136,14 @@ class BulletRigidBody : public engine::GameObject, public btMotionState {
 
 class HeightField : public engine::GameObject {
  public:
-  explicit HeightField(GameObject* parent) : GameObject(parent) {
-    terrain_ = addComponent<Terrain>();
-    const auto& height_map = terrain_->height_map();
-    int w = height_map.w(), h = height_map.h();
-    GLubyte *data = new GLubyte[w*h];
-    for (int x = 0; x < w; ++x) {
-      for (int y = 0; y < h; ++y) {
-        data[y*w + x] = height_map.heightAt(x, y);
-      }
-    }
-
-    btCollisionShape* shape = new btHeightfieldTerrainShape{
-        height_map.w(), height_map.h(), data,
-        1, 0, 256, 1, PHY_UCHAR, true};
-
-    glm::vec3 pos{height_map.w()/2.0f, 128, height_map.h()/2.0f};
-    addComponent<BulletRigidBody>(
-        0.0f, std::unique_ptr<btCollisionShape>{shape}, pos);
+  HeightField(GameObject* parent, engine::PhysicsStreamer* streamer)
+      : GameObject(parent) {
+    engine::AsyncLoader loader;
+    Terrain::Assets terrain_assets = Terrain::LoadAssets(&loader);
+    loader.finish();
+    terrain_ = addComponent<Terrain>(std::move(terrain_assets));
+    // The heightfield is only instantiated in chunks around the active bodies
+    streamer->addHeightField(terrain_->height_map(), this);
   }
 
   Terrain* terrain_;
@@ -177,9 +169,14 @@ class BulletCube : public engine::GameObject {
     bt_rigid_body->setCcdMotionThreshold(0.5f);
     bt_rigid_body->setCcdSweptSphereRadius(0.2f);
     mesh_ = addComponent<engine::debug::Cube>(glm::vec3(0.5, 0.0, 0.0));
+    scene_->subscribeToContacts(this);
+  }
+
+  virtual ~BulletCube() {
+    scene_->unsubscribeFromContacts(this);
   }
 
-  virtual void collision(const GameObject* other) override {
+  virtual void collision(const engine::Contact& contact) override {
     addColor(glm::vec3{0.0f, 0.02f, 0.0f});
   }
 
@@ -214,9 +211,14 @@ class BulletSphere : public engine::GameObject {
     bt_rigid_body->setCcdMotionThreshold(0.5f);
     bt_rigid_body->setCcdSweptSphereRadius(0.2f);
     mesh_ = addComponent<engine::debug::Sphere>(glm::vec3(0.5, 0.0, 0.0));
+    scene_->subscribeToContacts(this);
+  }
+
+  virtual ~BulletSphere() {
+    scene_->unsubscribeFromContacts(this);
   }
 
-  virtual void collision(const GameObject* other) override {
+  virtual void collision(const engine::Contact& contact) override {
     addColor(glm::vec3{0.0f, 0.02f, 0.0f});
   }
 
@@ -347,7 +349,8 @@ class BulletForest : public engine::GameObject {
                TreeInfo* tree_info,
                const engine::BoundingBox& bbox,
                const engine::ShaderProgram& prog,
-               const engine::ShaderProgram& shadow_prog)
+               const engine::ShaderProgram& shadow_prog,
+               engine::PhysicsStreamer* streamer)
         : GameObject(parent, transform)
         , model_matrix_(transform.matrix())
         , tree_info_(tree_info)
@@ -356,6 +359,9 @@ class BulletForest : public engine::GameObject {
         , shadow_uMCP_(shadow_prog, "uMCP")
         , uNormalMatrix_(prog, "uNormalMatrix") {
       rbody_ = addComponent<BulletRigidBody>(0, tree_info->shape_.get());
+      // the streamer adds the collider to the world when it's needed
+      scene_->world()->removeCollisionObject(rbody_->bt_rigid_body());
+      streamer->addStaticCollider(rbody_->bt_rigid_body(), bbox_);
     }
 
    private:
@@ -366,21 +372,6 @@ class BulletForest : public engine::GameObject {
     gl::LazyUniform<glm::mat4> uModelCameraMatrix_, shadow_uMCP_;
     gl::LazyUniform<glm::mat3> uNormalMatrix_;
 
-    virtual void update() override {
-      auto cam = scene_->camera();
-      const auto& campos = cam->transform()->pos();
-
-      if (glm::length(transform()->pos() - campos) < 1000) {
-        if (!enabled()) {
-          set_enabled(true);
-          scene_->world()->addRigidBody(rbody_->bt_rigid_body());
-        }
-      } else if (enabled()) {
-        set_enabled(false);
-        scene_->world()->removeCollisionObject(rbody_->bt_rigid_body());
-      }
-    }
-
     virtual void shadowRender() override {
       auto shadow = scene_->shadow();
       const auto& cam = *scene_->camera();
@@ -388,8 +379,9 @@ class BulletForest : public engine::GameObject {
       if (shadow->getDepth() < shadow->getMaxDepth() &&
           glm::length(glm::vec3(model_matrix_[3]) - campos) < 150) {
         shadow_uMCP_ = shadow->modelCamProjMat(
-            tree_info_->bsphere_, model_matrix_, glm::mat4{});
-        gl::TemporaryDisable cullface{gl::kCullFace};
+            tree_info_->bsphere_, model_matrix_,
+            tree_info_->mesh_.positionTransform());
+        engine::GlState::TemporarySet cullface{{GL_CULL_FACE, false}};
         tree_info_->mesh_.render();
         shadow->push();
       }
@@ -403,10 +395,11 @@ class BulletForest : public engine::GameObject {
       // Check for visibility
       if (!bbox_.collidesWithFrustum(frustum)) { return; }
 
-      gl::TemporarySet capabilities{{{gl::kBlend, true},
-                                   {gl::kCullFace, false}}};
+      engine::GlState::TemporarySet capabilities{{GL_BLEND, true},
+                                                 {GL_CULL_FACE, false}};
 
-      uModelCameraMatrix_.set(cam_mx * model_matrix_);
+      uModelCameraMatrix_.set(cam_mx * model_matrix_ *
+                              tree_info_->mesh_.positionTransform());
       uNormalMatrix_.set(glm::inverse(glm::mat3(model_matrix_)));
       tree_info_->mesh_.render();
     }
@@ -417,26 +410,31 @@ class BulletForest : public engine::GameObject {
   std::array<std::unique_ptr<TreeInfo>, 3> tree_infos_;
 
  public:
-  BulletForest(GameObject *parent, const engine::HeightMapInterface& hmap)
+  BulletForest(GameObject *parent, const engine::HeightMapInterface& hmap,
+               engine::PhysicsStreamer* streamer)
       : GameObject(parent)
       , prog_(scene_->shader_manager()->get("tree.vert"),
               scene_->shader_manager()->get("tree.frag"))
       , shadow_prog_(scene_->shader_manager()->get("tree_shadow.vert"),
                    scene_->shader_manager()->get("tree_shadow.frag"))
       , uProjectionMatrix_(prog_, "uProjectionMatrix") {
-    gl::Use(prog_);
-    gl::UniformSampler(prog_, "uDiffuseTexture").set(0);
-
     tree_infos_[0] = engine::make_unique<TreeInfo>(
         "src/resources/models/trees/massive_swamptree_01_a");
     tree_infos_[1] = engine::make_unique<TreeInfo>(
         "src/resources/models/trees/massive_swamptree_01_b");
     tree_infos_[2] = engine::make_unique<TreeInfo>(
         "src/resources/models/trees/cedar_01_a_source");
+    prog_.setup([this]() {
+      gl::Use(prog_);
+      gl::UniformSampler(prog_, "uDiffuseTexture").set(0);
+      for (auto& tree_info : tree_infos_) {
+        tree_info->mesh_.setupVertexAttribs(
+            prog_ | "aPosition", prog_ | "aNormal", prog_ | "aTexCoord",
+            engine::VertexFormat::Compact);
+      }
+    });
+
     for (size_t i = 0; i != tree_infos_.size(); ++i) {
-      tree_infos_[i]->mesh_.setupPositions(prog_ | "aPosition");
-      tree_infos_[i]->mesh_.setupTexCoords(prog_ | "aTexCoord");
-      tree_infos_[i]->mesh_.setupNormals(prog_ | "aNormal");
       tree_infos_[i]->mesh_.setupDiffuseTextures(0);
 
       tree_infos_[i]->triangles_ = engine::make_unique<btTriangleIndexVertexArray>();
@@ -470,21 +468,22 @@ class BulletForest : public engine::GameObject {
         t.set_rot(rot);
         engine::BoundingBox bbox = tree_infos_[type]->mesh_.boundingBox(t.matrix());
 
-        addComponent<BulletTree>(t, tree_infos_[type].get(), bbox, prog_, shadow_prog_);
+        addComponent<BulletTree>(t, tree_infos_[type].get(), bbox,
+                                 prog_, shadow_prog_, streamer);
       }
     }
   }
 
   virtual void shadowRender() override {
-    gl::Use(shadow_prog_);
+    engine::GlState::Use(shadow_prog_);
   }
 
   virtual void render() override {
-    gl::Use(prog_);
+    engine::GlState::Use(prog_);
     prog_.update();
     uProjectionMatrix_ = scene_->camera()->projectionMatrix();
 
-    gl::BlendFunc(gl::kSrcAlpha, gl::kOneMinusSrcAlpha);
+    engine::GlState::BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
     // The trees' render will run here
   }
@@ -537,8 +536,11 @@ class BulletHeightFieldScene : public engine::Scene {
     Shadow *shadow = addComponent<Shadow>(skybox, 2048, 2, 2);
     set_shadow(shadow);
 
-    auto hf = addComponent<HeightField>();
-    addComponent<BulletForest>(hf->terrain_->height_map());
+    // Static colliders are only kept in the world near the active bodies.
+    // It has to be added before its colliders' owners, so they outlive it.
+    auto streamer = addComponent<engine::PhysicsStreamer>(128.0f);
+    auto hf = addComponent<HeightField>(streamer);
+    addComponent<BulletForest>(hf->terrain_->height_map(), streamer);
 
     dynamic_objects = addComponent<GameObject>();
 
@@ -567,35 +569,6 @@ class BulletHeightFieldScene : public engine::Scene {
     addComponent<FpsDisplay>();
   }
 
-  void findCollisions() {
-    int num_manifolds = world_->getDispatcher()->getNumManifolds();
-    for (int i = 0; i < num_manifolds; ++i) {
-      btPersistentManifold* contact_manifold =
-         world_->getDispatcher()->getManifoldByIndexInternal(i);
-      const btCollisionObject* obA = contact_manifold->getBody0();
-      const btCollisionObject* obB = contact_manifold->getBody1();
-
-      int num_contacts = contact_manifold->getNumContacts();
-      for (int j = 0; j < num_contacts; ++j) {
-        btManifoldPoint& pt = contact_manifold->getContactPoint(j);
-        if (pt.getDistance() < 1e-3f) {
-          // const btVector3& ptA = pt.getPositionWorldOnA();
-          // const btVector3& ptB = pt.getPositionWorldOnB();
-          // const btVector3& normalOnB = pt.m_normalWorldOnB;
-          auto go1 = (engine::GameObject*)obA->getUserPointer();
-          auto go2 = (engine::GameObject*)obB->getUserPointer();
-          if (go1) { go1->collisionAll(go2); }
-          if (go2) { go2->collisionAll(go1); }
-        }
-      }
-    }
-  }
-
-  virtual void update() override {
-    Scene::update();
-    findCollisions();
-  }
-
   virtual void updatePhysics() override {
     world_->stepSimulation(game_time().dt, 4);
   }
@@ -4,8 +4,10 @@
 
 #include <iostream>
 #include <string>
+#include <utility>
 
 #include "../engine/rigid_body.h"
+#include "../engine/async_loader.h"
 #include "../engine/game_engine.h"
 #include "../engine/shader_manager.h"
 
@@ -15,6 +17,7 @@
 #include "../after_effects.h"
 #include "../ayumi.h"
 #include "../tree.h"
+#include "../crowd.h"
 #include "../shadow.h"
 #include "../fps_display.h"
 
@@ -43,10 +46,22 @@ MainScene::MainScene() {
   // The scene builds quite slow, put some picture for the user.
   last_debug_time = glfwGetTime();
   PrintDebugText("Drawing the loading screen");
-    LoadingScreen().render();
+    LoadingScreen loading_screen;
+    loading_screen.render();
     glfwSwapBuffers(window);
   PrintDebugTime();
 
+  // The meshes, the animations and the images are decoded on worker threads,
+  // and uploaded in small slices on the main thread, while it keeps
+  // redrawing the loading screen.
+  PrintDebugText("Starting the asset loading");
+    engine::AsyncLoader loader;
+    Terrain::Assets terrain_assets = Terrain::LoadAssets(&loader);
+    Ayumi::Assets ayumi_assets = Ayumi::LoadAssets(&loader);
+    Tree::Assets tree_assets = Tree::LoadAssets(&loader);
+    Crowd::Assets crowd_assets = Crowd::LoadAssets(&loader);
+  PrintDebugTime();
+
   PrintDebugText("Initializing the skybox");
     Skybox *skybox = addComponent<Skybox>();
   PrintDebugTime();
@@ -56,13 +71,20 @@ MainScene::MainScene() {
     set_shadow(shadow);
   PrintDebugTime();
 
+  PrintDebugText("Waiting for the asset loading");
+    loader.finish([&]() {
+      loading_screen.render();
+      glfwSwapBuffers(window);
+    });
+  PrintDebugTime();
+
   PrintDebugText("Initializing the terrain");
-    Terrain *terrain = addComponent<Terrain>();
+    Terrain *terrain = addComponent<Terrain>(std::move(terrain_assets));
   PrintDebugTime();
   const engine::HeightMapInterface& height_map = terrain->height_map();
 
   PrintDebugText("Initializing Ayumi");
-    Ayumi *ayumi = addComponent<Ayumi>();
+    Ayumi *ayumi = addComponent<Ayumi>(std::move(ayumi_assets));
     ayumi->addComponent<engine::RigidBody>(ayumi->transform(), height_map, 0);
 
     CharacterMovement *charmove = ayumi->addComponent<CharacterMovement>();
@@ -89,8 +111,13 @@ MainScene::MainScene() {
     charmove->setCamera(cam);
   PrintDebugTime();
 
+  // Opaque, so it's drawn before the blended trees
+  PrintDebugText("Initializing the crowd");
+    addComponent<Crowd>(height_map, std::move(crowd_assets));
+  PrintDebugTime();
+
   PrintDebugText("Initializing the trees");
-    addComponent<Tree>(height_map);
+    addComponent<Tree>(height_map, std::move(tree_assets));
   PrintDebugTime();
 
   PrintDebugText("Initializing the resources for the after effects");
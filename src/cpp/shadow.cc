@@ -3,6 +3,7 @@
 #include <vector>
 #include "./shadow.h"
 #include "./skybox.h"
+#include "engine/gl_state.h"
 #include "oglwrap/context.h"
 #include "oglwrap/smart_enums.h"
 
@@ -94,12 +95,12 @@ void Shadow::begin() {
   gl::Clear().Depth();
 
   // Setup the 0th shadowmap
-  gl::Viewport(0, 0, size_, size_);
+  engine::GlState::Viewport(0, 0, size_, size_);
 }
 
 void Shadow::setViewPort() {
   size_t x = curr_depth_ / xsize_, y = curr_depth_ % xsize_;
-  gl::Viewport(x*size_, y*size_, size_, size_);
+  engine::GlState::Viewport(x*size_, y*size_, size_, size_);
 }
 
 void Shadow::push() {
@@ -123,5 +124,5 @@ void Shadow::end() {
   } else {
     gl::Unbind(fbo_);
   }
-  gl::Viewport(w_, h_);
+  engine::GlState::Viewport(0, 0, w_, h_);
 }
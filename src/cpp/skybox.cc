@@ -18,9 +18,11 @@ Skybox::Skybox(engine::GameObject* parent)
     gl::Uniform<glm::vec3>(prog, "uSunPos") = getSunPos();
   });
 
-  gl::Use(prog_);
-  prog_.validate();
-  (prog_ | "aPosition").bindLocation(cube_.kPosition);
+  prog_.setup([this]() {
+    gl::Use(prog_);
+    prog_.validate();
+    prog_.bindAttribLocation("aPosition", cube_.kPosition);
+  });
 }
 
 glm::vec3 Skybox::getSunPos() const {
@@ -42,14 +44,14 @@ void Skybox::update() {
 void Skybox::render() {
   auto cam = scene_->camera();
 
-  gl::Use(prog_);
+  engine::GlState::Use(prog_);
   prog_.update();
   uCameraMatrix_ = glm::mat3(cam->cameraMatrix());
   uProjectionMatrix_ = cam->projectionMatrix();
 
-  gl::TemporaryDisable depth_test{gl::kDepthTest};
+  engine::GlState::TemporarySet depth_test{{{GL_DEPTH_TEST, false}}};
 
-  gl::DepthMask(false);
+  engine::GlState::DepthMask(false);
   cube_.render();
-  gl::DepthMask(true);
+  engine::GlState::DepthMask(true);
 }
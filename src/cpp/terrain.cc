@@ -5,9 +5,41 @@
 
 #include "engine/scene.h"
 
-Terrain::Terrain(engine::GameObject* parent)
+static const char* kHeightMapFile = "src/resources/terrain/terrain.png";
+static const char* kGrassMapFiles[] = {
+  "src/resources/textures/grass.jpg",
+  "src/resources/textures/grass_2.jpg"
+};
+static const char* kGrassNormalMapFile =
+  "src/resources/textures/grass_normal.jpg";
+
+// The grass maps don't have an alpha channel (they are compressed as BC1),
+// and the normal map only needs its first two channels (BC5), the shader
+// reconstructs the third one. The normal map is not in srgb space.
+static const char* kGrassMapFormat = "CSRGB";
+static const char* kGrassNormalMapFormat = "CRG";
+
+Terrain::Assets Terrain::LoadAssets(engine::AsyncLoader* loader) {
+  Assets assets;
+  assets.height_map = loader->run([]() {
+    return engine::TextureSource<GLubyte, 1>{kHeightMapFile, "CR"};
+  });
+
+  assets.textures =
+    std::make_shared<std::vector<engine::TextureCache::TexturePtr>>();
+  for (const char* filename : kGrassMapFiles) {
+    engine::TextureCache::LoadAsync(loader, filename, kGrassMapFormat,
+                                    assets.textures);
+  }
+  engine::TextureCache::LoadAsync(loader, kGrassNormalMapFile,
+                                  kGrassNormalMapFormat, assets.textures);
+
+  return assets;
+}
+
+Terrain::Terrain(engine::GameObject* parent, Assets assets)
     : engine::GameObject(parent)
-    , height_map_("src/resources/terrain/terrain.png")
+    , height_map_(assets.height_map.get())
     , mesh_(scene_->shader_manager(), height_map_)
     , prog_(scene_->shader_manager()->get("terrain.vert"),
             scene_->shader_manager()->get("terrain.frag"))
@@ -17,45 +49,37 @@ Terrain::Terrain(engine::GameObject* parent)
     , uShadowCP_(prog_, "uShadowCP")
     , uNumUsedShadowMaps_(prog_, "uNumUsedShadowMaps")
     , uShadowAtlasSize_(prog_, "uShadowAtlasSize") {
-  gl::Use(prog_);
-  mesh_.setup(prog_, 1);
-  gl::UniformSampler(prog_, "uGrassMap0").set(2);
-  gl::UniformSampler(prog_, "uGrassMap1").set(3);
   for (int i = 0; i < 2; ++i) {
-    gl::Bind(grassMaps_[i]);
-    // no alpha channel here
-    grassMaps_[i].loadTexture(std::string{"src/resources/textures/"} +
-        (i == 0 ? "grass.jpg" : "grass_2.jpg"), "CSRGB");
-    grassMaps_[i].generateMipmap();
-    grassMaps_[i].maxAnisotropy();
-    grassMaps_[i].minFilter(gl::kLinearMipmapLinear);
-    grassMaps_[i].magFilter(gl::kLinear);
-    grassMaps_[i].wrapS(gl::kRepeat);
-    grassMaps_[i].wrapT(gl::kRepeat);
-  }
-
-  gl::UniformSampler(prog_, "uGrassNormalMap").set(4);
-  gl::Bind(grassNormalMap_);
-  {
-    // the normal map doesn't have an alpha channel, and is not is srgb space
-    grassNormalMap_.loadTexture("src/resources/textures/grass_normal.jpg", "CRGB");
-    grassNormalMap_.generateMipmap();
-    grassNormalMap_.minFilter(gl::kLinearMipmapLinear);
-    grassNormalMap_.magFilter(gl::kLinear);
-    grassNormalMap_.wrapS(gl::kRepeat);
-    grassNormalMap_.wrapT(gl::kRepeat);
+    grassMaps_[i] = engine::TextureCache::load(kGrassMapFiles[i],
+                                               kGrassMapFormat);
+    gl::Bind(*grassMaps_[i]);
+    grassMaps_[i]->maxAnisotropy();
+    grassMaps_[i]->wrapS(gl::kRepeat);
+    grassMaps_[i]->wrapT(gl::kRepeat);
   }
 
-  gl::UniformSampler(prog_, "uShadowMap").set(5);
+  grassNormalMap_ = engine::TextureCache::load(kGrassNormalMapFile,
+                                               kGrassNormalMapFormat);
+  gl::Bind(*grassNormalMap_);
+  grassNormalMap_->wrapS(gl::kRepeat);
+  grassNormalMap_->wrapT(gl::kRepeat);
 
-  prog_.validate();
+  prog_.setup([this]() {
+    gl::Use(prog_);
+    mesh_.setup(prog_, 1);
+    gl::UniformSampler(prog_, "uGrassMap0").set(2);
+    gl::UniformSampler(prog_, "uGrassMap1").set(3);
+    gl::UniformSampler(prog_, "uGrassNormalMap").set(4);
+    gl::UniformSampler(prog_, "uShadowMap").set(5);
+    prog_.validate();
+  });
 }
 
 void Terrain::render() {
   const engine::Camera& cam = *scene_->camera();
   const Shadow *shadow = scene_->shadow();
 
-  gl::Use(prog_);
+  engine::GlState::Use(prog_);
   prog_.update();
   uCameraMatrix_ = cam.cameraMatrix();
   uProjectionMatrix_ = cam.projectionMatrix();
@@ -68,21 +92,22 @@ void Terrain::render() {
     uShadowAtlasSize_ = shadow->getAtlasDimensions();
   }
 
-  gl::BindToTexUnit(grassMaps_[0], 2);
-  gl::BindToTexUnit(grassMaps_[1], 3);
-  gl::BindToTexUnit(grassNormalMap_, 4);
+  // GlState::BeginFrame forgets the texture bindings (the load time code
+  // binds textures directly), so these binds are issued in every frame.
+  engine::GlState::BindTexture(2, *grassMaps_[0]);
+  engine::GlState::BindTexture(3, *grassMaps_[1]);
+  engine::GlState::BindTexture(4, *grassNormalMap_);
   if (shadow) {
-    gl::BindToTexUnit(shadow->shadowTex(), 5);
+    engine::GlState::BindTexture(5, shadow->shadowTex());
   }
 
   mesh_.render(cam);
 
+  // The shadow map is rendered to in the next frame, so it shouldn't be
+  // left bound.
   if (shadow) {
-    gl::UnbindFromTexUnit(shadow->shadowTex(), 5);
+    engine::GlState::BindTexture(5, 0);
   }
-  gl::UnbindFromTexUnit(grassNormalMap_, 4);
-  gl::UnbindFromTexUnit(grassMaps_[1], 3);
-  gl::UnbindFromTexUnit(grassMaps_[0], 2);
 }
 
 
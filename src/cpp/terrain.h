@@ -3,18 +3,35 @@
 #ifndef LOD_TERRAIN_H_
 #define LOD_TERRAIN_H_
 
+#include <future>
+#include <memory>
+#include <vector>
+
 #include "./skybox.h"
 #include "./shadow.h"
 #include "engine/oglwrap_config.h"
 
 #include "engine/height_map.h"
 #include "engine/game_object.h"
+#include "engine/async_loader.h"
+#include "engine/texture_cache.h"
 #include "engine/shader_manager.h"
 #include "engine/cdlod/terrain_mesh.h"
 
 class Terrain : public engine::GameObject {
  public:
-  explicit Terrain(engine::GameObject* parent);
+  /// The height map and the textures, loaded on worker threads.
+  struct Assets {
+    std::future<engine::TextureSource<GLubyte, 1>> height_map;
+    /// Keeps the textures in the TextureCache, they are uploaded by the
+    /// loader's main thread tasks.
+    std::shared_ptr<std::vector<engine::TextureCache::TexturePtr>> textures;
+  };
+
+  /// Starts loading the height map and the textures.
+  static Assets LoadAssets(engine::AsyncLoader* loader);
+
+  Terrain(engine::GameObject* parent, Assets assets);
   virtual ~Terrain() {}
 
   const engine::HeightMapInterface& height_map() { return height_map_; }
@@ -24,7 +41,7 @@ class Terrain : public engine::GameObject {
   engine::cdlod::TerrainMesh mesh_;
   engine::ShaderProgram prog_;  // has to be inited after mesh_
 
-  gl::Texture2D grassMaps_[2], grassNormalMap_;
+  engine::TextureCache::TexturePtr grassMaps_[2], grassNormalMap_;
   gl::LazyUniform<glm::mat4> uProjectionMatrix_, uCameraMatrix_,
                              uModelMatrix_, uShadowCP_;
   gl::LazyUniform<int> uNumUsedShadowMaps_;
@@ -1,10 +1,36 @@
 // Copyright (c) 2014, Tamas Csala
 
 #include "./tree.h"
+#include <cmath>
+#include <algorithm>
 #include "engine/scene.h"
 #include "oglwrap/debug/insertion.h"
 
-Tree::Tree(GameObject *parent, const engine::HeightMapInterface& height_map)
+static const char* kMeshFiles[] = {
+  "src/resources/models/trees/massive_swamptree_01_a.obj",
+  "src/resources/models/trees/massive_swamptree_01_b.obj",
+  "src/resources/models/trees/cedar_01_a_source.obj"
+};
+
+Tree::Assets Tree::LoadAssets(engine::AsyncLoader* loader) {
+  Assets assets;
+  for (unsigned i = 0; i < assets.meshes.size(); ++i) {
+    const char* filename = kMeshFiles[i];
+    assets.meshes[i] = loader->run([loader, filename]() {
+      engine::ImportedScene imported = engine::ImportedScene::Import(filename,
+          aiProcessPreset_TargetRealtime_Quality | aiProcess_FlipUVs |
+          aiProcess_PreTransformVertices);
+      imported.generateLods();
+      imported.loadTextures(loader, aiTextureType_DIFFUSE, true);
+      return imported;
+    });
+  }
+
+  return assets;
+}
+
+Tree::Tree(GameObject *parent, const engine::HeightMapInterface& height_map,
+           Assets assets)
     : GameObject(parent)
     , prog_(scene_->shader_manager()->get("tree.vert"),
             scene_->shader_manager()->get("tree.frag"))
@@ -14,35 +40,29 @@ Tree::Tree(GameObject *parent, const engine::HeightMapInterface& height_map)
     , uModelCameraMatrix_(prog_, "uModelCameraMatrix")
     , uNormalMatrix_(prog_, "uNormalMatrix")
     , shadow_uMCP_(shadow_prog_, "uMCP") {
-  gl::Use(shadow_prog_);
-  gl::UniformSampler(shadow_prog_, "uDiffuseTexture").set(0);
-  shadow_prog_.validate();
-
-  gl::Use(prog_);
-
-  meshes_[0] = engine::make_unique<engine::MeshRenderer>(
-    "src/resources/models/trees/massive_swamptree_01_a.obj",
-    aiProcessPreset_TargetRealtime_Quality | aiProcess_FlipUVs |
-    aiProcess_PreTransformVertices);
-  meshes_[1] = engine::make_unique<engine::MeshRenderer>(
-    "src/resources/models/trees/massive_swamptree_01_b.obj",
-    aiProcessPreset_TargetRealtime_Quality | aiProcess_FlipUVs |
-    aiProcess_PreTransformVertices);
-  meshes_[2] = engine::make_unique<engine::MeshRenderer>(
-    "src/resources/models/trees/cedar_01_a_source.obj",
-    aiProcessPreset_TargetRealtime_Quality | aiProcess_FlipUVs |
-    aiProcess_PreTransformVertices);
+  shadow_prog_.setup([this]() {
+    gl::Use(shadow_prog_);
+    gl::UniformSampler(shadow_prog_, "uDiffuseTexture").set(0);
+    shadow_prog_.validate();
+  });
 
   for (unsigned i = 0; i < meshes_.size(); ++i) {
-    meshes_[i]->setupPositions(prog_ | "aPosition");
-    meshes_[i]->setupTexCoords(prog_ | "aTexCoord");
-    meshes_[i]->setupNormals(prog_ | "aNormal");
+    meshes_[i] = engine::make_unique<engine::MeshRenderer>(
+        assets.meshes[i].get());
+    meshes_[i]->setupLods();
     meshes_[i]->setupDiffuseTextures(0);
   }
 
-  gl::UniformSampler(prog_, "uDiffuseTexture").set(0);
-
-  prog_.validate();
+  prog_.setup([this]() {
+    gl::Use(prog_);
+    for (auto& mesh : meshes_) {
+      mesh->setupVertexAttribs(prog_ | "aPosition", prog_ | "aNormal",
+                               prog_ | "aTexCoord",
+                               engine::VertexFormat::Compact);
+    }
+    gl::UniformSampler(prog_, "uDiffuseTexture").set(0);
+    prog_.validate();
+  });
 
   // Get the trees' positions.
   const int kTreeDist = 150;
@@ -74,35 +94,44 @@ Tree::Tree(GameObject *parent, const engine::HeightMapInterface& height_map)
   }
 }
 
+float Tree::screenSize(const TreeInfo& tree, const engine::Camera& cam) {
+  glm::vec3 extent = tree.bbox.extent();
+  float radius = glm::length(extent) / 2;
+  float dist = glm::length(tree.bbox.center() - cam.transform()->pos());
+  return radius / (std::max(dist, radius) * std::tan(cam.fovy() / 2));
+}
+
 void Tree::shadowRender() {
-  gl::Use(shadow_prog_);
+  engine::GlState::Use(shadow_prog_);
 
   auto shadow = scene_->shadow();
-  gl::TemporaryDisable cullface{gl::kCullFace};
+  engine::GlState::TemporarySet cullface{{{GL_CULL_FACE, false}}};
 
   const auto& cam = *scene_->camera();
   auto campos = cam.transform()->pos();
   for (size_t i = 0; i < trees_.size() &&
       shadow->getDepth() < shadow->getMaxDepth(); i++) {
     if (glm::length(glm::vec3(trees_[i].mat[3]) - campos) < 150) {
+      auto& mesh = meshes_[trees_[i].type];
+      mesh->selectLod(screenSize(trees_[i], cam));
       shadow_uMCP_ = shadow->modelCamProjMat(
-          trees_[i].bsphere, trees_[i].mat, glm::mat4{});
-      meshes_[trees_[i].type]->render();
+          trees_[i].bsphere, trees_[i].mat, mesh->positionTransform());
+      mesh->render();
       shadow->push();
     }
   }
 }
 
 void Tree::render() {
-  gl::Use(prog_);
+  engine::GlState::Use(prog_);
   prog_.update();
 
   const auto& cam = *scene_->camera();
   uProjectionMatrix_ = cam.projectionMatrix();
 
-  gl::TemporarySet capabilities{{{gl::kBlend, true},
-                                 {gl::kCullFace, false}}};
-  gl::BlendFunc(gl::kSrcAlpha, gl::kOneMinusSrcAlpha);
+  engine::GlState::TemporarySet capabilities{{{GL_BLEND, true},
+                                              {GL_CULL_FACE, false}}};
+  engine::GlState::BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
   auto campos = cam.transform()->pos();
   auto cam_mx = cam.cameraMatrix();
@@ -115,8 +144,9 @@ void Tree::render() {
     }
 
     auto& mesh = meshes_[trees_[i].type];
+    mesh->selectLod(screenSize(trees_[i], cam));
     glm::mat4 model_mx = trees_[i].mat;
-    uModelCameraMatrix_.set(cam_mx * model_mx);
+    uModelCameraMatrix_.set(cam_mx * model_mx * mesh->positionTransform());
     uNormalMatrix_.set(glm::inverse(glm::mat3(model_mx)));
     mesh->render();
   }
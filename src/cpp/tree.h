@@ -5,17 +5,29 @@
 
 #include <vector>
 #include <array>
+#include <future>
 
 #include "engine/oglwrap_config.h"
 #include "engine/scene.h"
 #include "engine/game_object.h"
+#include "engine/async_loader.h"
 #include "engine/shader_manager.h"
 #include "engine/mesh/mesh_renderer.h"
 #include "engine/height_map_interface.h"
 
 class Tree : public engine::GameObject {
  public:
-  Tree(GameObject *parent, const engine::HeightMapInterface& height_map);
+  /// The meshes of the tree types, imported and simplified on worker
+  /// threads. Their textures are uploaded by the loader's main thread tasks.
+  struct Assets {
+    std::array<std::future<engine::ImportedScene>, 3> meshes;
+  };
+
+  /// Starts loading the meshes and their textures.
+  static Assets LoadAssets(engine::AsyncLoader* loader);
+
+  Tree(GameObject *parent, const engine::HeightMapInterface& height_map,
+       Assets assets);
   virtual ~Tree() {}
   virtual void shadowRender() override;
   virtual void render() override;
@@ -38,6 +50,10 @@ class Tree : public engine::GameObject {
   };
 
   std::vector<TreeInfo> trees_;
+
+  // Returns the projected radius of a tree, relative to the half of the
+  // screen's height (that's what MeshRenderer::selectLod expects).
+  static float screenSize(const TreeInfo& tree, const engine::Camera& cam);
 };
 
 #endif  // LOD_TREE_H_
@@ -0,0 +1,22 @@
+// Copyright (c) 2014, Tamas Csala
+
+#version 120
+
+#include "engine/skinning.vert"
+
+attribute vec4 aPosition;
+attribute vec3 aNormal;
+
+// These are captured with transform feedback, and
+// read back by the other passes as aPosition and aNormal.
+varying vec3 vSkinnedPosition;
+varying vec3 vSkinnedNormal;
+
+void main() {
+  mat4 BoneMatrix = Skinning_boneMatrix();
+  vSkinnedPosition = vec3(BoneMatrix * aPosition);
+  vSkinnedNormal = mat3(BoneMatrix) * aNormal;
+
+  // Nothing is rasterized in this pass
+  gl_Position = vec4(vSkinnedPosition, 1.0);
+}
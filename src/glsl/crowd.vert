@@ -0,0 +1,34 @@
+// Copyright (c) 2014, Tamas Csala
+
+#version 120
+
+#include "engine/vertex_animation.vert"
+
+attribute vec4 aPosition;
+attribute vec2 aTexCoord;
+attribute vec3 aNormal;
+
+uniform mat4 uProjectionMatrix, uCameraMatrix;
+
+// The same as ayumi.vert's, so the characters are lit by ayumi.frag too
+varying vec3 w_vNormal, c_vNormal;
+varying vec3 w_vPos, c_vPos;
+varying vec2 vTexCoord;
+
+void main() {
+  mat4 ModelMatrix = VertexAnimation_modelMatrix();
+  mat4 BoneMatrix = VertexAnimation_boneMatrix();
+
+  vec3 w_normal = mat3(ModelMatrix) * (mat3(BoneMatrix) * aNormal);
+  w_vNormal = w_normal;
+  c_vNormal = mat3(uCameraMatrix) * w_normal;
+  vTexCoord = aTexCoord;
+
+  vec4 w_pos = ModelMatrix * (BoneMatrix * aPosition);
+  vec4 c_pos = uCameraMatrix * w_pos;
+
+  c_vPos = vec3(c_pos);
+  w_vPos = vec3(w_pos);
+
+  gl_Position = uProjectionMatrix * c_pos;
+}
@@ -0,0 +1,145 @@
+// Copyright (c) 2014, Tamas Csala
+
+#version 120
+
+#export mat4 Skinning_boneMatrix();
+
+// External macros
+#define BONE_NUM
+#define BONE_ATTRIB_NUM
+#define DUAL_QUATERNION_SKINNING
+#define BONE_PALETTE_UBO
+
+#if BONE_PALETTE_UBO
+  #extension GL_ARB_uniform_buffer_object : require
+#endif
+
+#if BONE_ATTRIB_NUM > 0
+attribute vec4 aBoneIDs0;
+attribute vec4 aWeights0;
+#endif
+#if BONE_ATTRIB_NUM > 1
+attribute vec4 aBoneIDs1;
+attribute vec4 aWeights1;
+#endif
+#if BONE_ATTRIB_NUM > 2
+attribute vec4 aBoneIDs2;
+attribute vec4 aWeights2;
+#endif
+#if BONE_ATTRIB_NUM > 3
+attribute vec4 aBoneIDs3;
+attribute vec4 aWeights3;
+#endif
+#if BONE_ATTRIB_NUM > 4
+attribute vec4 aBoneIDs4;
+attribute vec4 aWeights4;
+#endif
+#if BONE_ATTRIB_NUM > 5
+attribute vec4 aBoneIDs5;
+attribute vec4 aWeights5;
+#endif
+#if BONE_ATTRIB_NUM > 6
+attribute vec4 aBoneIDs6;
+attribute vec4 aWeights6;
+#endif
+#if BONE_ATTRIB_NUM > 7
+attribute vec4 aBoneIDs7;
+attribute vec4 aWeights7;
+#endif
+
+#if DUAL_QUATERNION_SKINNING
+  #define BONE_VECTORS 2
+#else
+  #define BONE_VECTORS 3
+#endif
+
+// Either the first three rows of the bones' affine transformations,
+// or the bones' unit dual quaternions (the real part first).
+#if BONE_PALETTE_UBO
+  // Uploaded once per frame, and shared by all the passes (BonePaletteBuffer)
+  layout(std140) uniform BonePalette {
+    vec4 uBones[BONE_NUM * BONE_VECTORS];
+  };
+#else
+  uniform vec4 uBones[BONE_NUM * BONE_VECTORS];
+#endif
+
+// Adds the weighted transformations of four bones to the sum.
+void Skinning_addBones(vec4 ids, vec4 weights,
+                       inout vec4 sum[BONE_VECTORS]) {
+  for (int j = 0; j < 4; j++) {
+    int bone = BONE_VECTORS * int(ids[j]);
+    float weight = weights[j];
+    #if DUAL_QUATERNION_SKINNING
+      // q and -q are the same rotation, but they only blend
+      // correctly if they are in the same hemisphere.
+      if (dot(uBones[bone], sum[0]) < 0.0) {
+        weight = -weight;
+      }
+    #endif
+    for (int k = 0; k < BONE_VECTORS; k++) {
+      sum[k] += uBones[bone + k] * weight;
+    }
+  }
+}
+
+#if DUAL_QUATERNION_SKINNING
+mat4 Skinning_dualQuatToMatrix(vec4 real, vec4 dual) {
+  float len = length(real);
+  real /= len;
+  dual /= len;
+
+  vec3 r = real.xyz;
+  float w = real.w;
+  vec3 t = 2.0 * (w * dual.xyz - dual.w * r + cross(r, dual.xyz));
+
+  return mat4(1.0 - 2.0*(r.y*r.y + r.z*r.z), 2.0*(r.x*r.y + w*r.z),
+              2.0*(r.x*r.z - w*r.y), 0.0,
+              2.0*(r.x*r.y - w*r.z), 1.0 - 2.0*(r.x*r.x + r.z*r.z),
+              2.0*(r.y*r.z + w*r.x), 0.0,
+              2.0*(r.x*r.z + w*r.y), 2.0*(r.y*r.z - w*r.x),
+              1.0 - 2.0*(r.x*r.x + r.y*r.y), 0.0,
+              t, 1.0);
+}
+#endif
+
+mat4 Skinning_boneMatrix() {
+  vec4 sum[BONE_VECTORS];
+  for (int k = 0; k < BONE_VECTORS; k++) {
+    sum[k] = vec4(0);
+  }
+  #if BONE_ATTRIB_NUM > 0
+    Skinning_addBones(aBoneIDs0, aWeights0, sum);
+  #endif
+  #if BONE_ATTRIB_NUM > 1
+    Skinning_addBones(aBoneIDs1, aWeights1, sum);
+  #endif
+  #if BONE_ATTRIB_NUM > 2
+    Skinning_addBones(aBoneIDs2, aWeights2, sum);
+  #endif
+  #if BONE_ATTRIB_NUM > 3
+    Skinning_addBones(aBoneIDs3, aWeights3, sum);
+  #endif
+  #if BONE_ATTRIB_NUM > 4
+    Skinning_addBones(aBoneIDs4, aWeights4, sum);
+  #endif
+  #if BONE_ATTRIB_NUM > 5
+    Skinning_addBones(aBoneIDs5, aWeights5, sum);
+  #endif
+  #if BONE_ATTRIB_NUM > 6
+    Skinning_addBones(aBoneIDs6, aWeights6, sum);
+  #endif
+  #if BONE_ATTRIB_NUM > 7
+    Skinning_addBones(aBoneIDs7, aWeights7, sum);
+  #endif
+
+  #if DUAL_QUATERNION_SKINNING
+    return Skinning_dualQuatToMatrix(sum[0], sum[1]);
+  #else
+    // The weights add up to 1, so the last row is always (0, 0, 0, 1).
+    return mat4(sum[0].x, sum[1].x, sum[2].x, 0,
+                sum[0].y, sum[1].y, sum[2].y, 0,
+                sum[0].z, sum[1].z, sum[2].z, 0,
+                sum[0].w, sum[1].w, sum[2].w, 1);
+  #endif
+}
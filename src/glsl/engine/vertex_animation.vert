@@ -0,0 +1,121 @@
+// Copyright (c) 2014, Tamas Csala
+
+#version 120
+
+#export mat4 VertexAnimation_modelMatrix();
+#export mat4 VertexAnimation_boneMatrix();
+
+// Plays back the animations baked into an engine::AnimationTexture,
+// for the instances drawn with AnimatedMeshRenderer::renderInstances.
+
+// External macros
+#define BONE_ATTRIB_NUM
+
+#if BONE_ATTRIB_NUM > 0
+attribute vec4 aBoneIDs0;
+attribute vec4 aWeights0;
+#endif
+#if BONE_ATTRIB_NUM > 1
+attribute vec4 aBoneIDs1;
+attribute vec4 aWeights1;
+#endif
+#if BONE_ATTRIB_NUM > 2
+attribute vec4 aBoneIDs2;
+attribute vec4 aWeights2;
+#endif
+#if BONE_ATTRIB_NUM > 3
+attribute vec4 aBoneIDs3;
+attribute vec4 aWeights3;
+#endif
+#if BONE_ATTRIB_NUM > 4
+attribute vec4 aBoneIDs4;
+attribute vec4 aWeights4;
+#endif
+#if BONE_ATTRIB_NUM > 5
+attribute vec4 aBoneIDs5;
+attribute vec4 aWeights5;
+#endif
+#if BONE_ATTRIB_NUM > 6
+attribute vec4 aBoneIDs6;
+attribute vec4 aWeights6;
+#endif
+#if BONE_ATTRIB_NUM > 7
+attribute vec4 aBoneIDs7;
+attribute vec4 aWeights7;
+#endif
+
+// Per instance attributes (see engine::VertexAnimationInstance)
+attribute vec4 VertexAnimation_aTransform0;
+attribute vec4 VertexAnimation_aTransform1;
+attribute vec4 VertexAnimation_aTransform2;
+attribute vec4 VertexAnimation_aAnimation;
+
+uniform sampler2D VertexAnimation_uTexture;
+uniform vec2 VertexAnimation_uTexSize;
+uniform float VertexAnimation_uTime;
+
+mat4 VertexAnimation_modelMatrix() {
+  vec4 row0 = VertexAnimation_aTransform0;
+  vec4 row1 = VertexAnimation_aTransform1;
+  vec4 row2 = VertexAnimation_aTransform2;
+  return mat4(row0.x, row1.x, row2.x, 0,
+              row0.y, row1.y, row2.y, 0,
+              row0.z, row1.z, row2.z, 0,
+              row0.w, row1.w, row2.w, 1);
+}
+
+// Adds the weighted transformations of four bones to the sum.
+void VertexAnimation_addBones(vec4 ids, vec4 weights, float v,
+                              inout vec4 sum[3]) {
+  for (int j = 0; j < 4; j++) {
+    float u = 3.0 * ids[j] + 0.5;
+    for (int k = 0; k < 3; k++) {
+      vec2 tex_coord = vec2(u + float(k), v) / VertexAnimation_uTexSize;
+      sum[k] += texture2DLod(VertexAnimation_uTexture, tex_coord, 0.0)
+                * weights[j];
+    }
+  }
+}
+
+mat4 VertexAnimation_boneMatrix() {
+  // x: first row, y: frame count, z: frame at time 0, w: frames per second
+  vec4 anim = VertexAnimation_aAnimation;
+  float frame = mod(anim.z + VertexAnimation_uTime * anim.w, anim.y);
+  // The filtering interpolates between this and the next frame
+  float v = anim.x + frame + 0.5;
+
+  vec4 sum[3];
+  for (int k = 0; k < 3; k++) {
+    sum[k] = vec4(0);
+  }
+  #if BONE_ATTRIB_NUM > 0
+    VertexAnimation_addBones(aBoneIDs0, aWeights0, v, sum);
+  #endif
+  #if BONE_ATTRIB_NUM > 1
+    VertexAnimation_addBones(aBoneIDs1, aWeights1, v, sum);
+  #endif
+  #if BONE_ATTRIB_NUM > 2
+    VertexAnimation_addBones(aBoneIDs2, aWeights2, v, sum);
+  #endif
+  #if BONE_ATTRIB_NUM > 3
+    VertexAnimation_addBones(aBoneIDs3, aWeights3, v, sum);
+  #endif
+  #if BONE_ATTRIB_NUM > 4
+    VertexAnimation_addBones(aBoneIDs4, aWeights4, v, sum);
+  #endif
+  #if BONE_ATTRIB_NUM > 5
+    VertexAnimation_addBones(aBoneIDs5, aWeights5, v, sum);
+  #endif
+  #if BONE_ATTRIB_NUM > 6
+    VertexAnimation_addBones(aBoneIDs6, aWeights6, v, sum);
+  #endif
+  #if BONE_ATTRIB_NUM > 7
+    VertexAnimation_addBones(aBoneIDs7, aWeights7, v, sum);
+  #endif
+
+  // The weights add up to 1, so the last row is always (0, 0, 0, 1).
+  return mat4(sum[0].x, sum[1].x, sum[2].x, 0,
+              sum[0].y, sum[1].y, sum[2].y, 0,
+              sum[0].z, sum[1].z, sum[2].z, 0,
+              sum[0].w, sum[1].w, sum[2].w, 1);
+}
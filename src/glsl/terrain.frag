@@ -98,7 +98,11 @@ void main() {
   normal_matrix[0] = normalize(vNormalMatrix[0]);
   normal_matrix[1] = normalize(vNormalMatrix[1]);
   normal_matrix[2] = normalize(vNormalMatrix[2]);
-  vec3 normal_offset = texture2D(uGrassNormalMap, vTexCoord*256).rgb;
+  // Only the first two channels of the normal map are stored (BC5), the
+  // third one is reconstructed, in the same [0, 1] encoding.
+  vec2 normal_xy = texture2D(uGrassNormalMap, vTexCoord*256).rg * 2.0 - 1.0;
+  vec3 normal_offset = 0.5 + 0.5 *
+      vec3(normal_xy, sqrt(max(1.0 - dot(normal_xy, normal_xy), 0.0)));
   vec3 w_normal = normalize(normal_matrix[2] + normal_matrix * normal_offset);
   vec3 c_normal = mat3(uCameraMatrix) * w_normal;
 